@@ -17,6 +17,7 @@
 
 #include "mdf_common.h"
 #include "mlink_json.h"
+#include "mlink_tlv.h"
 #include "mlink_utils.h"
 #include "mlink_notice.h"
 #include "mlink_httpd.h"
@@ -25,6 +26,7 @@
 #include "mlink_espnow.h"
 #include "mlink_ble.h"
 #include "mlink_sniffer.h"
+#include "mlink_shadow.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,6 +45,7 @@ extern "C" {
 enum mlink_protocol {
     MLINK_PROTO_HTTPD  = 0, /**< Http protocol communication */
     MLINK_PROTO_NOTICE = 1, /**< UDP protocol communication */
+    MLINK_PROTO_BINARY = 2, /**< Http protocol communication, the body is a compact binary frame, see mlink_tlv.h */
 };
 
 #ifdef __cplusplus
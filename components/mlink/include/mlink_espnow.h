@@ -24,6 +24,7 @@ extern "C" {
 #define MLINK_ESPNOW_PAYLOAD_LEN  (226)
 #define MLINK_ESPNOW_COMMUNICATE_UNICAST 0
 #define MLINK_ESPNOW_COMMUNICATE_GROUP   1
+#define MLINK_ESPNOW_BUF_SIZE            (250 * 4) /**< The largest packet, four ESP-NOW frames */
 
 
 /**
@@ -89,6 +90,29 @@ mdf_err_t __mlink_espnow_read(uint8_t **addrs_list, size_t *addrs_num, uint8_t *
 #define mlink_espnow_read(...)\
     __PASTE(mlink_espnow_read_, COUNT_PARMS(__VA_ARGS__))(__VA_ARGS__)
 
+/**
+ * @brief Receive a packet into a buffer of the caller, nothing is allocated
+ *
+ * @note  The returned pointers point into buf, they are valid until buf is reused
+ *
+ * @param  buf        Buffer that receives the packet, MLINK_ESPNOW_BUF_SIZE bytes for any packet
+ * @param  buf_size   The size of buf
+ * @param  addrs_list The address of the final destination of the packet
+ * @param  addrs_num  Number of destination addresses
+ * @param  data       Pointer to the received data
+ * @param  size       The length of the data
+ * @param  type       The type of the data, may be NULL
+ * @param  wait_ticks wait time if a packet isn't immediately available(0:no wait, portMAX_DELAY:wait forever)
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_FAIL
+ *    - MDF_ERR_INVALID_ARG
+ *    - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mlink_espnow_read_buf(void *buf, size_t buf_size, const uint8_t **addrs_list, size_t *addrs_num,
+                                const uint8_t **data, size_t *size, uint32_t *type, TickType_t wait_ticks);
+
 /**
  * @brief Initialize the use of ESP-NOW
  *
@@ -47,6 +47,38 @@ typedef enum {
     CHARACTERISTIC_FORMAT_STRING, /**< characteristic is a string format */
 } characteristic_format_t;
 
+/**
+ * @brief Numeric identifiers of the built-in requests
+ *
+ * @note The "request" field of a request can be either the name of the handler or its
+ *       numeric identifier, e.g. {"request":4,"cids":[0]} is the same as {"request":"get_status","cids":[0]}.
+ *       Identifiers of custom handlers should start from MLINK_HANDLE_ID_CUSTOM_BASE.
+ */
+typedef enum {
+    MLINK_HANDLE_ID_NONE               = 0,     /**< The handler has no numeric identifier */
+    MLINK_HANDLE_ID_RESET              = 1,     /**< reset */
+    MLINK_HANDLE_ID_REBOOT             = 2,     /**< reboot */
+    MLINK_HANDLE_ID_GET_DEVICE_INFO    = 3,     /**< get_device_info */
+    MLINK_HANDLE_ID_GET_STATUS         = 4,     /**< get_status */
+    MLINK_HANDLE_ID_SET_STATUS         = 5,     /**< set_status */
+    MLINK_HANDLE_ID_ADD_DEVICE         = 6,     /**< add_device */
+    MLINK_HANDLE_ID_RENAME_DEVICE      = 7,     /**< rename_device */
+    MLINK_HANDLE_ID_SET_POSITION       = 8,     /**< set_position */
+    MLINK_HANDLE_ID_GET_OTA_PROGRESS   = 9,     /**< get_ota_progress */
+    MLINK_HANDLE_ID_SET_OTA_FALLBACK   = 10,    /**< set_ota_fallback */
+    MLINK_HANDLE_ID_GET_MESH_CONFIG    = 11,    /**< get_mesh_config */
+    MLINK_HANDLE_ID_SET_MESH_CONFIG    = 12,    /**< set_mesh_config */
+    MLINK_HANDLE_ID_SET_GROUP          = 13,    /**< set_group */
+    MLINK_HANDLE_ID_GET_GROUP          = 14,    /**< get_group */
+    MLINK_HANDLE_ID_REMOVE_GROUP       = 15,    /**< remove_group */
+    MLINK_HANDLE_ID_GET_SNIFFER_INFO   = 16,    /**< get_sniffer_info */
+    MLINK_HANDLE_ID_GET_SNIFFER_CONFIG = 17,    /**< get_sniffer_config */
+    MLINK_HANDLE_ID_SET_SNIFFER_CONFIG = 18,    /**< set_sniffer_config */
+    MLINK_HANDLE_ID_GET_IBEACON_CONFIG = 19,    /**< get_ibeacon_config */
+    MLINK_HANDLE_ID_SET_IBEACON_CONFIG = 20,    /**< set_ibeacon_config */
+    MLINK_HANDLE_ID_CUSTOM_BASE        = 0x100, /**< Starting number of custom handlers */
+} mlink_handle_id_t;
+
 /**
  * @brief The data type of the parameter of the handler
  */
@@ -185,10 +217,49 @@ mdf_err_t mlink_handle(const uint8_t *src_addr, const mlink_httpd_type_t *type,
  */
 mdf_err_t mlink_set_handle(const char *name, const mlink_handle_func_t func);
 
+/**
+ * @brief Add or modify a request handler with a numeric identifier
+ *
+ * @param  name The name of the handler
+ * @param  id   The numeric identifier of the handler, 0 means none
+ * @param  func The pointer of the handler
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_FAIL
+ *     - MDF_ERR_INVALID_ARG: the identifier has been used by another handler
+ */
+mdf_err_t mlink_set_handle_id(const char *name, uint16_t id, const mlink_handle_func_t func);
+
+/**
+ * @brief Add or modify a request handler that also accepts compact binary requests
+ *
+ * @note Binary requests are dispatched only by the numeric identifier, their
+ *       handle_data->req_fromat is MLINK_HTTPD_FORMAT_HEX and handle_data->req_data
+ *       is the whole frame described in mlink_tlv.h. The handler puts only its
+ *       response items into handle_data->resp_data, the request identifier and
+ *       MLINK_TLV_TYPE_STATUS are added by mlink_handle_request().
+ *
+ * @param  name The name of the handler
+ * @param  id   The numeric identifier of the handler, can not be 0
+ * @param  func The pointer of the handler
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_FAIL
+ *     - MDF_ERR_INVALID_ARG: the identifier has been used by another handler
+ */
+mdf_err_t mlink_set_handle_binary(const char *name, uint16_t id, const mlink_handle_func_t func);
+
 
 /**
  * @brief Call the handler in the request list
  *
+ * @note If handle_data->req_fromat is MLINK_HTTPD_FORMAT_HEX, the request is a
+ *       compact binary frame (see mlink_tlv.h) and the response is a complete
+ *       binary frame including the status code, so the caller must not pack
+ *       "status_msg" and "status_code" into it.
+ *
  * @param handle_data The data type of the parameter of the handler
  *
  * @return
@@ -198,6 +269,20 @@ mdf_err_t mlink_set_handle(const char *name, const mlink_handle_func_t func);
  */
 mdf_err_t mlink_handle_request(mlink_handle_data_t *handle_data);
 
+/**
+ * @brief Call the handler by its numeric identifier, the request data is not
+ *        parsed to find the handler
+ *
+ * @param id          The numeric identifier of the handler
+ * @param handle_data The data type of the parameter of the handler
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_FAIL
+ *     - MDF_ERR_NOT_SUPPORTED
+ */
+mdf_err_t mlink_handle_request_id(uint16_t id, mlink_handle_data_t *handle_data);
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
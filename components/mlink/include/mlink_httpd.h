@@ -104,6 +104,25 @@ mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks);
  */
 mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks);
 
+/**
+ * @brief Push an event to the clients subscribed to "/device_events", the
+ *        change reports of the nodes are pushed as "status" events by mlink_httpd_write()
+ *
+ * @note  The stream of a slow client is not blocked on, the events that do not fit
+ *        into its buffer are dropped and the client sees a gap in the "id" of the events
+ *
+ * @param  event Name of the event, must not contain line breaks
+ * @param  addr  Address of the node that the event is about
+ * @param  data  Json value carried by the event, may be NULL
+ * @param  size  Length of data
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_INIT
+ *     - MDF_ERR_NOT_SUPPORTED: CONFIG_MLINK_HTTPD_EVENTS_ENABLE is not set
+ */
+mdf_err_t mlink_httpd_event_write(const char *event, const uint8_t *addr, const char *data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
@@ -116,9 +116,121 @@ esp_err_t __mlink_json_pack(char **json_str,  const char *key, int value, int va
  * @return
  *     - lenght: generates the length of the json string
  *     - ESP_FAIL
+ *     - MDF_ERR_INVALID_ARG: the value is nan or infinite, which json can not represent
  */
 ssize_t mlink_json_pack_double(char **json_ptr, const char *key, double value);
 
+/**
+ * @brief Append-oriented json builder
+ *
+ * @note Unlike mlink_json_pack(), the builder keeps track of the length and the
+ *       capacity of the string, so appending an item neither rescans the string
+ *       nor reallocates it every time. The heap buffer grows geometrically.
+ *       A builder initialized with all zeros is valid and allocates on the first append.
+ */
+typedef struct {
+    char *data;      /**< The generated json string, always terminated with '\0' */
+    size_t size;     /**< The length of the json string */
+    size_t capacity; /**< The size of the buffer pointed by data */
+    bool fixed;      /**< The buffer is supplied by the caller and can not grow */
+} mlink_json_buf_t;
+
+/**
+ * @brief  Initialize a json builder
+ *
+ * @param  buf      The json builder
+ * @param  data     Buffer supplied by the caller, if NULL, the buffer will be allocated from the heap
+ * @param  capacity The size of the buffer, if data is NULL, it is the initial size of the heap buffer
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mlink_json_buf_init(mlink_json_buf_t *buf, char *data, size_t capacity);
+
+/**
+ * @brief  Free the heap buffer of the json builder
+ *
+ * @param  buf The json builder
+ */
+void mlink_json_buf_free(mlink_json_buf_t *buf);
+
+/**
+ * @brief  mlink_json_buf_pack(mlink_json_buf_t *buf, const char *key, int/char value);
+ *         Append a key-value pair to the json builder
+ *
+ * @param  buf        The json builder
+ * @param  key        Build value pairs, "[]" means to append an element of the array
+ * @param  value      This is a generic, support long / int / char / char* / char []
+ * @param  value_type Type of parameter
+ *
+ * @return
+ *     - lenght: the length of the json string
+ *     - MDF_ERR_BUF: the buffer supplied by the caller is too small
+ *     - ESP_FAIL
+ */
+ssize_t __mlink_json_buf_pack(mlink_json_buf_t *buf, const char *key, int value, int value_type);
+#define mlink_json_buf_pack(buf, key, value) \
+    __mlink_json_buf_pack(buf, key, (int)(value), \
+                          __builtin_types_compatible_p(typeof(value), char) * MLINK_JSON_TYPE_INT8 \
+                          + __builtin_types_compatible_p(typeof(value), bool) * MLINK_JSON_TYPE_INT8 \
+                          + __builtin_types_compatible_p(typeof(value), int8_t) * MLINK_JSON_TYPE_INT8 \
+                          + __builtin_types_compatible_p(typeof(value), uint8_t) * MLINK_JSON_TYPE_INT8 \
+                          + __builtin_types_compatible_p(typeof(value), short) * MLINK_JSON_TYPE_INT16 \
+                          + __builtin_types_compatible_p(typeof(value), uint16_t) * MLINK_JSON_TYPE_INT16 \
+                          + __builtin_types_compatible_p(typeof(value), int) * MLINK_JSON_TYPE_INT32 \
+                          + __builtin_types_compatible_p(typeof(value), uint32_t) * MLINK_JSON_TYPE_INT32 \
+                          + __builtin_types_compatible_p(typeof(value), long) * MLINK_JSON_TYPE_INT32 \
+                          + __builtin_types_compatible_p(typeof(value), unsigned long) * MLINK_JSON_TYPE_INT32 \
+                          + __builtin_types_compatible_p(typeof(value), char *) * MLINK_JSON_TYPE_STRING  \
+                          + __builtin_types_compatible_p(typeof(value), const char *) * MLINK_JSON_TYPE_STRING  \
+                          + __builtin_types_compatible_p(typeof(value), char []) * MLINK_JSON_TYPE_STRING  \
+                          + __builtin_types_compatible_p(typeof(value), unsigned char *) * MLINK_JSON_TYPE_STRING  \
+                          + __builtin_types_compatible_p(typeof(value), const unsigned char *) * MLINK_JSON_TYPE_STRING)
+
+/**
+ * @brief  Append a double type key-value pair to the json builder
+ *
+ * @param  buf   The json builder
+ * @param  key   Build value pairs, "[]" means to append an element of the array
+ * @param  value The value to be stored
+ *
+ * @return
+ *     - lenght: the length of the json string
+ *     - MDF_ERR_BUF: the buffer supplied by the caller is too small
+ *     - MDF_ERR_INVALID_ARG: the value is nan or infinite, which json can not represent
+ */
+ssize_t mlink_json_buf_pack_double(mlink_json_buf_t *buf, const char *key, double value);
+
+/**
+ * @brief  Append a raw json value, such as an object or an array, to the json builder
+ *
+ * @param  buf   The json builder
+ * @param  key   Build value pairs, "[]" means to append an element of the array
+ * @param  raw   The raw json value, it will be copied as is
+ * @param  size  The length of the raw json value
+ *
+ * @return
+ *     - lenght: the length of the json string
+ *     - MDF_ERR_BUF: the buffer supplied by the caller is too small
+ */
+ssize_t mlink_json_buf_pack_raw(mlink_json_buf_t *buf, const char *key, const char *raw, size_t size);
+
+/**
+ * @brief  Append a value formatted like printf() to the json builder, the formatted
+ *         value is written into the buffer directly without any temporary string
+ *
+ * @param  buf    The json builder
+ * @param  key    Build value pairs, "[]" means to append an element of the array
+ * @param  format The format of the value, such as "{\"cid\":%d,\"value\":%d}"
+ *
+ * @return
+ *     - lenght: the length of the json string
+ *     - MDF_ERR_BUF: the buffer supplied by the caller is too small
+ */
+ssize_t mlink_json_buf_pack_format(mlink_json_buf_t *buf, const char *key, const char *format, ...)
+__attribute__((format(printf, 3, 4)));
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
@@ -0,0 +1,122 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MLINK_SHADOW_H__
+#define __MLINK_SHADOW_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Status shadow of the nodes, kept on the root
+ *
+ * @note Every response of a node that carries "characteristics" with "cid" and
+ *       "value", e.g. the response of get_status or get_device_info, updates the
+ *       shadow of the node. Nodes can also report changes on their own by sending
+ *       the same format with mlink_shadow_report(). Each node has a version that
+ *       is increased when a value changes, and each value has the time of its
+ *       last update.
+ */
+
+/**
+ * @brief  Initialize the shadow
+ *
+ * @param  max_num Maximum number of nodes in the shadow, once it is reached the node
+ *                 that has not responded for the longest time is removed
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mlink_shadow_init(size_t max_num);
+
+/**
+ * @brief  Deinitialize the shadow and free all the values
+ *
+ * @return
+ *     - MDF_OK
+ */
+mdf_err_t mlink_shadow_deinit(void);
+
+/**
+ * @brief  Update the shadow of a node with its response
+ *
+ * @param  addr The address of the node
+ * @param  data The json response of the node
+ * @param  size The length of the response
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND: the response does not carry characteristic values
+ *     - MDF_ERR_NOT_INIT
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mlink_shadow_update(const uint8_t *addr, const char *data, size_t size);
+
+/**
+ * @brief  Mark the values of a node as outdated, e.g. before set_status is forwarded to it
+ *
+ * @param  addr The address of the node, MWIFI_ADDR_ANY or MWIFI_ADDR_BROADCAST means all nodes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_INIT
+ */
+mdf_err_t mlink_shadow_invalidate(const uint8_t *addr);
+
+/**
+ * @brief  Answer a get_status request from the shadow
+ *
+ * @param  addr       The address of the node
+ * @param  req_data   The json get_status request
+ * @param  max_age_ms Maximum age of the values the caller accepts
+ * @param  resp_data  The response in the same format as the one of the node, must be freed by the caller
+ * @param  resp_size  The length of the response
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND: a value is not in the shadow or is older than max_age_ms
+ *     - MDF_ERR_NOT_SUPPORTED: the request is not get_status
+ *     - MDF_ERR_NOT_INIT
+ */
+mdf_err_t mlink_shadow_get_status(const uint8_t *addr, const char *req_data, uint32_t max_age_ms,
+                                  char **resp_data, size_t *resp_size);
+
+/**
+ * @brief  Report the values of some characteristics to the shadow on the root,
+ *         called by a node after the values have changed
+ *
+ * @note   The values set by set_status are reported by mlink_handle with
+ *         CONFIG_MLINK_SHADOW_REPORT. The application calls it for the values it
+ *         changes itself, e.g. from local input or sensors, otherwise the root
+ *         serves them stale until 'Shadow-Max-Age' expires
+ *
+ * @param  cids     The identifiers of the characteristics
+ * @param  cids_num The number of the characteristics
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL
+ */
+mdf_err_t mlink_shadow_report(const uint16_t *cids, size_t cids_num);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MLINK_SHADOW_H__ */
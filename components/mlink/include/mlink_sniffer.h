@@ -53,6 +53,46 @@ typedef struct {
     uint8_t data[0]; /**< The contents of the packet, where the fields are in ltv format */
 } __attribute__((packed)) mlink_sniffer_data_t;
 
+#define MLINK_SNIFFER_REPORT_VERSION (1)
+#define MLINK_SNIFFER_REPORT_DELTA   (1 << 0) /**< The report only has the devices that changed since the previous report */
+#define MLINK_SNIFFER_REPORT_LAST    (1 << 1) /**< The last batch of the report */
+
+/**
+ * @brief Header of a batch of mlink_sniffer_report(), it is followed by num records
+ */
+typedef struct {
+    uint8_t version;    /**< MLINK_SNIFFER_REPORT_VERSION */
+    uint8_t flag;       /**< MLINK_SNIFFER_REPORT_DELTA and MLINK_SNIFFER_REPORT_LAST */
+    uint16_t seq;       /**< Sequence number of the report, the same for all its batches */
+    uint8_t index;      /**< Index of the batch in the report */
+    uint8_t num;        /**< Number of records in the batch */
+} __attribute__((packed)) mlink_sniffer_batch_t;
+
+/**
+ * @brief Record of a device in a batch, all numbers are little endian
+ */
+typedef struct {
+    uint8_t addr[6];    /**< Address of the device */
+    uint8_t type;       /**< MLINK_SNIFFER_WIFI or MLINK_SNIFFER_BLE, MLINK_SNIFFER_NONE if the device is no longer seen */
+    int8_t rssi;        /**< Average RSSI since the previous report */
+    uint8_t channel;    /**< Wi-Fi channel, 0 for BLE */
+    uint32_t timestamp; /**< Milliseconds since the device was last seen */
+} __attribute__((packed)) mlink_sniffer_record_t;
+
+/**
+ * @brief Called by mlink_sniffer_report() for each batch
+ *
+ * @param data A mlink_sniffer_batch_t followed by its records, not larger than MWIFI_PAYLOAD_LEN
+ * @param size The length of data
+ * @param arg  The argument given to mlink_sniffer_report()
+ *
+ * @return
+ *    - MDF_OK
+ *    - Others: the report is stopped, the devices of this batch and the following ones
+ *              are kept as they are and sent again by the next report
+ */
+typedef mdf_err_t (*mlink_sniffer_report_cb_t)(const uint8_t *data, size_t size, void *arg);
+
 /**
  * @brief Sniffer configuration
  */
@@ -149,6 +189,26 @@ mdf_err_t mlink_sniffer_get_config(mlink_sniffer_config_t *config);
  */
 mdf_err_t mlink_sniffer_data(uint8_t **data, size_t *size);
 
+/**
+ * @brief Report the devices found since the previous report as fixed-width records,
+ *        the records are passed to report_cb in batches that fit in one mesh packet
+ *
+ * @note  A device is kept until a report finds that it has not been seen since the previous
+ *        report. A delta report only has the devices that are new, whose RSSI or channel changed
+ *        and the devices that are no longer seen, so the receiver must apply it to the previous
+ *        report. mlink_sniffer_data() takes all the devices and the next delta report starts over.
+ *
+ * @param delta     Only report the changes since the previous report
+ * @param report_cb Called for each batch, the last one has MLINK_SNIFFER_REPORT_LAST set
+ * @param arg       Argument of report_cb
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_INIT
+ *    - MDF_ERR_NO_MEM
+ */
+mdf_err_t mlink_sniffer_report(bool delta, mlink_sniffer_report_cb_t report_cb, void *arg);
+
 /**
  * @brief Initialize sniffer
  *
@@ -0,0 +1,172 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MLINK_TLV_H__
+#define __MLINK_TLV_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Compact binary encoding of the mlink requests
+ *
+ * @note A frame is the numeric identifier of the request (see mlink_handle_id_t)
+ *       followed by a list of items, all numbers are little endian:
+ *
+ *       | request (2) | type (1) | len (1) | value (len) | type (1) | len (1) | value (len) | ...
+ *
+ *       The first item of a response is always MLINK_TLV_TYPE_STATUS, which has
+ *       the same meaning as "status_code" of the json response. E.g. get_status
+ *       of the cid 0 and 1 is "04 00 02 02 00 00 02 02 01 00", it is 10 bytes
+ *       instead of the 37 bytes of {"request":"get_status","cids":[0,1]}.
+ */
+#define MLINK_TLV_REQUEST_LEN   (2)   /**< The length of the request identifier at the start of a frame */
+#define MLINK_TLV_HEAD_LEN      (2)   /**< The length of the type and the length of an item */
+#define MLINK_TLV_VALUE_MAX_LEN (255) /**< The maximum length of the value of an item */
+
+/**
+ * @brief The type of an item
+ */
+typedef enum {
+    MLINK_TLV_TYPE_NONE   = 0x00, /**< Invalid type */
+    MLINK_TLV_TYPE_STATUS = 0x01, /**< Status code of the response, int32_t */
+    MLINK_TLV_TYPE_CID    = 0x02, /**< Identifier of a characteristic, uint16_t */
+    MLINK_TLV_TYPE_INT    = 0x03, /**< Value of a characteristic, int32_t */
+    MLINK_TLV_TYPE_DOUBLE = 0x04, /**< Value of a characteristic, double */
+    MLINK_TLV_TYPE_STRING = 0x05, /**< Value of a characteristic, string without '\0' */
+    MLINK_TLV_TYPE_CUSTOM = 0x80, /**< Starting number of the types used by custom handlers */
+} mlink_tlv_type_t;
+
+/**
+ * @brief An item of the frame
+ */
+typedef struct {
+    uint8_t type;         /**< The type of the item, see mlink_tlv_type_t */
+    uint8_t len;          /**< The length of the value */
+    const uint8_t *value; /**< The value, points into the frame */
+} mlink_tlv_t;
+
+/**
+ * @brief Frame builder, a builder initialized with all zeros is valid and
+ *        allocates on the first append
+ */
+typedef struct {
+    uint8_t *data;   /**< The generated frame */
+    size_t size;     /**< The length of the frame */
+    size_t capacity; /**< The size of the buffer pointed by data */
+} mlink_tlv_buf_t;
+
+/**
+ * @brief  Free the buffer of the frame builder
+ *
+ * @param  buf The frame builder
+ */
+void mlink_tlv_buf_free(mlink_tlv_buf_t *buf);
+
+/**
+ * @brief  Write the request identifier, it must be the first thing written into a frame
+ *
+ * @param  buf     The frame builder
+ * @param  request The numeric identifier of the request
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mlink_tlv_pack_request(mlink_tlv_buf_t *buf, uint16_t request);
+
+/**
+ * @brief  Append an item to the frame
+ *
+ * @param  buf   The frame builder
+ * @param  type  The type of the item
+ * @param  value The value of the item
+ * @param  len   The length of the value, not larger than MLINK_TLV_VALUE_MAX_LEN
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mlink_tlv_pack(mlink_tlv_buf_t *buf, uint8_t type, const void *value, size_t len);
+
+/**
+ * @brief  Append an item whose value is a uint16_t, e.g. MLINK_TLV_TYPE_CID
+ */
+mdf_err_t mlink_tlv_pack_uint16(mlink_tlv_buf_t *buf, uint8_t type, uint16_t value);
+
+/**
+ * @brief  Append an item whose value is an int32_t, e.g. MLINK_TLV_TYPE_INT
+ */
+mdf_err_t mlink_tlv_pack_int32(mlink_tlv_buf_t *buf, uint8_t type, int32_t value);
+
+/**
+ * @brief  Append an item whose value is a double, e.g. MLINK_TLV_TYPE_DOUBLE
+ */
+mdf_err_t mlink_tlv_pack_double(mlink_tlv_buf_t *buf, uint8_t type, double value);
+
+/**
+ * @brief  Get the request identifier of a frame
+ *
+ * @param  data    The frame
+ * @param  size    The length of the frame
+ * @param  request The numeric identifier of the request
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mlink_tlv_parse_request(const uint8_t *data, size_t size, uint16_t *request);
+
+/**
+ * @brief  Get the next item of a frame
+ *
+ * @param  data The position in the frame, it is advanced past the returned item.
+ *              Start with the frame plus MLINK_TLV_REQUEST_LEN
+ * @param  size The remaining length of the frame, it is decreased accordingly
+ * @param  tlv  The item
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND: the end of the frame is reached
+ *     - MDF_ERR_INVALID_SIZE: the item is truncated
+ */
+mdf_err_t mlink_tlv_next(const uint8_t **data, size_t *size, mlink_tlv_t *tlv);
+
+/**
+ * @brief  Read the value of an item as an integer, an item of any integer length
+ *         up to 4 bytes is accepted
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mlink_tlv_get_int32(const mlink_tlv_t *tlv, int32_t *value);
+
+/**
+ * @brief  Read the value of an item as a double, MLINK_TLV_TYPE_INT is converted
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mlink_tlv_get_double(const mlink_tlv_t *tlv, double *value);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MLINK_TLV_H__ */
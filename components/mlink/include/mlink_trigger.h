@@ -50,9 +50,27 @@ mdf_err_t mlink_trigger_init();
  */
 bool mlink_trigger_is_exist();
 
+/**
+ * @brief Notify that the value of a characteristic has changed, the triggers of
+ *        the characteristic are evaluated first by the next mlink_trigger_handle().
+ *        The values set by set_status are notified by mlink_handle, the application
+ *        notifies the values it changes itself, e.g. from local input or sensors
+ *
+ * @param  cid The identifier of the characteristic
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_INIT: mlink_trigger_init() is not called, nothing is logged
+ */
+mdf_err_t mlink_trigger_notify(uint16_t cid);
+
 /**
  * @brief Whether the query event is triggered
  *
+ * @note  The triggers of the characteristics notified by mlink_trigger_notify() since the
+ *        last call are evaluated first, then the others. With CONFIG_MLINK_TRIGGER_NOTIFY_ONLY,
+ *        only the notified ones are evaluated. The value of each characteristic is read once
+ *
  * @param  communicate The method of sending the package when the event is triggered
  *
  * @return
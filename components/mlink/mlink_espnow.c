@@ -31,17 +31,34 @@ typedef struct {
     char data[0];        /**< Pointer of data */
 } mlink_espnow_t;
 
+/**
+ * @brief The packets are built and received in these buffers, so that sending
+ *        or receiving a packet does not allocate memory
+ */
+static SemaphoreHandle_t g_espnow_write_lock = NULL;
+static SemaphoreHandle_t g_espnow_read_lock  = NULL;
+static uint32_t g_espnow_write_buf[MLINK_ESPNOW_BUF_SIZE / sizeof(uint32_t)];
+static uint32_t g_espnow_read_buf[MLINK_ESPNOW_BUF_SIZE / sizeof(uint32_t)];
+
 mdf_err_t __mlink_espnow_write(const uint8_t *addrs_list, size_t addrs_num, const void *data,
                                size_t size, uint32_t type, TickType_t wait_ticks)
 {
     MDF_PARAM_CHECK(data);
     MDF_PARAM_CHECK(addrs_list);
     MDF_PARAM_CHECK(size > 0);
+    MDF_ERROR_CHECK(!g_espnow_write_lock, MDF_ERR_NOT_INIT, "Mlink espnow is not initialized");
 
     mdf_err_t ret      = MDF_OK;
     size_t espnow_size = sizeof(mlink_espnow_t) + size + addrs_num * ESP_NOW_ETH_ALEN;
-    mlink_espnow_t *espnow_data = MDF_MALLOC(espnow_size);
-    MDF_ERROR_CHECK(!espnow_data, MDF_ERR_NO_MEM, "");
+    mlink_espnow_t *espnow_data = (mlink_espnow_t *)g_espnow_write_buf;
+
+    /**< Only a packet larger than the buffer is allocated */
+    if (espnow_size > sizeof(g_espnow_write_buf)) {
+        espnow_data = MDF_MALLOC(espnow_size);
+        MDF_ERROR_CHECK(!espnow_data, MDF_ERR_NO_MEM, "");
+    } else if (!xSemaphoreTake(g_espnow_write_lock, wait_ticks)) {
+        return MDF_ERR_TIMEOUT;
+    }
 
     espnow_data->size      = size;
     espnow_data->type      = type;
@@ -52,55 +69,110 @@ mdf_err_t __mlink_espnow_write(const uint8_t *addrs_list, size_t addrs_num, cons
     /**< write date package to espnow. */
     ret = mespnow_write(MESPNOW_TRANS_PIPE_CONTROL, g_espnow_config.parent_bssid,
                         espnow_data, espnow_size, wait_ticks);
-    MDF_FREE(espnow_data);
+
+    if (espnow_data == (mlink_espnow_t *)g_espnow_write_buf) {
+        xSemaphoreGive(g_espnow_write_lock);
+    } else {
+        MDF_FREE(espnow_data);
+    }
+
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mespnow_write");
 
     return ret;
 }
 
-mdf_err_t __mlink_espnow_read(uint8_t **addrs_list, size_t *addrs_num, uint8_t **data,
-                              size_t *size, uint32_t *type, TickType_t wait_ticks)
+mdf_err_t mlink_espnow_read_buf(void *buf, size_t buf_size, const uint8_t **addrs_list, size_t *addrs_num,
+                                const uint8_t **data, size_t *size, uint32_t *type, TickType_t wait_ticks)
 {
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(buf_size > sizeof(mlink_espnow_t));
     MDF_PARAM_CHECK(size);
     MDF_PARAM_CHECK(data);
     MDF_PARAM_CHECK(addrs_num);
     MDF_PARAM_CHECK(addrs_list);
 
     mdf_err_t ret      = MDF_OK;
-    size_t espnow_size = ESP_NOW_MAX_DATA_LEN * 4;
+    size_t espnow_size = buf_size;
     uint8_t src_addr[ESP_NOW_ETH_ALEN] = {0x0};
-    *size = 0;
-    *data = NULL;
-    *addrs_num = 0;
+    mlink_espnow_t *espnow_data        = (mlink_espnow_t *)buf;
 
-    mlink_espnow_t *espnow_data = MDF_MALLOC(ESP_NOW_MAX_DATA_LEN * 4);
-    MDF_ERROR_CHECK(!espnow_data, MDF_ERR_NO_MEM, "");
+    *size       = 0;
+    *data       = NULL;
+    *addrs_num  = 0;
+    *addrs_list = NULL;
 
     /**< read data from espnow */
     ret = mespnow_read(MESPNOW_TRANS_PIPE_CONTROL, src_addr,
                        espnow_data, &espnow_size, wait_ticks);
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mespnow_read");
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mespnow_read");
+
+    ret = (espnow_size >= sizeof(mlink_espnow_t) && espnow_data->size <= espnow_size - sizeof(mlink_espnow_t)
+           && espnow_data->addrs_num <= (espnow_size - sizeof(mlink_espnow_t) - espnow_data->size) / ESP_NOW_ETH_ALEN)
+          ? MDF_OK : MDF_ERR_INVALID_SIZE;
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Invalid packet, size: %d", espnow_size);
 
-    *size = espnow_data->size;
-    *data = MDF_MALLOC(espnow_data->size);
+    *size       = espnow_data->size;
+    *data       = (uint8_t *)espnow_data->data;
     *addrs_num  = espnow_data->addrs_num;
-    *addrs_list = MDF_MALLOC(*addrs_num * ESP_NOW_ETH_ALEN);
+    *addrs_list = (uint8_t *)espnow_data->data + espnow_data->size;
+
+    if (type) {
+        *type = espnow_data->type;
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t __mlink_espnow_read(uint8_t **addrs_list, size_t *addrs_num, uint8_t **data,
+                              size_t *size, uint32_t *type, TickType_t wait_ticks)
+{
+    MDF_PARAM_CHECK(size);
+    MDF_PARAM_CHECK(data);
+    MDF_PARAM_CHECK(addrs_num);
+    MDF_PARAM_CHECK(addrs_list);
+    MDF_ERROR_CHECK(!g_espnow_read_lock, MDF_ERR_NOT_INIT, "Mlink espnow is not initialized");
+
+    mdf_err_t ret              = MDF_OK;
+    const uint8_t *buf_data    = NULL;
+    const uint8_t *buf_addrs   = NULL;
+
+    TickType_t start_ticks     = xTaskGetTickCount();
+
+    *size       = 0;
+    *data       = NULL;
+    *addrs_num  = 0;
+    *addrs_list = NULL;
+
+    if (!xSemaphoreTake(g_espnow_read_lock, wait_ticks)) {
+        return MDF_ERR_TIMEOUT;
+    }
 
-    if (!(*data) || !(*addrs_list)) {
+    /**< The time spent waiting for the lock is part of wait_ticks */
+    if (wait_ticks != portMAX_DELAY) {
+        wait_ticks = (xTaskGetTickCount() - start_ticks < wait_ticks) ?
+                     wait_ticks - (xTaskGetTickCount() - start_ticks) : 0;
+    }
+
+    ret = mlink_espnow_read_buf(g_espnow_read_buf, sizeof(g_espnow_read_buf), &buf_addrs, addrs_num,
+                                &buf_data, size, type, wait_ticks);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_espnow_read_buf");
+
+    /**< The caller frees the data and the addresses, they are NULL if empty */
+    *data       = (*size) ? MDF_MALLOC(*size) : NULL;
+    *addrs_list = (*addrs_num) ? MDF_MALLOC(*addrs_num * ESP_NOW_ETH_ALEN) : NULL;
+
+    if ((*size && !(*data)) || (*addrs_num && !(*addrs_list))) {
         ret = MDF_ERR_NO_MEM;
         MDF_FREE(*data);
         MDF_FREE(*addrs_list);
+        goto EXIT;
     }
 
-    if (type) {
-        *type = espnow_data->type;
-    }
-
-    memcpy(*data, espnow_data->data, espnow_data->size);
-    memcpy(*addrs_list, espnow_data->data + *size, *addrs_num * ESP_NOW_ETH_ALEN);
+    memcpy(*data, buf_data, *size);
+    memcpy(*addrs_list, buf_addrs, *addrs_num * ESP_NOW_ETH_ALEN);
 
 EXIT:
-    MDF_FREE(espnow_data);
+    xSemaphoreGive(g_espnow_read_lock);
     return ret;
 }
 
@@ -114,6 +186,12 @@ mdf_err_t mlink_espnow_init(mlink_espnow_config_t *config)
     ret = mespnow_init();
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mespnow_init");
 
+    if (!g_espnow_write_lock) {
+        g_espnow_write_lock = xSemaphoreCreateMutex();
+        g_espnow_read_lock  = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_espnow_write_lock || !g_espnow_read_lock, MDF_ERR_NO_MEM, "xSemaphoreCreateMutex");
+    }
+
     /**< espnow need to set the channel */
     esp_wifi_set_promiscuous(1);
     ESP_ERROR_CHECK(esp_wifi_set_channel(config->channel, second));
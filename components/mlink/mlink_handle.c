@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <ctype.h>
+
 #include "mlink.h"
 #include "mwifi.h"
 #include "mconfig_chain.h"
@@ -19,7 +21,8 @@
 
 #define MLINK_RESTART_DELAY_TIME_MS (5000)
 #define MLINK_HANDLES_MAX_SIZE      (64)
-#define CHARACTERISTICS_MAX_NUM     (32)
+#define MLINK_HANDLES_TABLE_SIZE    (128) /**< Must be a power of 2 and larger than MLINK_HANDLES_MAX_SIZE */
+#define CHARACTERISTICS_INDEX_MIN   (16)  /**< Minimum size of the cid index, must be a power of 2 */
 #define MLINK_DEVICE_NAME_KEY       "ML_NAME"
 #define MLINK_DEVICE_POSITION_KEY   "ML_POSITION"
 
@@ -55,6 +58,8 @@ typedef struct {
     char version[32];                         /**< The version of the device */
     uint8_t characteristics_num;              /**< The number of device attributes */
     mlink_characteristics_t *characteristics; /**< The characteristics of the device */
+    uint16_t cid_index_size;                  /**< The size of the cid index, a power of 2 */
+    uint8_t *cid_index;                       /**< Position + 1 of the characteristic of a cid, 0 means empty */
 } mlink_device_t;
 
 /**
@@ -62,7 +67,10 @@ typedef struct {
  */
 typedef struct {
     const char *name;         /**< The name of the function */
+    uint16_t id;              /**< The numeric identifier of the request, 0 means none */
+    uint32_t hash;            /**< The hash of the name, ignoring case */
     mlink_handle_func_t func; /**< The pointer of the function */
+    bool binary;              /**< The function also accepts compact binary requests */
 } mlink_handle_t;
 
 static const char *TAG               = "mlink_handle";
@@ -162,15 +170,77 @@ int mlink_device_get_tid()
     return g_device_info->tid;
 }
 
+/**
+ * @brief Rebuild the open addressing index from cid to characteristic,
+ *        sized to keep the load factor at or below one half
+ */
+static mdf_err_t mlink_characteristic_index_update()
+{
+    uint16_t index_size = CHARACTERISTICS_INDEX_MIN;
+
+    while (index_size < g_device_info->characteristics_num * 2) {
+        index_size <<= 1;
+    }
+
+    if (index_size != g_device_info->cid_index_size) {
+        uint8_t *cid_index = MDF_REALLOC(g_device_info->cid_index, index_size);
+        MDF_ERROR_CHECK(!cid_index, MDF_ERR_NO_MEM, "");
+
+        g_device_info->cid_index      = cid_index;
+        g_device_info->cid_index_size = index_size;
+    }
+
+    memset(g_device_info->cid_index, 0, g_device_info->cid_index_size);
+
+    for (int i = 0; i < g_device_info->characteristics_num; ++i) {
+        uint16_t cid = g_device_info->characteristics[i].cid;
+        uint16_t slot = cid & (g_device_info->cid_index_size - 1);
+
+        /**< If a cid is added twice, the first one is kept */
+        while (g_device_info->cid_index[slot]
+                && g_device_info->characteristics[g_device_info->cid_index[slot] - 1].cid != cid) {
+            slot = (slot + 1) & (g_device_info->cid_index_size - 1);
+        }
+
+        if (!g_device_info->cid_index[slot]) {
+            g_device_info->cid_index[slot] = i + 1;
+        }
+    }
+
+    return MDF_OK;
+}
+
+static mlink_characteristics_t *mlink_characteristic_find(uint16_t cid)
+{
+    if (!g_device_info->cid_index) {
+        return NULL;
+    }
+
+    uint16_t slot = cid & (g_device_info->cid_index_size - 1);
+
+    for (uint8_t pos = g_device_info->cid_index[slot]; pos; pos = g_device_info->cid_index[slot]) {
+        if (g_device_info->characteristics[pos - 1].cid == cid) {
+            return g_device_info->characteristics + pos - 1;
+        }
+
+        slot = (slot + 1) & (g_device_info->cid_index_size - 1);
+    }
+
+    return NULL;
+}
+
 mdf_err_t mlink_add_characteristic(uint16_t cid, const char *name, characteristic_format_t format,
                                    characteristic_perms_t perms, int min, int max, uint16_t step)
 {
     MDF_PARAM_CHECK(g_device_info);
     MDF_PARAM_CHECK(name);
+    MDF_ERROR_CHECK(g_device_info->characteristics_num == UINT8_MAX, MDF_ERR_NOT_SUPPORTED,
+                    "The maximum number of characteristics: %d", UINT8_MAX);
 
-    g_device_info->characteristics = MDF_REALLOC(g_device_info->characteristics,
-                                     (g_device_info->characteristics_num + 1) * sizeof(mlink_characteristics_t));
-    MDF_ERROR_CHECK(!g_device_info->characteristics, MDF_ERR_NO_MEM, "");
+    mlink_characteristics_t *characteristics_list = MDF_REALLOC(g_device_info->characteristics,
+            (g_device_info->characteristics_num + 1) * sizeof(mlink_characteristics_t));
+    MDF_ERROR_CHECK(!characteristics_list, MDF_ERR_NO_MEM, "");
+    g_device_info->characteristics = characteristics_list;
     mlink_characteristics_t *characteristics = g_device_info->characteristics + g_device_info->characteristics_num;
 
     characteristics->cid    = cid;
@@ -184,20 +254,7 @@ mdf_err_t mlink_add_characteristic(uint16_t cid, const char *name, characteristi
     memset(characteristics->name, 0, sizeof(characteristics->name));
     strncpy(characteristics->name, name, sizeof(characteristics->name) - 1);
 
-    return MDF_OK;
-}
-
-static characteristic_format_t mlink_get_characteristics_format(uint16_t cid)
-{
-    mlink_characteristics_t *characteristic = g_device_info->characteristics;
-
-    for (int i = 0; i < g_device_info->characteristics_num; ++i) {
-        if (characteristic[i].cid == cid) {
-            return characteristic[i].format;
-        }
-    }
-
-    return CHARACTERISTIC_FORMAT_NONE;
+    return mlink_characteristic_index_update();
 }
 
 mdf_err_t mlink_add_characteristic_handle(mlink_characteristic_func_t get_value_func, mlink_characteristic_func_t set_value_func)
@@ -254,8 +311,8 @@ static mdf_err_t mlink_handle_get_info(mlink_handle_data_t *handle_data)
     char position[32]            = {0x0};
     size_t position_len          = sizeof(position);
     mesh_addr_t mesh_id          = {0};
-    handle_data->resp_data       = NULL;
-    char *characteristics_list   = NULL;
+    mlink_json_buf_t resp        = {0};
+    mlink_json_buf_t characteristics_list = {0};
     characteristic_value_t value = {0};
     mesh_addr_t parent_bssid     = {0};
     uint8_t parent_mac[6]        = {0};
@@ -275,7 +332,7 @@ static mdf_err_t mlink_handle_get_info(mlink_handle_data_t *handle_data)
     ESP_ERROR_CHECK(esp_mesh_get_id(&mesh_id));
 
     if (mdf_info_load(MLINK_DEVICE_POSITION_KEY, position, &position_len) == MDF_OK) {
-        mlink_json_pack(&handle_data->resp_data, "position", position);
+        mlink_json_buf_pack(&resp, "position", position);
     }
 
     sprintf(tmp_str, "%d", g_device_info->tid);
@@ -289,55 +346,53 @@ static mdf_err_t mlink_handle_get_info(mlink_handle_data_t *handle_data)
 
     esp_wifi_get_mac(ESP_IF_WIFI_STA, self_mac);
 
-    mlink_json_pack(&handle_data->resp_data, "tid", tmp_str);
-    mlink_json_pack(&handle_data->resp_data, "name", g_device_info->name);
-    mlink_json_pack(&handle_data->resp_data, "self_mac", mlink_mac_hex2str(self_mac, tmp_str));
-    mlink_json_pack(&handle_data->resp_data, "parent_mac",  mlink_mac_hex2str(parent_mac, tmp_str));
-    mlink_json_pack(&handle_data->resp_data, "mesh_id", mlink_mac_hex2str(mesh_id.addr, tmp_str));
-    mlink_json_pack(&handle_data->resp_data, "version", g_device_info->version);
-    mlink_json_pack(&handle_data->resp_data, "idf_version", esp_get_idf_version());
-    mlink_json_pack(&handle_data->resp_data, "mdf_version", mdf_get_version());
-    mlink_json_pack(&handle_data->resp_data, "mlink_version", 2);
-    mlink_json_pack(&handle_data->resp_data, "mlink_trigger", mlink_trigger_is_exist());
-    mlink_json_pack(&handle_data->resp_data, "rssi", mwifi_get_parent_rssi());
-    mlink_json_pack(&handle_data->resp_data, "layer", esp_mesh_get_layer());
+    mlink_json_buf_pack(&resp, "tid", tmp_str);
+    mlink_json_buf_pack(&resp, "name", g_device_info->name);
+    mlink_json_buf_pack(&resp, "self_mac", mlink_mac_hex2str(self_mac, tmp_str));
+    mlink_json_buf_pack(&resp, "parent_mac",  mlink_mac_hex2str(parent_mac, tmp_str));
+    mlink_json_buf_pack(&resp, "mesh_id", mlink_mac_hex2str(mesh_id.addr, tmp_str));
+    mlink_json_buf_pack(&resp, "version", g_device_info->version);
+    mlink_json_buf_pack(&resp, "idf_version", esp_get_idf_version());
+    mlink_json_buf_pack(&resp, "mdf_version", mdf_get_version());
+    mlink_json_buf_pack(&resp, "mlink_version", 2);
+    mlink_json_buf_pack(&resp, "mlink_trigger", mlink_trigger_is_exist());
+    mlink_json_buf_pack(&resp, "rssi", mwifi_get_parent_rssi());
+    mlink_json_buf_pack(&resp, "layer", esp_mesh_get_layer());
 
     sprintf(tmp_str, "%lld", esp_mesh_get_tsf_time());
-    mlink_json_pack(&handle_data->resp_data, "tsf_time", tmp_str);
+    mlink_json_buf_pack(&resp, "tsf_time", tmp_str);
 
     uint16_t group_num = esp_mesh_get_group_num();
 
     if (group_num > 0) {
         mesh_addr_t *group_list = MDF_MALLOC(sizeof(mesh_addr_t) * group_num);
-        MDF_ERROR_CHECK(!group_list, MDF_ERR_NO_MEM, "");
 
-        if (esp_mesh_get_group_list(group_list, group_num) == MDF_OK) {
-            char *group_str = NULL;
+        if (group_list && esp_mesh_get_group_list(group_list, group_num) == MDF_OK) {
+            mlink_json_buf_t group_str = {0};
             char group_id_str[13] = {0x0};
 
             for (int i = 0; i < group_num; ++i) {
                 mlink_mac_hex2str(group_list[i].addr, group_id_str);
-                mlink_json_pack(&group_str, "[]", group_id_str);
+                mlink_json_buf_pack(&group_str, "[]", group_id_str);
             }
 
-            mlink_json_pack(&handle_data->resp_data, "group", group_str);
-            MDF_FREE(group_str);
+            mlink_json_buf_pack_raw(&resp, "group", group_str.data, group_str.size);
+            mlink_json_buf_free(&group_str);
         }
 
         MDF_FREE(group_list);
     }
 
     for (int i = 0; i < g_device_info->characteristics_num; ++i) {
-        char *tmp_str = NULL;
-
         switch (characteristic[i].format) {
             case CHARACTERISTIC_FORMAT_INT: {
                 ret = mlink_device_get_value(characteristic[i].cid, &value.value_int);
                 MDF_ERROR_CONTINUE(ret != MDF_OK, "Get the value of the device's cid: %d", characteristic[i].cid);
 
-                asprintf(&tmp_str, characteristic_format_int, characteristic[i].cid, characteristic[i].name,
-                         characteristic[i].perms, value.value_int,
-                         characteristic[i].min, characteristic[i].max, characteristic[i].step);
+                mlink_json_buf_pack_format(&characteristics_list, "[]", characteristic_format_int,
+                                           characteristic[i].cid, characteristic[i].name,
+                                           characteristic[i].perms, value.value_int,
+                                           characteristic[i].min, characteristic[i].max, characteristic[i].step);
                 break;
             }
 
@@ -345,9 +400,10 @@ static mdf_err_t mlink_handle_get_info(mlink_handle_data_t *handle_data)
                 ret = mlink_device_get_value(characteristic[i].cid, &value.value_double);
                 MDF_ERROR_CONTINUE(ret != MDF_OK, "Get the value of the device's cid: %d", characteristic[i].cid);
 
-                asprintf(&tmp_str, characteristic_format_double, characteristic[i].cid, characteristic[i].name,
-                         characteristic[i].perms, value.value_double,
-                         characteristic[i].min, characteristic[i].max, characteristic[i].step);
+                mlink_json_buf_pack_format(&characteristics_list, "[]", characteristic_format_double,
+                                           characteristic[i].cid, characteristic[i].name,
+                                           characteristic[i].perms, value.value_double,
+                                           characteristic[i].min, characteristic[i].max, characteristic[i].step);
                 break;
             }
 
@@ -355,24 +411,202 @@ static mdf_err_t mlink_handle_get_info(mlink_handle_data_t *handle_data)
                 ret = mlink_device_get_value(characteristic[i].cid, &value.value_string);
                 MDF_ERROR_CONTINUE(ret != MDF_OK, "Get the value of the device's cid: %d", characteristic[i].cid);
 
-                asprintf(&tmp_str, characteristic_format_string, characteristic[i].cid, characteristic[i].name,
-                         characteristic[i].perms, value.value_string,
-                         characteristic[i].min, characteristic[i].max, characteristic[i].step);
+                mlink_json_buf_pack_format(&characteristics_list, "[]", characteristic_format_string,
+                                           characteristic[i].cid, characteristic[i].name,
+                                           characteristic[i].perms, value.value_string,
+                                           characteristic[i].min, characteristic[i].max, characteristic[i].step);
                 break;
             }
 
             default:
                 break;
         }
+    }
+
+    if (characteristics_list.size > 0) {
+        mlink_json_buf_pack_raw(&resp, "characteristics", characteristics_list.data, characteristics_list.size);
+    }
+
+    mlink_json_buf_free(&characteristics_list);
+
+    handle_data->resp_data = resp.data;
+    handle_data->resp_size = resp.size;
+
+    return MDF_OK;
+}
+
+static mdf_err_t mlink_handle_get_status_binary(mlink_handle_data_t *handle_data)
+{
+    mdf_err_t ret        = MDF_OK;
+    mlink_tlv_t tlv      = {0};
+    mlink_tlv_buf_t resp = {0};
+    characteristic_value_t value = {0};
+    mlink_characteristics_t *characteristic = NULL;
+    const uint8_t *req_data = (uint8_t *)handle_data->req_data + MLINK_TLV_REQUEST_LEN;
+    size_t req_size         = handle_data->req_size - MLINK_TLV_REQUEST_LEN;
+
+    MDF_ERROR_CHECK(handle_data->req_size < MLINK_TLV_REQUEST_LEN, MDF_ERR_INVALID_SIZE,
+                    "The request is too short, req_size: %d", handle_data->req_size);
+
+    mdf_event_loop_send(MDF_EVENT_MLINK_GET_STATUS, NULL);
+
+    while ((ret = mlink_tlv_next(&req_data, &req_size, &tlv)) == MDF_OK) {
+        MDF_ERROR_CONTINUE(tlv.type != MLINK_TLV_TYPE_CID || tlv.len != sizeof(uint16_t),
+                           "The item is not a cid, type: %d, len: %d", tlv.type, tlv.len);
+
+        uint16_t cid = tlv.value[0] | (tlv.value[1] << 8);
+        characteristic = mlink_characteristic_find(cid);
+        MDF_ERROR_CONTINUE(!characteristic, "The characteristic does not exist, cid: %d", cid);
+
+        switch (characteristic->format) {
+            case CHARACTERISTIC_FORMAT_INT:
+                ret = mlink_device_get_value(cid, &value.value_int);
+                MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
+                mlink_tlv_pack_uint16(&resp, MLINK_TLV_TYPE_CID, cid);
+                mlink_tlv_pack_int32(&resp, MLINK_TLV_TYPE_INT, value.value_int);
+                break;
+
+            case CHARACTERISTIC_FORMAT_DOUBLE:
+                ret = mlink_device_get_value(cid, &value.value_double);
+                MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
+                mlink_tlv_pack_uint16(&resp, MLINK_TLV_TYPE_CID, cid);
+                mlink_tlv_pack_double(&resp, MLINK_TLV_TYPE_DOUBLE, value.value_double);
+                break;
+
+            case CHARACTERISTIC_FORMAT_STRING:
+                ret = mlink_device_get_value(cid, &value.value_string);
+                MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
+                MDF_ERROR_BREAK(strlen(value.value_string) > MLINK_TLV_VALUE_MAX_LEN,
+                                "The string is too long, cid: %d", cid);
+                mlink_tlv_pack_uint16(&resp, MLINK_TLV_TYPE_CID, cid);
+                mlink_tlv_pack(&resp, MLINK_TLV_TYPE_STRING, value.value_string, strlen(value.value_string));
+                break;
 
-        if (tmp_str) {
-            mlink_json_pack(&characteristics_list, "[]", tmp_str);
-            MDF_FREE(tmp_str);
+            default:
+                MDF_LOGW("Data types in this format are not supported");
+                break;
         }
     }
 
-    handle_data->resp_size = mlink_json_pack(&handle_data->resp_data, "characteristics", characteristics_list);
-    MDF_FREE(characteristics_list);
+    if (ret != MDF_ERR_NOT_FOUND || !resp.size) {
+        mlink_tlv_buf_free(&resp);
+        return MDF_FAIL;
+    }
+
+    handle_data->resp_data = (char *)resp.data;
+    handle_data->resp_size = resp.size;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Set the value of a characteristic, the triggers of the characteristic
+ *        are evaluated by the next mlink_trigger_handle()
+ */
+static mdf_err_t mlink_characteristic_set_value(uint16_t cid, void *value)
+{
+    mdf_err_t ret = mlink_device_set_value(cid, value);
+
+    if (ret == MDF_OK) {
+        mlink_trigger_notify(cid);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Report the values set by set_status to the shadow on the root, the request
+ *        may come from another node, a trigger or ESP-NOW, which the root does not see
+ */
+static void mlink_characteristic_report(const uint16_t *cids, size_t cids_num)
+{
+#ifdef CONFIG_MLINK_SHADOW_REPORT
+
+    if (cids && cids_num && mwifi_is_connected()) {
+        mdf_err_t ret = mlink_shadow_report(cids, cids_num);
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> mlink_shadow_report", mdf_err_to_name(ret));
+        }
+    }
+
+#endif /**< CONFIG_MLINK_SHADOW_REPORT */
+}
+
+static mdf_err_t mlink_handle_set_status_binary(mlink_handle_data_t *handle_data)
+{
+    mdf_err_t ret   = MDF_OK;
+    mlink_tlv_t tlv = {0};
+    characteristic_value_t value = {0};
+    char value_string[MLINK_TLV_VALUE_MAX_LEN + 1] = {0};
+    mlink_characteristics_t *characteristic = NULL;
+    const uint8_t *req_data = (uint8_t *)handle_data->req_data + MLINK_TLV_REQUEST_LEN;
+    size_t req_size         = handle_data->req_size - MLINK_TLV_REQUEST_LEN;
+    uint16_t *report_cids   = NULL;
+    size_t report_num       = 0;
+
+    MDF_ERROR_CHECK(handle_data->req_size < MLINK_TLV_REQUEST_LEN, MDF_ERR_INVALID_SIZE,
+                    "The request is too short, req_size: %d", handle_data->req_size);
+
+#ifdef CONFIG_MLINK_SHADOW_REPORT
+    report_cids = MDF_MALLOC(g_device_info->characteristics_num * sizeof(uint16_t));
+#endif /**< CONFIG_MLINK_SHADOW_REPORT */
+
+    /**< Each value follows the cid it belongs to */
+    while ((ret = mlink_tlv_next(&req_data, &req_size, &tlv)) == MDF_OK) {
+        if (tlv.type == MLINK_TLV_TYPE_CID) {
+            uint16_t cid = (tlv.len == sizeof(uint16_t)) ? tlv.value[0] | (tlv.value[1] << 8) : 0;
+            characteristic = (tlv.len == sizeof(uint16_t)) ? mlink_characteristic_find(cid) : NULL;
+            MDF_ERROR_CONTINUE(!characteristic, "The characteristic does not exist, cid: %d", cid);
+            continue;
+        }
+
+        MDF_ERROR_CONTINUE(!characteristic, "The value is not preceded by a cid, type: %d", tlv.type);
+
+        switch (characteristic->format) {
+            case CHARACTERISTIC_FORMAT_INT:
+                ret = mlink_tlv_get_int32(&tlv, (int32_t *)&value.value_int);
+                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_tlv_get_int32", mdf_err_to_name(ret));
+                ret = mlink_characteristic_set_value(characteristic->cid, &value.value_int);
+                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value, cid: %d, value: %d",
+                                mdf_err_to_name(ret), characteristic->cid, value.value_int);
+                break;
+
+            case CHARACTERISTIC_FORMAT_DOUBLE:
+                ret = mlink_tlv_get_double(&tlv, &value.value_double);
+                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_tlv_get_double", mdf_err_to_name(ret));
+                ret = mlink_characteristic_set_value(characteristic->cid, &value.value_double);
+                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value, cid: %d, value: %f",
+                                mdf_err_to_name(ret), characteristic->cid, value.value_double);
+                break;
+
+            case CHARACTERISTIC_FORMAT_STRING:
+                MDF_ERROR_BREAK(tlv.type != MLINK_TLV_TYPE_STRING, "The value is not a string, type: %d", tlv.type);
+                memcpy(value_string, tlv.value, tlv.len);
+                value_string[tlv.len] = '\0';
+                ret = mlink_characteristic_set_value(characteristic->cid, value_string);
+                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value,", mdf_err_to_name(ret));
+                break;
+
+            default:
+                MDF_LOGW("Data types in this format are not supported");
+                break;
+        }
+
+        if (ret == MDF_OK && report_cids && report_num < g_device_info->characteristics_num) {
+            report_cids[report_num++] = characteristic->cid;
+        }
+
+        characteristic = NULL;
+    }
+
+    /**< The values set before the request is found truncated are reported too */
+    mlink_characteristic_report(report_cids, report_num);
+    MDF_FREE(report_cids);
+
+    MDF_ERROR_CHECK(ret != MDF_ERR_NOT_FOUND, MDF_FAIL, "The request is truncated");
+
+    mdf_event_loop_send(MDF_EVENT_MLINK_SET_STATUS, NULL);
 
     return MDF_OK;
 }
@@ -381,44 +615,60 @@ static mdf_err_t mlink_handle_get_status(mlink_handle_data_t *handle_data)
 {
     MDF_ERROR_CHECK(!mlink_device_get_value, MDF_FAIL, "this device does not support get_status");
 
+    if (handle_data->req_fromat == MLINK_HTTPD_FORMAT_HEX) {
+        return mlink_handle_get_status_binary(handle_data);
+    }
+
     mdf_err_t ret                     = MDF_OK;
-    int cids_num                      = 0;
-    handle_data->resp_data            = NULL;
-    char *characteristics_list        = NULL;
-    int cids[CHARACTERISTICS_MAX_NUM] = {0};
+    mlink_json_buf_t resp             = {0};
+    mlink_json_buf_t characteristics_list = {0};
     characteristic_value_t value      = {0};
+    mlink_characteristics_t *characteristic = NULL;
 
-    ret = mlink_json_parse(handle_data->req_data, "cids", &cids_num);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    cJSON *pJson = cJSON_Parse(handle_data->req_data);
+    MDF_ERROR_CHECK(!pJson, MDF_ERR_INVALID_ARG, "Parse the json formatted string");
 
-    ret = mlink_json_parse(handle_data->req_data, "cids", cids);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    cJSON *pCids = cJSON_GetObjectItem(pJson, "cids");
+    ret = (pCids && pCids->type == cJSON_Array) ? MDF_OK : MDF_ERR_INVALID_ARG;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Parse the json formatted string");
 
     mdf_event_loop_send(MDF_EVENT_MLINK_GET_STATUS, NULL);
 
-    for (int i = 0; i < cids_num; ++i) {
-        char *tmp_str = NULL;
+    for (cJSON *pCid = pCids->child; pCid; pCid = pCid->next) {
+        MDF_ERROR_CONTINUE(pCid->type != cJSON_Number, "The cid must be a number");
+
+        uint16_t cid = pCid->valueint;
+        characteristic = mlink_characteristic_find(cid);
+        MDF_ERROR_CONTINUE(!characteristic, "The characteristic does not exist, cid: %d", cid);
 
-        switch (mlink_get_characteristics_format(cids[i])) {
+        switch (characteristic->format) {
             case CHARACTERISTIC_FORMAT_INT:
-                ret = mlink_device_get_value(cids[i], &value.value_int);
+                ret = mlink_device_get_value(cid, &value.value_int);
                 MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
-                mlink_json_pack(&tmp_str, "cid", cids[i]);
-                mlink_json_pack(&tmp_str, "value", value.value_int);
+                mlink_json_buf_pack_format(&characteristics_list, "[]",
+                                           "{\"cid\":%d,\"value\":%d}", cid, value.value_int);
                 break;
 
             case CHARACTERISTIC_FORMAT_DOUBLE:
-                ret = mlink_device_get_value(cids[i], &value.value_double);
+                ret = mlink_device_get_value(cid, &value.value_double);
                 MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
-                mlink_json_pack(&tmp_str, "cid", cids[i]);
-                mlink_json_pack_double(&tmp_str, "value", value.value_double);
+                mlink_json_buf_pack_format(&characteristics_list, "[]",
+                                           "{\"cid\":%d,\"value\":%lf}", cid, value.value_double);
                 break;
 
             case CHARACTERISTIC_FORMAT_STRING:
-                ret = mlink_device_get_value(cids[i], &value.value_string);
+                ret = mlink_device_get_value(cid, &value.value_string);
                 MDF_ERROR_BREAK(ret < 0, "<%s> mlink_device_get_value", mdf_err_to_name(ret));
-                mlink_json_pack(&tmp_str, "cid", cids[i]);
-                mlink_json_pack(&tmp_str, "value", value.value_string);
+
+                /**< A sub json object or array is packed as is */
+                if (*value.value_string == '{' || *value.value_string == '[') {
+                    mlink_json_buf_pack_format(&characteristics_list, "[]",
+                                               "{\"cid\":%d,\"value\":%s}", cid, value.value_string);
+                } else {
+                    mlink_json_buf_pack_format(&characteristics_list, "[]",
+                                               "{\"cid\":%d,\"value\":\"%s\"}", cid, value.value_string);
+                }
+
                 break;
 
             default:
@@ -426,67 +676,85 @@ static mdf_err_t mlink_handle_get_status(mlink_handle_data_t *handle_data)
                 break;
 
         }
-
-        if (tmp_str) {
-            mlink_json_pack(&characteristics_list, "[]", tmp_str);
-            MDF_FREE(tmp_str);
-        }
     }
 
-    MDF_ERROR_CHECK(!characteristics_list, MDF_FAIL, "Create a json string");
+    ret = characteristics_list.size ? MDF_OK : MDF_FAIL;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Create a json string");
 
-    handle_data->resp_size = mlink_json_pack(&handle_data->resp_data,
-                             "characteristics", characteristics_list);
-    MDF_FREE(characteristics_list);
+    mlink_json_buf_pack_raw(&resp, "characteristics", characteristics_list.data, characteristics_list.size);
 
-    return MDF_OK;
+    handle_data->resp_data = resp.data;
+    handle_data->resp_size = resp.size;
+
+EXIT:
+    mlink_json_buf_free(&characteristics_list);
+    cJSON_Delete(pJson);
+    return ret;
 }
 
 static mdf_err_t mlink_handle_set_status(mlink_handle_data_t *handle_data)
 {
     MDF_ERROR_CHECK(!mlink_device_set_value, MDF_FAIL, "This device does not support set_status");
 
-    int cid         = 0;
+    if (handle_data->req_fromat == MLINK_HTTPD_FORMAT_HEX) {
+        return mlink_handle_set_status_binary(handle_data);
+    }
+
     mdf_err_t ret   = MDF_OK;
-    size_t cids_num = 0;
     characteristic_value_t value = {0};
-    char *characteristics_list[CHARACTERISTICS_MAX_NUM] = {NULL};
+    mlink_characteristics_t *characteristic = NULL;
+    uint16_t *report_cids = NULL;
+    size_t report_num     = 0;
 
-    ret = mlink_json_parse(handle_data->req_data, "characteristics", &cids_num);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    cJSON *pJson = cJSON_Parse(handle_data->req_data);
+    MDF_ERROR_CHECK(!pJson, MDF_ERR_INVALID_ARG, "Parse the json formatted string");
 
-    ret = mlink_json_parse(handle_data->req_data, "characteristics", characteristics_list);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    cJSON *pList = cJSON_GetObjectItem(pJson, "characteristics");
 
-    for (int i = 0; i < cids_num; ++i) {
-        ret = mlink_json_parse(characteristics_list[i], "cid",  &cid);
+    if (!pList || pList->type != cJSON_Array) {
+        MDF_LOGW("Parse the json formatted string");
+        cJSON_Delete(pJson);
+        return MDF_FAIL;
+    }
 
-        if (ret) {
-            MDF_LOGW("<%s> Parse the json formatted string", mdf_err_to_name(ret));
-            MDF_FREE(characteristics_list[i]);
-            continue;
-        }
+#ifdef CONFIG_MLINK_SHADOW_REPORT
+    report_cids = MDF_MALLOC(g_device_info->characteristics_num * sizeof(uint16_t));
+#endif /**< CONFIG_MLINK_SHADOW_REPORT */
 
-        switch (mlink_get_characteristics_format(cid)) {
+    for (cJSON *pItem = pList->child; pItem; pItem = pItem->next) {
+        cJSON *pCid   = cJSON_GetObjectItem(pItem, "cid");
+        cJSON *pValue = cJSON_GetObjectItem(pItem, "value");
+        MDF_ERROR_CONTINUE(!pCid || pCid->type != cJSON_Number || !pValue,
+                           "Parse the json formatted string");
+
+        uint16_t cid = pCid->valueint;
+        characteristic = mlink_characteristic_find(cid);
+        MDF_ERROR_CONTINUE(!characteristic, "The characteristic does not exist, cid: %d", cid);
+
+        switch (characteristic->format) {
             case CHARACTERISTIC_FORMAT_INT:
-                ret = mlink_json_parse(characteristics_list[i], "value", &value.value_int);
-                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> Parse the json formatted string", mdf_err_to_name(ret));
-                ret = mlink_device_set_value(cid, &value.value_int);
+                value.value_int = pValue->valueint;
+                ret = mlink_characteristic_set_value(cid, &value.value_int);
                 MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value, cid: %d, value: %d", mdf_err_to_name(ret), cid, value.value_int);
                 break;
 
             case CHARACTERISTIC_FORMAT_DOUBLE:
-                ret = mlink_json_parse(characteristics_list[i], "value", &value.value_double);
-                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> Parse the json formatted string", mdf_err_to_name(ret));
-                ret = mlink_device_set_value(cid, &value.value_double);
+                value.value_double = pValue->valuedouble;
+                ret = mlink_characteristic_set_value(cid, &value.value_double);
                 MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value, cid: %d, value: %f", mdf_err_to_name(ret), cid, value.value_double);
                 break;
 
             case CHARACTERISTIC_FORMAT_STRING:
-                ret = mlink_json_parse(characteristics_list[i], "value", &value.value_string);
-                MDF_ERROR_BREAK(ret != MDF_OK, "<%s> Parse the json formatted string", mdf_err_to_name(ret));
-                ret = mlink_device_set_value(cid, value.value_string);
-                MDF_FREE(value.value_string);
+                /**< A sub json object or array is passed as its raw string */
+                if (pValue->type == cJSON_String) {
+                    ret = mlink_characteristic_set_value(cid, pValue->valuestring);
+                } else {
+                    value.value_string = cJSON_PrintUnformatted(pValue);
+                    MDF_ERROR_BREAK(!value.value_string, "cJSON_PrintUnformatted");
+                    ret = mlink_characteristic_set_value(cid, value.value_string);
+                    MDF_FREE(value.value_string);
+                }
+
                 MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mlink_device_set_value,", mdf_err_to_name(ret));
                 break;
 
@@ -495,9 +763,16 @@ static mdf_err_t mlink_handle_set_status(mlink_handle_data_t *handle_data)
                 break;
         }
 
-        MDF_FREE(characteristics_list[i]);
+        if (ret == MDF_OK && report_cids && report_num < g_device_info->characteristics_num) {
+            report_cids[report_num++] = cid;
+        }
     }
 
+    cJSON_Delete(pJson);
+
+    mlink_characteristic_report(report_cids, report_num);
+    MDF_FREE(report_cids);
+
     mdf_event_loop_send(MDF_EVENT_MLINK_SET_STATUS, NULL);
 
     return MDF_OK;
@@ -725,16 +1000,18 @@ static mdf_err_t mlink_handle_get_group(mlink_handle_data_t *handle_data)
         MDF_ERROR_CHECK(!group_list, MDF_ERR_NO_MEM, "");
 
         if (esp_mesh_get_group_list(group_list, group_num) == MDF_OK) {
-            char *group_str = NULL;
+            mlink_json_buf_t resp      = {0};
+            mlink_json_buf_t group_str = {0};
             char group_id_str[13] = {0x0};
 
             for (int i = 0; i < group_num; ++i) {
                 mlink_mac_hex2str(group_list[i].addr, group_id_str);
-                mlink_json_pack(&group_str, "[]", group_id_str);
+                mlink_json_buf_pack(&group_str, "[]", group_id_str);
             }
 
-            mlink_json_pack(&handle_data->resp_data, "group", group_str);
-            MDF_FREE(group_str);
+            mlink_json_buf_pack_raw(&resp, "group", group_str.data, group_str.size);
+            mlink_json_buf_free(&group_str);
+            handle_data->resp_data = resp.data;
         }
 
         MDF_FREE(group_list);
@@ -880,11 +1157,61 @@ mdf_err_t mlink_ble_ibeacon_get_config(mlink_handle_data_t *handle_data)
     return ESP_OK;
 }
 
+typedef struct {
+    mlink_handle_data_t *handle_data;
+    size_t capacity;           /**< The size reserved for resp_data */
+} mlink_sniffer_report_buf_t;
+
+static mdf_err_t mlink_sniffer_report_append(const uint8_t *data, size_t size, void *arg)
+{
+    mlink_sniffer_report_buf_t *buf  = (mlink_sniffer_report_buf_t *)arg;
+    mlink_handle_data_t *handle_data = buf->handle_data;
+
+    /**< Only grows if the sniffer buffer is resized during the report */
+    if (handle_data->resp_size + size > buf->capacity) {
+        char *resp_data = MDF_REALLOC(handle_data->resp_data, handle_data->resp_size + size);
+        MDF_ERROR_CHECK(!resp_data, MDF_ERR_NO_MEM, "");
+
+        handle_data->resp_data = resp_data;
+        buf->capacity          = handle_data->resp_size + size;
+    }
+
+    memcpy(handle_data->resp_data + handle_data->resp_size, data, size);
+    handle_data->resp_size += size;
+
+    return MDF_OK;
+}
+
 static mdf_err_t mlink_sniffer_get_data(mlink_handle_data_t *handle_data)
 {
-    mdf_err_t ret = MDF_OK;
+    mdf_err_t ret        = MDF_OK;
+    char format_str[16]  = {0};
+    bool delta           = false;
 
     handle_data->resp_fromat = MLINK_HTTPD_FORMAT_HEX;
+
+    if (mlink_json_parse(handle_data->req_data, "format", format_str) == MDF_OK
+            && !strcasecmp(format_str, "batch")) {
+        mlink_sniffer_config_t config   = {0x0};
+        mlink_sniffer_report_buf_t buf  = {.handle_data = handle_data};
+        const size_t batch_max_num      = (MWIFI_PAYLOAD_LEN - sizeof(mlink_sniffer_batch_t)) / sizeof(mlink_sniffer_record_t);
+
+        mlink_json_parse(handle_data->req_data, "delta", &delta);
+        mlink_sniffer_get_config(&config);
+
+        /**< Reserve the records of all the devices and the header of each batch at once */
+        buf.capacity = config.buffer_num * sizeof(mlink_sniffer_record_t)
+                       + (config.buffer_num / batch_max_num + 1) * sizeof(mlink_sniffer_batch_t);
+        handle_data->resp_size = 0;
+        handle_data->resp_data = MDF_MALLOC(buf.capacity);
+        MDF_ERROR_CHECK(!handle_data->resp_data, MDF_ERR_NO_MEM, "");
+
+        ret = mlink_sniffer_report(delta, mlink_sniffer_report_append, &buf);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_sniffer_report, size: %d", handle_data->resp_size);
+
+        return MDF_OK;
+    }
+
     ret = mlink_sniffer_data((uint8_t **)&handle_data->resp_data, (size_t *)&handle_data->resp_size);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "get_sniffer_list, size: %d", handle_data->resp_size);
 
@@ -950,51 +1277,270 @@ static mdf_err_t mlink_sniffer_get_cfg(mlink_handle_data_t *handle_data)
 }
 
 static mlink_handle_t g_handles_list[MLINK_HANDLES_MAX_SIZE] = {
-    {"reset",            mlink_handle_system_reset},
-    {"reboot",           mlink_handle_system_reboot},
-    {"get_device_info",  mlink_handle_get_info},
-    {"get_status",       mlink_handle_get_status},
-    {"set_status",       mlink_handle_set_status},
-    {"add_device",       mlink_handle_add_device},
-    {"rename_device",    mlink_handle_set_name},
-    {"set_position",     mlink_handle_set_position},
-    {"get_ota_progress", mlink_handle_get_ota_progress},
-    {"set_ota_fallback", mlink_handle_set_ota_fallback},
-    {"get_mesh_config",  mlink_handle_get_config},
-    {"set_mesh_config",  mlink_handle_set_config},
-    {"set_group",        mlink_handle_set_group},
-    {"get_group",        mlink_handle_get_group},
-    {"remove_group",     mlink_handle_remove_group},
-    {"get_sniffer_info", mlink_sniffer_get_data},
-    {"get_sniffer_config", mlink_sniffer_get_cfg},
-    {"set_sniffer_config", mlink_sniffer_set_cfg},
-    {"get_ibeacon_config", mlink_ble_ibeacon_get_config},
-    {"set_ibeacon_config", mlink_ble_ibeacon_set_config},
-    {NULL,                 NULL},
+    {"reset",              MLINK_HANDLE_ID_RESET,              0, mlink_handle_system_reset},
+    {"reboot",             MLINK_HANDLE_ID_REBOOT,             0, mlink_handle_system_reboot},
+    {"get_device_info",    MLINK_HANDLE_ID_GET_DEVICE_INFO,    0, mlink_handle_get_info},
+    {"get_status",         MLINK_HANDLE_ID_GET_STATUS,         0, mlink_handle_get_status, true},
+    {"set_status",         MLINK_HANDLE_ID_SET_STATUS,         0, mlink_handle_set_status, true},
+    {"add_device",         MLINK_HANDLE_ID_ADD_DEVICE,         0, mlink_handle_add_device},
+    {"rename_device",      MLINK_HANDLE_ID_RENAME_DEVICE,      0, mlink_handle_set_name},
+    {"set_position",       MLINK_HANDLE_ID_SET_POSITION,       0, mlink_handle_set_position},
+    {"get_ota_progress",   MLINK_HANDLE_ID_GET_OTA_PROGRESS,   0, mlink_handle_get_ota_progress},
+    {"set_ota_fallback",   MLINK_HANDLE_ID_SET_OTA_FALLBACK,   0, mlink_handle_set_ota_fallback},
+    {"get_mesh_config",    MLINK_HANDLE_ID_GET_MESH_CONFIG,    0, mlink_handle_get_config},
+    {"set_mesh_config",    MLINK_HANDLE_ID_SET_MESH_CONFIG,    0, mlink_handle_set_config},
+    {"set_group",          MLINK_HANDLE_ID_SET_GROUP,          0, mlink_handle_set_group},
+    {"get_group",          MLINK_HANDLE_ID_GET_GROUP,          0, mlink_handle_get_group},
+    {"remove_group",       MLINK_HANDLE_ID_REMOVE_GROUP,       0, mlink_handle_remove_group},
+    {"get_sniffer_info",   MLINK_HANDLE_ID_GET_SNIFFER_INFO,   0, mlink_sniffer_get_data},
+    {"get_sniffer_config", MLINK_HANDLE_ID_GET_SNIFFER_CONFIG, 0, mlink_sniffer_get_cfg},
+    {"set_sniffer_config", MLINK_HANDLE_ID_SET_SNIFFER_CONFIG, 0, mlink_sniffer_set_cfg},
+    {"get_ibeacon_config", MLINK_HANDLE_ID_GET_IBEACON_CONFIG, 0, mlink_ble_ibeacon_get_config},
+    {"set_ibeacon_config", MLINK_HANDLE_ID_SET_IBEACON_CONFIG, 0, mlink_ble_ibeacon_set_config},
+    {NULL,                 0,                                  0, NULL},
 };
 
-mdf_err_t mlink_set_handle(const char *name, const mlink_handle_func_t func)
+/**
+ * @brief Open addressing hash tables of the handler list, indexed by the hash of
+ *        the name and by the numeric identifier. Each slot stores the index of
+ *        the handler plus one, 0 means the slot is empty.
+ */
+static uint8_t g_handles_name_table[MLINK_HANDLES_TABLE_SIZE] = {0};
+static uint8_t g_handles_id_table[MLINK_HANDLES_TABLE_SIZE]   = {0};
+static volatile int g_handles_num = -1;
+
+/**
+ * @brief FNV-1a hash of the name, ignoring case to be consistent with strcasecmp()
+ */
+static uint32_t mlink_handle_hash(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *name; ++name) {
+        hash ^= (uint8_t)tolower((uint8_t) * name);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void mlink_handle_table_insert(uint8_t *table, uint32_t key, int index)
+{
+    for (uint32_t i = key;; ++i) {
+        uint8_t *slot = table + (i & (MLINK_HANDLES_TABLE_SIZE - 1));
+
+        if (*slot == 0 || *slot == index + 1) {
+            *slot = index + 1;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Build the hash tables from the static handler list, only done once.
+ *        The tables are filled before g_handles_num is set, under a spinlock
+ *        since the first lookups may come from several tasks
+ */
+static void mlink_handle_table_init(void)
+{
+    static portMUX_TYPE s_handles_mux = portMUX_INITIALIZER_UNLOCKED;
+
+    if (g_handles_num >= 0) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_handles_mux);
+
+    if (g_handles_num < 0) {
+        int handles_num = 0;
+
+        for (; g_handles_list[handles_num].name; handles_num++) {
+            mlink_handle_t *handle = g_handles_list + handles_num;
+            handle->hash = mlink_handle_hash(handle->name);
+            mlink_handle_table_insert(g_handles_name_table, handle->hash, handles_num);
+
+            if (handle->id) {
+                mlink_handle_table_insert(g_handles_id_table, handle->id, handles_num);
+            }
+        }
+
+        g_handles_num = handles_num;
+    }
+
+    portEXIT_CRITICAL(&s_handles_mux);
+}
+
+static mlink_handle_t *mlink_handle_find(const char *name)
+{
+    mlink_handle_table_init();
+
+    uint32_t hash = mlink_handle_hash(name);
+
+    for (uint32_t i = hash;; ++i) {
+        uint8_t slot = g_handles_name_table[i & (MLINK_HANDLES_TABLE_SIZE - 1)];
+
+        if (!slot) {
+            return NULL;
+        }
+
+        if (g_handles_list[slot - 1].hash == hash && !strcasecmp(g_handles_list[slot - 1].name, name)) {
+            return g_handles_list + slot - 1;
+        }
+    }
+}
+
+static mlink_handle_t *mlink_handle_find_id(uint16_t id)
+{
+    mlink_handle_table_init();
+
+    for (uint32_t i = id;; ++i) {
+        uint8_t slot = g_handles_id_table[i & (MLINK_HANDLES_TABLE_SIZE - 1)];
+
+        if (!slot) {
+            return NULL;
+        }
+
+        if (g_handles_list[slot - 1].id == id) {
+            return g_handles_list + slot - 1;
+        }
+    }
+}
+
+mdf_err_t mlink_set_handle_id(const char *name, uint16_t id, const mlink_handle_func_t func)
 {
     MDF_PARAM_CHECK(name);
     MDF_PARAM_CHECK(func);
 
-    int i = 0;
+    mlink_handle_t *handle = mlink_handle_find(name);
 
-    for (i = 0; g_handles_list[i].name && i < MLINK_HANDLES_MAX_SIZE; i++) {
-        if (!strcasecmp(g_handles_list[i].name, name)) {
-            g_handles_list[i].func = (mlink_handle_func_t)func;
-            return ESP_OK;
-        }
+    if (!handle) {
+        MDF_ERROR_CHECK(g_handles_num >= MLINK_HANDLES_MAX_SIZE - 1, MDF_FAIL, "Mlink handles list is full");
+
+        handle       = g_handles_list + g_handles_num;
+        handle->name = name;
+        handle->hash = mlink_handle_hash(name);
+        mlink_handle_table_insert(g_handles_name_table, handle->hash, g_handles_num);
+        g_handles_num++;
     }
 
-    MDF_ERROR_CHECK(i == MLINK_HANDLES_MAX_SIZE, MDF_FAIL, "Mlink handles list is full");
+    if (id && handle->id != id) {
+        mlink_handle_t *handle_id = mlink_handle_find_id(id);
+        MDF_ERROR_CHECK(handle_id && handle_id != handle, MDF_ERR_INVALID_ARG,
+                        "The id: %d has been used by the request: %s", id, handle_id->name);
 
-    g_handles_list[i].name = name;
-    g_handles_list[i].func = (mlink_handle_func_t)func;
+        MDF_ERROR_CHECK(handle->id, MDF_ERR_INVALID_ARG,
+                        "The request: %s already has the id: %d", name, handle->id);
+
+        handle->id = id;
+        mlink_handle_table_insert(g_handles_id_table, id, handle - g_handles_list);
+    }
+
+    handle->func = (mlink_handle_func_t)func;
 
     return ESP_OK;
 }
 
+mdf_err_t mlink_set_handle(const char *name, const mlink_handle_func_t func)
+{
+    return mlink_set_handle_id(name, 0, func);
+}
+
+mdf_err_t mlink_set_handle_binary(const char *name, uint16_t id, const mlink_handle_func_t func)
+{
+    MDF_PARAM_CHECK(id);
+
+    mdf_err_t ret = mlink_set_handle_id(name, id, func);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "");
+
+    mlink_handle_find_id(id)->binary = true;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Call the handler of a compact binary request, the response items of
+ *        the handler are prefixed with the request identifier and the status code
+ */
+static mdf_err_t mlink_handle_request_binary(mlink_handle_data_t *handle_data)
+{
+    mdf_err_t ret          = MDF_OK;
+    uint16_t request       = 0;
+    mlink_handle_t *handle = NULL;
+
+    ret = mlink_tlv_parse_request((uint8_t *)handle_data->req_data, handle_data->req_size, &request);
+    handle = (ret == MDF_OK) ? mlink_handle_find_id(request) : NULL;
+
+    /**< Handlers that only understand json must not be given binary data */
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> mlink_tlv_parse_request", mdf_err_to_name(ret));
+    } else if (!handle || !handle->func || !handle->binary) {
+        MDF_LOGD("The binary request is not supported, id: %d", request);
+        ret = MDF_ERR_NOT_SUPPORTED;
+    } else {
+        MDF_LOGD("Function: %s", handle->name);
+        ret = handle->func(handle_data);
+    }
+
+    size_t body_size = handle_data->resp_data ? handle_data->resp_size : 0;
+    mlink_tlv_buf_t resp = {
+        .data     = MDF_MALLOC(MLINK_TLV_REQUEST_LEN + MLINK_TLV_HEAD_LEN + sizeof(int32_t) + body_size),
+        .capacity = MLINK_TLV_REQUEST_LEN + MLINK_TLV_HEAD_LEN + sizeof(int32_t) + body_size,
+    };
+
+    if (!resp.data) {
+        MDF_FREE(handle_data->resp_data);
+        return MDF_ERR_NO_MEM;
+    }
+
+    mlink_tlv_pack_request(&resp, request);
+    mlink_tlv_pack_int32(&resp, MLINK_TLV_TYPE_STATUS, -ret);
+
+    if (body_size) {
+        memcpy(resp.data + resp.size, handle_data->resp_data, body_size);
+        resp.size += body_size;
+    }
+
+    MDF_FREE(handle_data->resp_data);
+    handle_data->resp_data   = (char *)resp.data;
+    handle_data->resp_size   = resp.size;
+    handle_data->resp_fromat = MLINK_HTTPD_FORMAT_HEX;
+
+    return ret;
+}
+
+/**
+ * @brief Find the handler by the "request" field, which is either the name or the numeric identifier
+ */
+static mlink_handle_t *mlink_handle_find_request(const char *req_data)
+{
+    mlink_handle_t *handle = NULL;
+    cJSON *pJson = cJSON_Parse(req_data);
+
+    if (!pJson) {
+        MDF_LOGW("cJSON_Parse, req_data: %s", req_data);
+        return NULL;
+    }
+
+    cJSON *pSub = cJSON_GetObjectItem(pJson, "request");
+
+    if (!pSub) {
+        MDF_LOGW("The request field was not found, req_data: %s", req_data);
+    } else if (pSub->type == cJSON_Number) {
+        /**< An identifier out of range would alias a valid one once truncated */
+        if (pSub->valuedouble >= 1 && pSub->valuedouble <= UINT16_MAX && pSub->valuedouble == pSub->valueint) {
+            handle = mlink_handle_find_id(pSub->valueint);
+        } else {
+            MDF_LOGW("The request id is out of range, req_data: %s", req_data);
+        }
+    } else if (pSub->type == cJSON_String) {
+        handle = mlink_handle_find(pSub->valuestring);
+    }
+
+    cJSON_Delete(pJson);
+
+    return handle;
+}
+
 mdf_err_t mlink_handle(const uint8_t *src_addr, const mlink_httpd_type_t *type,
                        const void *data, size_t size)
 {
@@ -1005,7 +1551,7 @@ mdf_err_t mlink_handle(const uint8_t *src_addr, const mlink_httpd_type_t *type,
 
     mdf_err_t ret                = MDF_FAIL;
     const uint8_t *dest_addr     = NULL;
-    char func_name[32]           = {0x0};
+    mlink_handle_t *handle       = NULL;
     mlink_httpd_type_t resp_type = {0x0};
     mwifi_data_type_t data_type  = {
         .compression = true,
@@ -1019,21 +1565,21 @@ mdf_err_t mlink_handle(const uint8_t *src_addr, const mlink_httpd_type_t *type,
         .resp_fromat = MLINK_HTTPD_FORMAT_JSON,
     };
 
-    MDF_ERROR_GOTO(type->format != MLINK_HTTPD_FORMAT_JSON, EXIT,
-                   "The current version only supports the json protocol");
+    MDF_ERROR_GOTO(type->format != MLINK_HTTPD_FORMAT_JSON && type->format != MLINK_HTTPD_FORMAT_HEX, EXIT,
+                   "The current version only supports the json and the binary protocol");
 
-    ret = mlink_json_parse(handle_data.req_data, "request", func_name);
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_json_parse, ret: %d, key: %s, value: %.*s",
-                   ret, func_name, handle_data.req_size, handle_data.req_data);
-
-    ret = MDF_ERR_NOT_SUPPORTED;
+    if (type->format == MLINK_HTTPD_FORMAT_HEX) {
+        handle_data.req_fromat = MLINK_HTTPD_FORMAT_HEX;
+        ret = mlink_handle_request_binary(&handle_data);
+    } else {
+        handle = mlink_handle_find_request(handle_data.req_data);
 
-    /**< If we can find this request from our list, we will handle this request */
-    for (int i = 0; g_handles_list[i].func; i++) {
-        if (!strcasecmp(func_name, g_handles_list[i].name)) {
-            MDF_LOGD("Function: %s", func_name);
-            ret = g_handles_list[i].func(&handle_data);
-            break;
+        /**< If we can find this request from our list, we will handle this request */
+        if (handle && handle->func) {
+            MDF_LOGD("Function: %s", handle->name);
+            ret = handle->func(&handle_data);
+        } else {
+            ret = MDF_ERR_NOT_SUPPORTED;
         }
     }
 
@@ -1052,7 +1598,7 @@ EXIT:
     resp_type.format = handle_data.resp_fromat;
     resp_type.from   = MLINK_HTTPD_FROM_DEVICE;
     resp_type.resp   = (ret == MDF_OK) ? true : false;
-    data_type.protocol = MLINK_PROTO_HTTPD;
+    data_type.protocol = (handle_data.resp_fromat == MLINK_HTTPD_FORMAT_HEX) ? MLINK_PROTO_BINARY : MLINK_PROTO_HTTPD;
     memcpy(&data_type.custom, &resp_type, sizeof(mlink_httpd_type_t));
 
     if (handle_data.resp_fromat == MLINK_HTTPD_FORMAT_JSON) {
@@ -1072,22 +1618,35 @@ mdf_err_t mlink_handle_request(mlink_handle_data_t *handle_data)
 {
     MDF_PARAM_CHECK(handle_data);
 
-    mdf_err_t ret           = MDF_FAIL;
-    char      func_name[32] = {0x0};
-
-    ret = mlink_json_parse(handle_data->req_data, "request", func_name);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_json_parse, ret: %d, key: %s, value: %.*s",
-                    ret, func_name, handle_data->req_size, handle_data->req_data);
+    if (handle_data->req_fromat == MLINK_HTTPD_FORMAT_HEX) {
+        return mlink_handle_request_binary(handle_data);
+    }
 
-    ret = MDF_ERR_NOT_SUPPORTED;
+    mlink_handle_t *handle = mlink_handle_find_request(handle_data->req_data);
 
     /**< If we can find this request from our list, we will handle this request */
-    for (int i = 0; g_handles_list[i].func; i++) {
-        if (!strcasecmp(func_name, g_handles_list[i].name)) {
-            MDF_LOGD("Function: %s", func_name);
-            ret = g_handles_list[i].func(handle_data);
-        }
+    if (!handle || !handle->func) {
+        MDF_LOGD("The request is not supported, req_data: %.*s", handle_data->req_size, handle_data->req_data);
+        return MDF_ERR_NOT_SUPPORTED;
     }
 
-    return ret;
+    MDF_LOGD("Function: %s", handle->name);
+
+    return handle->func(handle_data);
+}
+
+mdf_err_t mlink_handle_request_id(uint16_t id, mlink_handle_data_t *handle_data)
+{
+    MDF_PARAM_CHECK(handle_data);
+
+    mlink_handle_t *handle = mlink_handle_find_id(id);
+
+    if (!handle || !handle->func) {
+        MDF_LOGD("The request is not supported, id: %d", id);
+        return MDF_ERR_NOT_SUPPORTED;
+    }
+
+    MDF_LOGD("Function: %s", handle->name);
+
+    return handle->func(handle_data);
 }
@@ -21,7 +21,23 @@
 
 #define MLINK_HTTPD_FIRMWARE_URL_LEN (128)
 #define MLINK_HTTPD_RESP_TIMEROUT_MS (15000)
+#define MLINK_HTTPD_BATCH_TIMEOUT_MS (3000) /**< Default deadline of collecting the responses of a batch request */
+#define MLINK_HTTPD_BATCH_TIMEOUT_MIN_MS (100)
+#define MLINK_HTTPD_BATCH_RETRY_MS   (20)   /**< The deadline is handled again after this if it can not be now */
 #define MLINK_HTTPD_MAX_CONNECT      (CONFIG_LWIP_MAX_SOCKETS - 5)
+#define MLINK_HTTPD_CONTENT_MAX_LEN  (8095) /**< Larger data is not accepted by mwifi_write() */
+#define MLINK_HTTPD_413              "413 Payload Too Large"
+#define MLINK_HTTPD_QUEUE_SIZE       CONFIG_MLINK_HTTPD_QUEUE_SIZE
+#define MLINK_HTTPD_503              "503 Service Unavailable"
+#define MLINK_HTTPD_STR(x)           #x
+#define MLINK_HTTPD_XSTR(x)          MLINK_HTTPD_STR(x)
+
+/**
+ * @brief The socket descriptors of lwip are consecutive numbers, one connection
+ *        is recorded per socket at a fixed position of g_conn_list
+ */
+#define MLINK_HTTPD_CONN_TABLE_SIZE  (CONFIG_LWIP_MAX_SOCKETS)
+#define MLINK_HTTPD_CONN_INDEX(sockfd) ((sockfd) % MLINK_HTTPD_CONN_TABLE_SIZE)
 
 /**
  * @brief The flag of http chunks
@@ -43,12 +59,42 @@ typedef struct {
     uint16_t sockfd;       /**< Socket descriptor for sending data */
     uint16_t num;          /**< Number of destination addresses */
     uint8_t flag;          /**< The flag of http chunks */
+    bool batch;            /**< The responses are aggregated into one response */
+    bool expired;          /**< The deadline of the batch is reached, the partial results are being sent */
+    size_t addrs_num;      /**< Number of addresses, only for batch */
+    uint8_t *addrs_list;   /**< Addresses that have not responded yet are non-zero, only for batch */
+    mlink_json_buf_t resp; /**< Aggregated responses, only for batch */
+    uint32_t send_timeout_ms; /**< Send timeout set on the socket, kept until the socket is reopened */
 } mlink_connection_t;
 
 static const char *TAG                 = "mlink_httpd";
 static httpd_handle_t g_httpd_handle   = NULL;
 static QueueHandle_t g_mlink_queue     = NULL;
 static mlink_connection_t *g_conn_list = NULL;
+static SemaphoreHandle_t g_batch_lock  = NULL;
+
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+#define MLINK_HTTPD_EVENTS_FLUSH_MS      (1000)
+#define MLINK_HTTPD_EVENTS_HEARTBEAT_NUM (15)   /**< An idle stream gets a comment every 15 flush periods */
+
+/**
+ * @brief A client subscribed to the events of the nodes
+ */
+typedef struct {
+    int sockfd;            /**< Socket of the event stream, 0 means the entry is unused */
+    httpd_handle_t handle; /**< The server of the socket */
+    char *pending;         /**< Events not accepted by the socket yet */
+    size_t pending_size;   /**< Length of the pending events */
+    uint8_t idle_count;    /**< Number of flush periods without any event */
+} mlink_event_sub_t;
+
+static mlink_event_sub_t g_event_subs[CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM];
+static SemaphoreHandle_t g_event_lock = NULL;
+static TimerHandle_t g_event_timer    = NULL;
+static uint32_t g_event_id            = 0;
+
+static esp_err_t mlink_device_events(httpd_req_t *req);
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
 
 static void mlink_connection_remove(mlink_connection_t *mlink_conn);
 static mlink_connection_t *mlink_connection_find(uint16_t sockfd);
@@ -89,7 +135,15 @@ static const httpd_uri_t basic_handlers[] = {
         .method   = HTTP_POST,
         .handler  = mlink_ota_stop,
         .user_ctx = NULL,
-    }
+    },
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+    {
+        .uri      = "/device_events",
+        .method   = HTTP_GET,
+        .handler  = mlink_device_events,
+        .user_ctx = NULL,
+    },
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
 };
 
 static mdf_err_t mlink_socket_keepalive(int sockfd, int keep_idle, int keep_interval, int keep_count)
@@ -147,13 +201,185 @@ static int httpd_default_send(httpd_handle_t hd, int sockfd, const char *buf, si
     return ret;
 }
 
+/**
+ * @brief Send the parts of a response with one call, the payload is sent from
+ *        the buffer of the caller instead of being copied behind the headers.
+ *        As httpd_default_send(), the connection is closed and removed on failure
+ *
+ * @note  iov is modified
+ */
+static int mlink_httpd_sendv(mlink_connection_t *mlink_conn, struct iovec *iov, int iovcnt)
+{
+    int ret          = 0;
+    int total_size   = 0;
+    struct msghdr msg = {0};
+
+    while (iovcnt > 0) {
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ret = sendmsg(mlink_conn->sockfd, &msg, 0);
+
+        if (ret <= 0) {
+            MDF_LOGW("socket send, err_str: %s, sockfd: %d", strerror(errno), mlink_conn->sockfd);
+            close(mlink_conn->sockfd);
+            mlink_connection_remove(mlink_conn);
+            return ret;
+        }
+
+        total_size += ret;
+
+        /**< Skip what has been sent, the socket may accept only a part before the timeout */
+        for (; iovcnt > 0 && ret >= iov->iov_len; ret -= iov->iov_len, iov++, iovcnt--);
+
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return total_size;
+}
+
 static void mlink_connection_remove(mlink_connection_t *mlink_conn)
 {
     if (mlink_conn && mlink_conn->timer) {
+        uint32_t send_timeout_ms = mlink_conn->send_timeout_ms;
+
         xTimerStop(mlink_conn->timer, 0);
         xTimerDelete(mlink_conn->timer, 0);
+        MDF_FREE(mlink_conn->addrs_list);
+        mlink_json_buf_free(&mlink_conn->resp);
         memset(mlink_conn, 0, sizeof(mlink_connection_t));
+        mlink_conn->send_timeout_ms = send_timeout_ms;
+    }
+}
+
+/**
+ * @brief Add the response of a node to a batch request, the responses of
+ *        unknown or repeated addresses are dropped
+ *
+ * @return The number of nodes that have not responded yet
+ */
+static size_t mlink_batch_append(mlink_connection_t *mlink_conn, const mlink_httpd_t *response)
+{
+    char mac_str[13] = {0};
+    uint8_t *addr    = NULL;
+
+    for (int i = 0; i < mlink_conn->addrs_num; ++i) {
+        if (!memcmp(mlink_conn->addrs_list + i * MWIFI_ADDR_LEN, response->addrs_list, MWIFI_ADDR_LEN)) {
+            addr = mlink_conn->addrs_list + i * MWIFI_ADDR_LEN;
+            break;
+        }
+    }
+
+    if (!addr) {
+        MDF_LOGD("Drop the response, addr: " MACSTR, MAC2STR(response->addrs_list));
+        return mlink_conn->num;
+    }
+
+    mlink_mac_hex2str(response->addrs_list, mac_str);
+
+    if (response->type.format == MLINK_HTTPD_FORMAT_JSON && response->size > 0) {
+        mlink_json_buf_pack_format(&mlink_conn->resp, "[]", "{\"mac\":\"%s\",\"data\":%.*s}",
+                                   mac_str, response->size, response->data);
+    } else {
+        /**< Responses that are not json are packed as a hex string */
+        char *hex_str = MDF_MALLOC(response->size * 2 + 1);
+        MDF_ERROR_CHECK(!hex_str, mlink_conn->num, "");
+
+        for (int i = 0; i < response->size; ++i) {
+            sprintf(hex_str + i * 2, "%02x", (uint8_t)response->data[i]);
+        }
+
+        hex_str[response->size * 2] = '\0';
+        mlink_json_buf_pack_format(&mlink_conn->resp, "[]", "{\"mac\":\"%s\",\"data\":\"%s\"}",
+                                   mac_str, hex_str);
+        MDF_FREE(hex_str);
     }
+
+    memset(addr, 0, MWIFI_ADDR_LEN);
+
+    return --mlink_conn->num;
+}
+
+/**
+ * @brief Send the aggregated responses of a batch request, the nodes that have
+ *        not responded before the deadline are listed in "timeout"
+ */
+static mdf_err_t mlink_batch_send(mlink_connection_t *mlink_conn)
+{
+    mdf_err_t ret    = MDF_OK;
+    char mac_str[13] = {0};
+    char header[96]  = {0};
+    size_t header_size = 0;
+    mlink_json_buf_t body         = {0};
+    mlink_json_buf_t timeout_list = {0};
+
+    for (int i = 0; i < mlink_conn->addrs_num; ++i) {
+        if (!MWIFI_ADDR_IS_EMPTY(mlink_conn->addrs_list + i * MWIFI_ADDR_LEN)) {
+            mlink_json_buf_pack(&timeout_list, "[]",
+                                mlink_mac_hex2str(mlink_conn->addrs_list + i * MWIFI_ADDR_LEN, mac_str));
+        }
+    }
+
+    mlink_json_buf_pack(&body, "status_code", 0);
+    mlink_json_buf_pack(&body, "device_num", mlink_conn->addrs_num);
+    mlink_json_buf_pack(&body, "response_num", mlink_conn->addrs_num - mlink_conn->num);
+    mlink_json_buf_pack_raw(&body, "devices", mlink_conn->resp.size ? mlink_conn->resp.data : "[]",
+                            mlink_conn->resp.size ? mlink_conn->resp.size : 2);
+
+    if (timeout_list.size) {
+        mlink_json_buf_pack_raw(&body, "timeout", timeout_list.data, timeout_list.size);
+    }
+
+    ret = body.size ? MDF_OK : MDF_ERR_NO_MEM;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Generate the batch response");
+
+    header_size = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: %d\r\n\r\n", body.size);
+
+    struct iovec iov[] = {
+        {.iov_base = header, .iov_len = header_size},
+        {.iov_base = body.data, .iov_len = body.size},
+    };
+
+    MDF_LOGD("Batch response, sockfd: %d, response_num: %d, device_num: %d",
+             mlink_conn->sockfd, mlink_conn->addrs_num - mlink_conn->num, mlink_conn->addrs_num);
+
+    ret = mlink_httpd_sendv(mlink_conn, iov, sizeof(iov) / sizeof(struct iovec));
+    MDF_ERROR_GOTO(ret <= 0, EXIT, "mlink_httpd_sendv");
+
+    ret = MDF_OK;
+
+EXIT:
+    mlink_json_buf_free(&body);
+    mlink_json_buf_free(&timeout_list);
+    return ret;
+}
+
+/**
+ * @brief Send the partial results of a batch request whose deadline is reached,
+ *        it runs in the httpd task
+ */
+static void mlink_batch_timeout_work(void *arg)
+{
+    mlink_connection_t *mlink_conn = (mlink_connection_t *)arg;
+
+    xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+
+    /**< The connection is cleared if all the nodes have responded in the meantime */
+    if (mlink_conn->batch && mlink_conn->expired) {
+        MDF_LOGW("Batch response timeout, sockfd: %d, %d of %d nodes are not responding",
+                 mlink_conn->sockfd, mlink_conn->num, mlink_conn->addrs_num);
+
+        /**< If sending fails, the connection has been removed by httpd_default_send */
+        mlink_batch_send(mlink_conn);
+        mlink_connection_remove(mlink_conn);
+    }
+
+    xSemaphoreGive(g_batch_lock);
 }
 
 static void mlink_connection_timeout_cb(void *timer)
@@ -165,6 +391,27 @@ static void mlink_connection_timeout_cb(void *timer)
         return ;
     }
 
+    /**< The deadline of a batch request is reached, the partial results are sent by the
+         httpd task, this task runs every timer of the system and must not block */
+    if (mlink_conn->batch) {
+        if (xSemaphoreTake(g_batch_lock, 0) != pdTRUE) {
+            xTimerChangePeriod(timer, MLINK_HTTPD_BATCH_RETRY_MS / portTICK_RATE_MS, 0);
+            return ;
+        }
+
+        if (mlink_conn->timer == timer && mlink_conn->batch && !mlink_conn->expired) {
+            mlink_conn->expired = true;
+
+            if (httpd_queue_work(mlink_conn->handle, mlink_batch_timeout_work, mlink_conn) != ESP_OK) {
+                mlink_conn->expired = false;
+                xTimerChangePeriod(timer, MLINK_HTTPD_BATCH_RETRY_MS / portTICK_RATE_MS, 0);
+            }
+        }
+
+        xSemaphoreGive(g_batch_lock);
+        return ;
+    }
+
     if (mlink_conn->flag != MLINK_HTTPD_CHUNKS_BODY) {
         chunk_footer = "HTTP/1.1 400 Bad Request\r\n"
                        "Content-Type: application/json\r\n"
@@ -188,36 +435,171 @@ static void mlink_connection_timeout_cb(void *timer)
 
 static mlink_connection_t *mlink_connection_find(uint16_t sockfd)
 {
-    for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
-        if (g_conn_list[i].sockfd == sockfd && g_conn_list[i].flag != MLINK_HTTPD_CHUNKS_NONE) {
-            return g_conn_list + i;
-        }
+    mlink_connection_t *mlink_conn = g_conn_list + MLINK_HTTPD_CONN_INDEX(sockfd);
+
+    if (mlink_conn->sockfd == sockfd && mlink_conn->flag != MLINK_HTTPD_CHUNKS_NONE) {
+        return mlink_conn;
     }
 
     MDF_LOGW("Mlink chunks is no find, sockfd: %d", sockfd);
     return NULL;
 }
 
-static mdf_err_t mlink_connection_add(httpd_req_t *req, uint16_t chunks_num)
+/**
+ * @brief Add a connection waiting for responses
+ *
+ * @param req              The http request
+ * @param chunks_num       The number of responses to wait for
+ * @param batch_addrs_list If not NULL, the responses of these addresses are aggregated
+ *                         into one response, the connection takes over the list
+ * @param batch_timeout_ms The deadline of collecting the responses, only for batch
+ */
+static mdf_err_t mlink_connection_add(httpd_req_t *req, uint16_t chunks_num,
+                                      uint8_t *batch_addrs_list, uint32_t batch_timeout_ms)
+{
+    uint32_t timeout_ms = batch_addrs_list ? batch_timeout_ms : MLINK_HTTPD_RESP_TIMEROUT_MS;
+    int sockfd          = httpd_req_to_sockfd(req);
+    mlink_connection_t *mlink_conn = g_conn_list + MLINK_HTTPD_CONN_INDEX(sockfd);
+
+    /**< The responses of the previous request on this socket are still being sent */
+    if (mlink_conn->flag != MLINK_HTTPD_CHUNKS_NONE) {
+        MDF_LOGW("Mlink chunks add, the previous request is not finished, sockfd: %d", sockfd);
+        MDF_FREE(batch_addrs_list);
+        return MDF_ERR_INVALID_STATE;
+    }
+
+    mlink_conn->num        = chunks_num;
+    mlink_conn->flag       = (chunks_num > 1 && !batch_addrs_list) ? MLINK_HTTPD_CHUNKS_HEADER : MLINK_HTTPD_CHUNKS_DATA;
+    mlink_conn->handle     = req->handle;
+    mlink_conn->sockfd     = sockfd;
+    mlink_conn->batch      = batch_addrs_list ? true : false;
+    mlink_conn->expired    = false;
+    mlink_conn->addrs_num  = batch_addrs_list ? chunks_num : 0;
+    mlink_conn->addrs_list = batch_addrs_list;
+    mlink_conn->timer      = xTimerCreate("chunk_timer", timeout_ms / portTICK_RATE_MS,
+                                          false, mlink_conn, mlink_connection_timeout_cb);
+
+    if (!mlink_conn->timer) {
+        MDF_LOGE("xTimerCreate mlink_conn fail");
+        MDF_FREE(mlink_conn->addrs_list);
+        mlink_conn->flag       = MLINK_HTTPD_CHUNKS_NONE;
+        mlink_conn->addrs_list = NULL;
+        return MDF_FAIL;
+    }
+
+    xTimerStart(mlink_conn->timer, portMAX_DELAY);
+
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+static void mlink_event_sub_remove(mlink_event_sub_t *sub, bool close_socket)
+{
+    if (close_socket) {
+        httpd_sess_trigger_close(sub->handle, sub->sockfd);
+    }
+
+    MDF_FREE(sub->pending);
+    memset(sub, 0, sizeof(mlink_event_sub_t));
+}
+
+/**
+ * @brief Send the pending events without blocking, what the socket does not
+ *        accept stays pending until the next event or flush period
+ */
+static mdf_err_t mlink_event_sub_flush(mlink_event_sub_t *sub)
 {
-    for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
-        if (g_conn_list[i].flag == MLINK_HTTPD_CHUNKS_NONE) {
-            g_conn_list[i].num    = chunks_num;
-            g_conn_list[i].flag   = (chunks_num > 1) ? MLINK_HTTPD_CHUNKS_HEADER : MLINK_HTTPD_CHUNKS_DATA;
-            g_conn_list[i].handle = req->handle;
-            g_conn_list[i].sockfd = httpd_req_to_sockfd(req);
-            g_conn_list[i].timer  = xTimerCreate("chunk_timer", MLINK_HTTPD_RESP_TIMEROUT_MS / portTICK_RATE_MS,
-                                                 false, g_conn_list + i, mlink_connection_timeout_cb);
-            MDF_ERROR_CHECK(!g_conn_list[i].timer, MDF_FAIL, "xTimerCreate mlink_conn fail");
-            xTimerStart(g_conn_list[i].timer, portMAX_DELAY);
+    while (sub->pending_size > 0) {
+        int ret = send(sub->sockfd, sub->pending, sub->pending_size, MSG_DONTWAIT);
 
-            mlink_socket_keepalive(g_conn_list[i].sockfd, 10, 3, 3);
-            return MDF_OK;
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
         }
+
+        MDF_ERROR_CHECK(ret <= 0, MDF_FAIL, "<%s> Send events, sockfd: %d", strerror(errno), sub->sockfd);
+
+        sub->pending_size -= ret;
+        memmove(sub->pending, sub->pending + ret, sub->pending_size);
     }
 
-    MDF_LOGW("Mlink chunks add");
-    return MDF_FAIL;
+    return MDF_OK;
+}
+
+/**
+ * @brief Queue an event to a subscriber, the event is dropped for this subscriber
+ *        only if its buffer is full. The subscriber finds the gap by the "id" of the events
+ */
+static void mlink_event_sub_append(mlink_event_sub_t *sub, const char *event, size_t size)
+{
+    if (sub->pending_size + size > CONFIG_MLINK_HTTPD_EVENTS_BUF_SIZE) {
+        MDF_LOGD("The subscriber is too slow, drop the event, sockfd: %d", sub->sockfd);
+    } else {
+        memcpy(sub->pending + sub->pending_size, event, size);
+        sub->pending_size += size;
+        sub->idle_count    = 0;
+    }
+
+    if (mlink_event_sub_flush(sub) != MDF_OK) {
+        mlink_event_sub_remove(sub, true);
+    }
+}
+
+static void mlink_event_timer_cb(void *timer)
+{
+    /**< Never block the timer task, the next period retries */
+    if (xSemaphoreTake(g_event_lock, 0) != pdTRUE) {
+        return;
+    }
+
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM; ++i) {
+        mlink_event_sub_t *sub = g_event_subs + i;
+
+        if (!sub->sockfd) {
+            continue;
+        }
+
+        /**< A stream never sends requests, it is kept from being the least recently used socket */
+        httpd_sess_update_lru_counter(sub->handle, sub->sockfd);
+
+        /**< A comment keeps the proxies open and finds the closed clients */
+        if (!sub->pending_size && ++sub->idle_count >= MLINK_HTTPD_EVENTS_HEARTBEAT_NUM) {
+            mlink_event_sub_append(sub, ":\n\n", 3);
+        } else if (mlink_event_sub_flush(sub) != MDF_OK) {
+            mlink_event_sub_remove(sub, true);
+        }
+    }
+
+    xSemaphoreGive(g_event_lock);
+}
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+
+/**
+ * @brief Called by the server for every new socket, the options that persist
+ *        for the lifetime of the socket are set here instead of per request
+ */
+static esp_err_t mlink_httpd_open_cb(httpd_handle_t hd, int sockfd)
+{
+    mlink_connection_t *mlink_conn = g_conn_list + MLINK_HTTPD_CONN_INDEX(sockfd);
+
+    /**< Left by a closed socket that had the same descriptor */
+    mlink_connection_remove(mlink_conn);
+    mlink_conn->send_timeout_ms = 0;
+
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+    xSemaphoreTake(g_event_lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM; ++i) {
+        if (g_event_subs[i].sockfd == sockfd) {
+            mlink_event_sub_remove(g_event_subs + i, false);
+        }
+    }
+
+    xSemaphoreGive(g_event_lock);
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+
+    mlink_socket_keepalive(sockfd, 10, 3, 3);
+
+    return ESP_OK;
 }
 
 static mdf_err_t mlink_get_mesh_info(httpd_req_t *req)
@@ -324,6 +706,20 @@ EXIT:
     return ret;
 }
 
+/**
+ * @brief The request is rejected because the root is busy, the client should
+ *        retry after 'Retry-After' seconds
+ */
+static esp_err_t mlink_httpd_resp_503(httpd_req_t *req, const char *message)
+{
+    mdf_err_t ret = MDF_FAIL;
+
+    ret = httpd_resp_set_hdr(req, "Retry-After", MLINK_HTTPD_XSTR(CONFIG_MLINK_HTTPD_RETRY_AFTER));
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Set the 'Retry-After' header");
+
+    return mlink_httpd_resp(req, MLINK_HTTPD_503, message);
+}
+
 static esp_err_t mlink_httpd_resp_200(httpd_req_t *req)
 {
     mdf_err_t ret           = MDF_FAIL;
@@ -338,6 +734,138 @@ static esp_err_t mlink_httpd_resp_200(httpd_req_t *req)
     return MDF_OK;
 }
 
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
+/**
+ * @brief Keep the shadow consistent with the requests forwarded to the nodes
+ *
+ * @return The maximum age (ms) given by the 'Shadow-Max-Age' header of a get_status
+ *         request, -1 means the request can not be answered by the shadow
+ */
+static int mlink_httpd_shadow_request(httpd_req_t *req, const mlink_httpd_t *httpd_data)
+{
+    int max_age_ms      = -1;
+    int request_id      = MLINK_HANDLE_ID_NONE;
+    char *hdr_value     = NULL;
+    cJSON *pJson        = cJSON_Parse(httpd_data->data);
+    cJSON *pSub         = pJson ? cJSON_GetObjectItem(pJson, "request") : NULL;
+
+    if (pSub && pSub->type == cJSON_Number) {
+        request_id = pSub->valueint;
+    } else if (pSub && pSub->type == cJSON_String) {
+        request_id = !strcasecmp(pSub->valuestring, "get_status") ? MLINK_HANDLE_ID_GET_STATUS :
+                     !strcasecmp(pSub->valuestring, "set_status") ? MLINK_HANDLE_ID_SET_STATUS : MLINK_HANDLE_ID_NONE;
+    }
+
+    cJSON_Delete(pJson);
+
+    /**< The values are outdated once set_status is forwarded */
+    if (request_id == MLINK_HANDLE_ID_SET_STATUS) {
+        if (httpd_data->group || MWIFI_ADDR_IS_ANY(httpd_data->addrs_list)) {
+            mlink_shadow_invalidate((uint8_t [])MWIFI_ADDR_ANY);
+        } else {
+            for (int i = 0; i < httpd_data->addrs_num; ++i) {
+                mlink_shadow_invalidate(httpd_data->addrs_list + i * MWIFI_ADDR_LEN);
+            }
+        }
+    }
+
+    if (request_id == MLINK_HANDLE_ID_GET_STATUS && !httpd_data->group
+            && mlink_httpd_get_hdr(req, "Shadow-Max-Age", &hdr_value) > 0) {
+        max_age_ms = atoi(hdr_value);
+        MDF_FREE(hdr_value);
+    }
+
+    return max_age_ms;
+}
+
+/**
+ * @brief Answer a get_status request to a single node from the shadow
+ */
+static bool mlink_httpd_shadow_resp(httpd_req_t *req, const mlink_httpd_t *httpd_data, uint32_t max_age_ms)
+{
+    char *resp_data  = NULL;
+    size_t resp_size = 0;
+    char mac_str[13] = {0};
+
+    if (mlink_shadow_get_status(httpd_data->addrs_list, httpd_data->data, max_age_ms,
+                                &resp_data, &resp_size) != MDF_OK) {
+        return false;
+    }
+
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    httpd_resp_set_hdr(req, "Mesh-Node-Mac", mlink_mac_hex2str(httpd_data->addrs_list, mac_str));
+
+    if (httpd_resp_send(req, resp_data, resp_size) != MDF_OK) {
+        MDF_LOGW("Send the response of the shadow, addr: " MACSTR, MAC2STR(httpd_data->addrs_list));
+    }
+
+    MDF_FREE(resp_data);
+
+    return true;
+}
+
+/**
+ * @brief Answer the nodes of a batch get_status request from the shadow, only
+ *        the other nodes are left in the address list to be forwarded
+ *
+ * @return Whether all the nodes have been answered
+ */
+static bool mlink_httpd_shadow_batch(mlink_httpd_t *httpd_data, uint32_t max_age_ms)
+{
+    bool done = false;
+    uint8_t addr[MWIFI_ADDR_LEN] = {0};
+    mlink_httpd_t response = {
+        .type.format = MLINK_HTTPD_FORMAT_JSON,
+        .addrs_num   = 1,
+        .addrs_list  = addr,
+    };
+    mlink_connection_t *mlink_conn = mlink_connection_find(httpd_data->type.sockfd);
+
+    if (!mlink_conn || !mlink_conn->batch) {
+        return false;
+    }
+
+    xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+
+    for (int i = 0; i < mlink_conn->addrs_num; ++i) {
+        memcpy(addr, mlink_conn->addrs_list + i * MWIFI_ADDR_LEN, MWIFI_ADDR_LEN);
+
+        if (mlink_shadow_get_status(addr, httpd_data->data, max_age_ms,
+                                    &response.data, &response.size) == MDF_OK) {
+            mlink_batch_append(mlink_conn, &response);
+            MDF_FREE(response.data);
+        }
+    }
+
+    MDF_LOGD("Batch request, %d of %d nodes are answered by the shadow",
+             mlink_conn->addrs_num - mlink_conn->num, mlink_conn->addrs_num);
+
+    if (!mlink_conn->num) {
+        mlink_batch_send(mlink_conn);
+        mlink_connection_remove(mlink_conn);
+        done = true;
+    } else if (mlink_conn->num < mlink_conn->addrs_num) {
+        uint8_t *addrs_list = MDF_REALLOC(httpd_data->addrs_list, mlink_conn->num * MWIFI_ADDR_LEN);
+
+        if (addrs_list) {
+            httpd_data->addrs_list = addrs_list;
+            httpd_data->addrs_num  = 0;
+
+            for (int i = 0; i < mlink_conn->addrs_num; ++i) {
+                if (!MWIFI_ADDR_IS_EMPTY(mlink_conn->addrs_list + i * MWIFI_ADDR_LEN)) {
+                    memcpy(addrs_list + httpd_data->addrs_num++ * MWIFI_ADDR_LEN,
+                           mlink_conn->addrs_list + i * MWIFI_ADDR_LEN, MWIFI_ADDR_LEN);
+                }
+            }
+        }
+    }
+
+    xSemaphoreGive(g_batch_lock);
+
+    return done;
+}
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
+
 static esp_err_t mlink_device_request(httpd_req_t *req)
 {
     esp_err_t ret               = MDF_FAIL;
@@ -383,11 +911,20 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
         }
     }
 
-    httpd_data->addrs_list = MDF_MALLOC(httpd_hdr_value_len / 2);
-    MDF_ERROR_CHECK(!httpd_data->addrs_list, MDF_ERR_NO_MEM, "");
+    /**
+     * @brief The addresses are converted in place, each address of 12 characters
+     *        and a separator is replaced by 6 bytes that are never ahead of the parsing
+     */
+    httpd_data->addrs_list = (uint8_t *)httpd_hdr_value;
+    httpd_hdr_value        = NULL;
 
-    for (char *tmp = httpd_hdr_value;; tmp++) {
+    for (char *tmp = (char *)httpd_data->addrs_list;; tmp++) {
         if (*tmp == ',' || *tmp == '\0') {
+            if (tmp - (char *)httpd_data->addrs_list < (httpd_data->addrs_num + 1) * 13 - 1) {
+                httpd_data->addrs_num = 0;
+                break;
+            }
+
             mlink_mac_str2hex(tmp - 12, httpd_data->addrs_list + (httpd_data->addrs_num * MWIFI_ADDR_LEN));
             httpd_data->addrs_num++;
 
@@ -397,7 +934,6 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
         }
     }
 
-    MDF_FREE(httpd_hdr_value);
     MDF_LOGD("dest_addrs_num: %d", httpd_data->addrs_num);
 
     if (httpd_data->addrs_num == 0) {
@@ -406,8 +942,19 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
         goto EXIT;
     }
 
+    /**< Give back the memory of the address strings */
+    uint8_t *addrs_list = MDF_REALLOC(httpd_data->addrs_list, httpd_data->addrs_num * MWIFI_ADDR_LEN);
+    httpd_data->addrs_list = addrs_list ? addrs_list : httpd_data->addrs_list;
+
+    /**< The body is forwarded as one packet, it is rejected before it is received if it can not be */
+    if (req->content_len > MLINK_HTTPD_CONTENT_MAX_LEN) {
+        MDF_LOGW("The request body is too large, content_len: %d", req->content_len);
+        mlink_httpd_resp(req, MLINK_HTTPD_413, "The request body is too large");
+        goto EXIT;
+    }
+
     httpd_data->size = req->content_len;
-    httpd_data->data = MDF_MALLOC(req->content_len);
+    httpd_data->data = MDF_CALLOC(1, req->content_len + 1);
     MDF_ERROR_CHECK(!httpd_data->data, MDF_ERR_NO_MEM, "");
 
     for (int i = 0, recv_size = 0; i < 5 && recv_size < req->content_len; ++i, recv_size += ret) {
@@ -422,37 +969,99 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
         MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 408");
     }
 
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
+    int shadow_max_age_ms = -1;
+
+    if (httpd_data->type.format == MLINK_HTTPD_FORMAT_JSON) {
+        shadow_max_age_ms = mlink_httpd_shadow_request(req, httpd_data);
+    }
+
+    /**< A request to a single node is answered without being forwarded if the shadow is fresh enough */
+    if (shadow_max_age_ms >= 0 && httpd_data->type.resp && httpd_data->addrs_num == 1
+            && !MWIFI_ADDR_IS_ANY(httpd_data->addrs_list) && !MWIFI_ADDR_IS_BROADCAST(httpd_data->addrs_list)
+            && !httpd_req_get_hdr_value_len(req, "Batch-Timeout")
+            && mlink_httpd_shadow_resp(req, httpd_data, shadow_max_age_ms)) {
+        ret = MDF_OK;
+        goto EXIT;
+    }
+
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
+
+    /**< Queued requests are never dropped, the new request is rejected instead */
+    if (!uxQueueSpacesAvailable(g_mlink_queue)) {
+        MDF_LOGW("Mlink data queue is full, reject the request");
+        ret = mlink_httpd_resp_503(req, "Too many pending requests");
+        goto EXIT;
+    }
+
     if (!httpd_data->type.resp) {
         mlink_httpd_resp_200(req);
     } else {
+        bool broadcast = httpd_data->addrs_num == 1
+                         && (MWIFI_ADDR_IS_ANY(httpd_data->addrs_list)
+                             || MWIFI_ADDR_IS_BROADCAST(httpd_data->addrs_list));
+        size_t resp_num = broadcast ? esp_mesh_get_routing_table_size() : httpd_data->addrs_num;
+        uint8_t *batch_addrs_list = NULL;
+        uint32_t batch_timeout_ms = 0;
+
         httpd_data->type.sockfd = httpd_req_to_sockfd(req);
 
-        if (httpd_data->addrs_num == 1
-                && (MWIFI_ADDR_IS_ANY(httpd_data->addrs_list)
-                    || MWIFI_ADDR_IS_BROADCAST(httpd_data->addrs_list))) {
-            mlink_connection_add(req, esp_mesh_get_routing_table_size());
-        } else {
-            mlink_connection_add(req, httpd_data->addrs_num);
+        /**
+         * @brief The responses of a batch request are aggregated by the root into
+         *        one response, which is sent when all nodes have responded or
+         *        when the deadline given by 'Batch-Timeout' (ms) is reached
+         */
+        if (mlink_httpd_get_hdr(req, "Batch-Timeout", &httpd_hdr_value) > 0) {
+            batch_timeout_ms = atoi(httpd_hdr_value);
+            batch_timeout_ms = batch_timeout_ms ? batch_timeout_ms : MLINK_HTTPD_BATCH_TIMEOUT_MS;
+            batch_timeout_ms = MAX(batch_timeout_ms, MLINK_HTTPD_BATCH_TIMEOUT_MIN_MS);
+            batch_timeout_ms = MIN(batch_timeout_ms, MLINK_HTTPD_RESP_TIMEROUT_MS);
+            MDF_FREE(httpd_hdr_value);
+
+            /**< The addresses of a group request are group IDs, the root does not know their members */
+            batch_addrs_list = httpd_data->group ? NULL : MDF_MALLOC(resp_num * MWIFI_ADDR_LEN);
+
+            if (httpd_data->group) {
+                MDF_LOGW("The responses of a group request are not aggregated");
+            } else if (!batch_addrs_list) {
+                MDF_LOGW("Not enough memory for the batch request, the responses will not be aggregated");
+            } else if (broadcast) {
+                int table_size = 0;
+                esp_mesh_get_routing_table((mesh_addr_t *)batch_addrs_list,
+                                           resp_num * MWIFI_ADDR_LEN, &table_size);
+                resp_num = table_size;
+            } else {
+                memcpy(batch_addrs_list, httpd_data->addrs_list, resp_num * MWIFI_ADDR_LEN);
+            }
+        }
+
+        ret = mlink_connection_add(req, resp_num, batch_addrs_list, batch_timeout_ms);
+
+        if (ret != MDF_OK) {
+            ret = mlink_httpd_resp_503(req, ret == MDF_ERR_INVALID_STATE ? "The previous request is not finished"
+                                       : "Too many pending requests");
+            goto EXIT;
         }
-    }
 
-    /**< If g_mlink_queue is full, delete the front item */
-    mlink_httpd_t *q_data = NULL;
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
 
-    if (!uxQueueSpacesAvailable(g_mlink_queue)
-            && xQueueReceive(g_mlink_queue, &q_data, 0)) {
-        MDF_LOGW("Mlink data queue is full, delete the front item");
-        MDF_FREE(q_data->addrs_list);
-        MDF_FREE(q_data->data);
-        MDF_FREE(q_data);
+        if (batch_addrs_list && shadow_max_age_ms >= 0
+                && mlink_httpd_shadow_batch(httpd_data, shadow_max_age_ms)) {
+            ret = MDF_OK;
+            goto EXIT;
+        }
+
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
     }
 
     if (xQueueSend(g_mlink_queue, &httpd_data, 0) == pdFALSE) {
         MDF_LOGW("xQueueSend failed");
         ret = ESP_FAIL;
 
-        ret = httpd_resp_send_500(req);
-        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 408");
+        if (httpd_data->type.resp) {
+            mlink_connection_remove(mlink_connection_find(httpd_data->type.sockfd));
+            ret = mlink_httpd_resp_503(req, "Too many pending requests");
+        }
 
         goto EXIT;
     }
@@ -471,6 +1080,46 @@ EXIT:
     return ret;
 }
 
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+/**
+ * @brief Subscribe to the events of the nodes, the response is a stream of
+ *        Server-Sent Events that stays open until the client closes it
+ */
+static esp_err_t mlink_device_events(httpd_req_t *req)
+{
+    const char *header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n\r\n";
+    int sockfd             = httpd_req_to_sockfd(req);
+    mlink_event_sub_t *sub = NULL;
+
+    xSemaphoreTake(g_event_lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM && !sub; ++i) {
+        if (!g_event_subs[i].sockfd) {
+            sub = g_event_subs + i;
+        }
+    }
+
+    if (!sub || !(sub->pending = MDF_MALLOC(CONFIG_MLINK_HTTPD_EVENTS_BUF_SIZE))) {
+        xSemaphoreGive(g_event_lock);
+        MDF_LOGW("Too many subscribers of the events");
+        return mlink_httpd_resp_503(req, "Too many subscribers");
+    }
+
+    sub->sockfd = sockfd;
+    sub->handle = req->handle;
+    mlink_event_sub_append(sub, header, strlen(header));
+
+    xSemaphoreGive(g_event_lock);
+
+    MDF_LOGI("Subscribe to the events, sockfd: %d", sockfd);
+
+    return ESP_OK;
+}
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+
 static void mlink_ota_send_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
@@ -491,6 +1140,21 @@ static void mlink_ota_send_task(void *arg)
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief Send the firmware to the devices in another task, it takes the list of addresses
+ */
+static void mlink_ota_send_start(uint8_t **addrs_list, size_t addrs_num)
+{
+    mlink_httpd_t *mlink_httpd = MDF_REALLOC_RETRY(NULL, sizeof(mlink_httpd_t));
+    memset(mlink_httpd, 0, sizeof(mlink_httpd_t));
+    mlink_httpd->addrs_list = *addrs_list;
+    mlink_httpd->addrs_num  = addrs_num;
+    *addrs_list = NULL;
+    xTaskCreatePinnedToCore(mlink_ota_send_task, "mlink_ota_send", 4 * 1024,
+                            mlink_httpd, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
+                            NULL, CONFIG_MDF_TASK_PINNED_TO_CORE);
+}
+
 static esp_err_t mlink_ota_firmware(httpd_req_t *req)
 {
     mdf_err_t ret               = MDF_FAIL;
@@ -543,6 +1207,11 @@ static esp_err_t mlink_ota_firmware(httpd_req_t *req)
         goto EXIT;
     }
 
+#ifdef CONFIG_MUPGRADE_PIPELINE
+    /**< The packets are sent to the devices as soon as they are downloaded */
+    mlink_ota_send_start(&addrs_list, addrs_num);
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
+
     buf = MDF_REALLOC_RETRY(NULL, MUPGRADE_PACKET_MAX_SIZE);
 
     for (int i = 10; i > 0 && firmware_size > 0; --i) {
@@ -575,17 +1244,22 @@ static esp_err_t mlink_ota_firmware(httpd_req_t *req)
     mlink_httpd_resp_200(req);
     MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 200");
 
-    mlink_httpd_t *mlink_httpd = MDF_REALLOC_RETRY(NULL, sizeof(mlink_httpd_t));
-    memset(mlink_httpd, 0, sizeof(mlink_httpd_t));
-    mlink_httpd->addrs_list = addrs_list;
-    mlink_httpd->addrs_num  = addrs_num;
-    addrs_list = NULL;
-    xTaskCreatePinnedToCore(mlink_ota_send_task, "mlink_ota_send", 4 * 1024,
-                            mlink_httpd, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
-                            NULL, CONFIG_MDF_TASK_PINNED_TO_CORE);
+    /**< The firmware is already being sent if it is sent while it is downloaded */
+    if (addrs_list) {
+        mlink_ota_send_start(&addrs_list, addrs_num);
+    }
 
 EXIT:
 
+#ifdef CONFIG_MUPGRADE_PIPELINE
+
+    /**< Stop sending the firmware if it is not completely downloaded */
+    if (buf && firmware_size > 0) {
+        mupgrade_firmware_stop();
+    }
+
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
+
     MDF_FREE(buf);
     MDF_FREE(addrs_list)
     MDF_FREE(httpd_hdr_value);
@@ -684,6 +1358,16 @@ static esp_err_t mlink_ota_url(httpd_req_t *req)
         goto EXIT;
     }
 
+#ifdef CONFIG_MUPGRADE_PIPELINE
+
+    /**< The packets are sent to the devices as soon as they are downloaded,
+         which needs the size of the firmware */
+    if (firmware_size != OTA_SIZE_UNKNOWN) {
+        mlink_ota_send_start(&addrs_list, addrs_num);
+    }
+
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
+
     buf = MDF_REALLOC_RETRY(NULL, MUPGRADE_PACKET_MAX_SIZE);
 
     while (firmware_size > 0) {
@@ -701,17 +1385,22 @@ static esp_err_t mlink_ota_url(httpd_req_t *req)
     mlink_httpd_resp_200(req);
     MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 200");
 
-    mlink_httpd_t *mlink_httpd = MDF_REALLOC_RETRY(NULL, sizeof(mlink_httpd_t));
-    memset(mlink_httpd, 0, sizeof(mlink_httpd_t));
-    mlink_httpd->addrs_list = addrs_list;
-    mlink_httpd->addrs_num  = addrs_num;
-    addrs_list = NULL;
-    xTaskCreatePinnedToCore(mlink_ota_send_task, "mlink_ota_send", 4 * 1024,
-                            mlink_httpd, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
-                            NULL, CONFIG_MDF_TASK_PINNED_TO_CORE);
+    /**< The firmware is already being sent if it is sent while it is downloaded */
+    if (addrs_list) {
+        mlink_ota_send_start(&addrs_list, addrs_num);
+    }
 
 EXIT:
 
+#ifdef CONFIG_MUPGRADE_PIPELINE
+
+    /**< Stop sending the firmware if it is not completely downloaded */
+    if (buf && firmware_size > 0) {
+        mupgrade_firmware_stop();
+    }
+
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
+
     if (http_client_handle) {
         esp_http_client_close(http_client_handle);
         esp_http_client_cleanup(http_client_handle);
@@ -739,46 +1428,6 @@ static mdf_err_t mlink_ota_stop(httpd_req_t *req)
     return MDF_OK;
 }
 
-static mdf_err_t mlink_httpd_resp_set_status(char **resp, const char *status)
-{
-    *resp = NULL;
-    asprintf(resp, "HTTP/1.1 %s\r\n", status);
-
-    return ESP_OK;
-}
-
-static mdf_err_t mlink_httpd_resp_set_hdr(char **resp, const char *field, const char *value)
-{
-    char *tmp_str   = NULL;
-    size_t tmp_size = asprintf(&tmp_str, "%s: %s\r\n", field, value);
-
-    *resp = MDF_REALLOC_RETRY(*resp, strlen(*resp) + tmp_size + 1);
-    memcpy(*resp + strlen(*resp), tmp_str, tmp_size + 1);
-
-    MDF_FREE(tmp_str);
-
-    return ESP_OK;
-}
-
-static size_t mlink_httpd_resp_set_data(char **resp, const char *data, size_t size)
-{
-    MDF_PARAM_CHECK(resp);
-
-    char *tmp_str     = NULL;
-    size_t tmp_size   = asprintf(&tmp_str, "Content-Length: %d\r\n\r\n", size);
-    size_t total_size = strlen(*resp) + tmp_size + size;
-
-    *resp = MDF_REALLOC_RETRY(*resp, total_size + 8);
-    memcpy(*resp + strlen(*resp), tmp_str, tmp_size + 1);
-
-    if (data && size) {
-        memcpy(*resp + strlen(*resp), data, size);
-    }
-
-    MDF_FREE(tmp_str);
-    return total_size;
-}
-
 mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks)
 {
     MDF_PARAM_CHECK(response);
@@ -786,93 +1435,190 @@ mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks
 
     mdf_err_t ret    = MDF_FAIL;
     char mac_str[13] = {0};
-    size_t resp_size = 0;
-    char *resp_data  = NULL;
 
     /**
       * @brief For sending out data in response to an HTTP request.
       */
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
+
+    if (response->type.format == MLINK_HTTPD_FORMAT_JSON && response->addrs_num == 1) {
+        mlink_shadow_update(response->addrs_list, response->data, response->size);
+    }
+
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
+
+    /**< A change report of a node, no http connection is waiting for it */
+    if (!response->type.sockfd) {
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+
+        if (response->type.format == MLINK_HTTPD_FORMAT_JSON && response->addrs_num == 1) {
+            mlink_httpd_event_write("status", response->addrs_list, response->data, response->size);
+        }
+
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+        return MDF_OK;
+    }
+
     mlink_connection_t *mlink_conn = mlink_connection_find(response->type.sockfd);
     MDF_ERROR_CHECK(mlink_conn == NULL, MDF_FAIL, "mlink_connection_find");
 
-    /**
-     * @brief Generate a packet for the http response
-     */
-    mlink_httpd_resp_set_status(&resp_data, response->type.resp == true ? HTTPD_200 : HTTPD_400);
-    mlink_httpd_resp_set_hdr(&resp_data, "Content-Type",
-                             response->type.format == MESH_PROTO_JSON ? HTTPD_TYPE_JSON : "application/bin");
-    mlink_httpd_resp_set_hdr(&resp_data, "Mesh-Node-Mac", mlink_mac_hex2str(response->addrs_list, mac_str));
-    resp_size = mlink_httpd_resp_set_data(&resp_data, response->data, response->size);
-
-    if (wait_ticks != portMAX_DELAY) {
-        int send_timeout_ms = wait_ticks * portTICK_PERIOD_MS;
+    if (mlink_conn->batch) {
+        xSemaphoreTake(g_batch_lock, portMAX_DELAY);
+
+        /**< The deadline may have been reached while waiting for the lock */
+        if (mlink_conn->batch && mlink_conn->sockfd == response->type.sockfd
+                && !mlink_batch_append(mlink_conn, response)) {
+            mlink_batch_send(mlink_conn);
+            mlink_connection_remove(mlink_conn);
+        }
+
+        xSemaphoreGive(g_batch_lock);
+        return MDF_OK;
+    }
+
+    /**< The option stays on the socket, it is only set again when the timeout changes */
+    uint32_t send_timeout_ms = (wait_ticks == portMAX_DELAY) ? 0 : wait_ticks * portTICK_PERIOD_MS;
+
+    if (send_timeout_ms != mlink_conn->send_timeout_ms) {
         struct timeval timeout = {
             .tv_usec = (send_timeout_ms % 1000) * 1000,
             .tv_sec = send_timeout_ms / 1000,
         };
 
         ret = setsockopt(mlink_conn->sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-        MDF_ERROR_GOTO(ret < 0, EXIT, "<%s> Set send timeout", strerror(errno));
+        MDF_ERROR_CHECK(ret < 0, MDF_FAIL, "<%s> Set send timeout", strerror(errno));
+        mlink_conn->send_timeout_ms = send_timeout_ms;
     }
 
-    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_HEADER) {
-        char *chunk_header =
-            "HTTP/1.1 200 OK\r\n"
-            "Content-Type: application/http\r\n"
-            "Transfer-Encoding: chunked\r\n\r\n";
-
-        MDF_LOGD("send chunk_header, sockfd: %d, chunk_header: %s", mlink_conn->sockfd, chunk_header);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_header, strlen(chunk_header), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "This is the low level default send function of the HTTPD");
+    /**
+     * @brief Generate the headers of the http response, the payload is not copied.
+     *        The response of each node is a chunk of the http response when several
+     *        nodes respond, the last chunk carries the footer of the chunks as well
+     */
+    char chunk_header[80] = {0};
+    char resp_header[128] = {0};
+    size_t chunk_header_size = 0;
+    size_t resp_header_size  = 0;
+    const char *chunk_footer = "";
+    bool last_resp           = mlink_conn->num <= 1;
+
+    resp_header_size = snprintf(resp_header, sizeof(resp_header),
+                                "HTTP/1.1 %s\r\n"
+                                "Content-Type: %s\r\n"
+                                "Mesh-Node-Mac: %s\r\n"
+                                "Content-Length: %d\r\n\r\n",
+                                response->type.resp == true ? HTTPD_200 : HTTPD_400,
+                                response->type.format == MESH_PROTO_JSON ? HTTPD_TYPE_JSON : "application/bin",
+                                mlink_mac_hex2str(response->addrs_list, mac_str), response->size);
 
+    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_HEADER) {
+        chunk_header_size = snprintf(chunk_header, sizeof(chunk_header),
+                                     "HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: application/http\r\n"
+                                     "Transfer-Encoding: chunked\r\n\r\n");
         mlink_conn->flag = MLINK_HTTPD_CHUNKS_BODY;
     }
 
     if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_BODY) {
-        char chunk_size[16] = {0};
-        sprintf(chunk_size, "%x\r\n", resp_size);
+        chunk_header_size += snprintf(chunk_header + chunk_header_size, sizeof(chunk_header) - chunk_header_size,
+                                      "%x\r\n", resp_header_size + response->size);
+        chunk_footer = last_resp ? "\r\n0\r\n\r\n" : "\r\n";
 
         if (mlink_conn->timer) {
             xTimerReset(mlink_conn->timer, portMAX_DELAY);
         }
+    }
 
-        MDF_LOGD("send chunk_size, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_size);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_size, strlen(chunk_size), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "<%s> This is the low level default send function of the HTTPD", strerror(errno));
+    /**< Empty parts are left out, lwip does not expect empty vectors */
+    struct iovec iov[4] = {0};
+    int iovcnt = 0;
 
-        resp_data[resp_size++] = '\r';
-        resp_data[resp_size++] = '\n';
+    if (chunk_header_size) {
+        iov[iovcnt++] = (struct iovec) {.iov_base = chunk_header, .iov_len = chunk_header_size};
     }
 
-    resp_data[resp_size] = '\0';
+    iov[iovcnt++] = (struct iovec) {.iov_base = resp_header, .iov_len = resp_header_size};
 
-    MDF_LOGD("size: %d, resp_data: %.*s", resp_size, resp_size, resp_data);
-    ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, resp_data, resp_size, 0);
-    MDF_ERROR_GOTO(ret <= 0, EXIT, "<%s> httpd_default_send, sockfd: %d",
-                   strerror(errno), mlink_conn->sockfd);
+    if (response->data && response->size) {
+        iov[iovcnt++] = (struct iovec) {.iov_base = response->data, .iov_len = response->size};
+    }
+
+    if (strlen(chunk_footer)) {
+        iov[iovcnt++] = (struct iovec) {.iov_base = (void *)chunk_footer, .iov_len = strlen(chunk_footer)};
+    }
+
+    MDF_LOGD("sockfd: %d, resp_header: %.*s, size: %d", mlink_conn->sockfd,
+             resp_header_size, resp_header, response->size);
+    ret = mlink_httpd_sendv(mlink_conn, iov, iovcnt);
+    MDF_ERROR_CHECK(ret <= 0, MDF_FAIL, "mlink_httpd_sendv, sockfd: %d", response->type.sockfd);
 
     mlink_conn->num--;
     MDF_LOGD("mlink_conn->num: %d", mlink_conn->num);
 
-    if (mlink_conn->num > 0) {
-        ret = MDF_OK;
-        goto EXIT;
+    if (last_resp) {
+        mlink_connection_remove(mlink_conn);
     }
 
-    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_BODY) {
-        char *chunk_footer = "0\r\n\r\n";
+    return MDF_OK;
+}
+
+mdf_err_t mlink_httpd_event_write(const char *event, const uint8_t *addr, const char *data, size_t size)
+{
+    MDF_PARAM_CHECK(event);
+    MDF_PARAM_CHECK(addr);
+
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+    MDF_ERROR_CHECK(!g_httpd_handle, MDF_ERR_NOT_INIT, "mlink_httpd is stop");
+
+    char mac_str[13]   = {0};
+    char *event_data   = NULL;
+    ssize_t event_size = 0;
+    bool subscribed    = false;
 
-        MDF_LOGD("send chunk_footer, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_footer);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_footer, strlen(chunk_footer), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "This is the low level default send function of the HTTPD");
+    xSemaphoreTake(g_event_lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM && !subscribed; ++i) {
+        subscribed = g_event_subs[i].sockfd != 0;
     }
 
-    mlink_connection_remove(mlink_conn);
-    ret = MDF_OK;
+    if (!subscribed) {
+        xSemaphoreGive(g_event_lock);
+        return MDF_OK;
+    }
 
-EXIT:
-    MDF_FREE(resp_data);
-    return ret;
+    event_size = (data && size) ?
+                 asprintf(&event_data, "id: %u\nevent: %s\ndata: {\"mac\":\"%s\",\"data\":%.*s}\n\n",
+                          g_event_id, event, mlink_mac_hex2str(addr, mac_str), (int)size, data) :
+                 asprintf(&event_data, "id: %u\nevent: %s\ndata: {\"mac\":\"%s\"}\n\n",
+                          g_event_id, event, mlink_mac_hex2str(addr, mac_str));
+
+    if (event_size <= 0) {
+        xSemaphoreGive(g_event_lock);
+        return MDF_ERR_NO_MEM;
+    }
+
+    /**< The data of an event must be one line, line breaks are whitespace in json */
+    for (char *p = strstr(event_data, "data: "); p < event_data + event_size - 2; ++p) {
+        if (*p == '\r' || *p == '\n') {
+            *p = ' ';
+        }
+    }
+
+    g_event_id++;
+
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM; ++i) {
+        if (g_event_subs[i].sockfd) {
+            mlink_event_sub_append(g_event_subs + i, event_data, event_size);
+        }
+    }
+
+    xSemaphoreGive(g_event_lock);
+    MDF_FREE(event_data);
+
+    return MDF_OK;
+#else
+    return MDF_ERR_NOT_SUPPORTED;
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
 }
 
 mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks)
@@ -882,7 +1628,7 @@ mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks)
     mdf_err_t ret = MDF_OK;
 
     if (!g_mlink_queue) {
-        g_mlink_queue = xQueueCreate(3, sizeof(mlink_httpd_t *));
+        g_mlink_queue = xQueueCreate(MLINK_HTTPD_QUEUE_SIZE, sizeof(mlink_httpd_t *));
     }
 
     ret = xQueueReceive(g_mlink_queue, request, wait_ticks);
@@ -919,24 +1665,59 @@ mdf_err_t mlink_httpd_start(void)
      * @brief This check should be a part of http_server
      */
     config.max_open_sockets = (MLINK_HTTPD_MAX_CONNECT);
+    config.open_fn          = mlink_httpd_open_cb;
+
+    /**
+     * @brief Idle keep-alive connections are reused by their clients, the least
+     *        recently used one is closed when a new client can not be accepted.
+     *        The streams of the event subscribers are marked as used periodically
+     */
+    config.lru_purge_enable = true;
 
     MDF_LOGI("Starting server");
     MDF_LOGD("HTTP port         : %d", config.server_port);
     MDF_LOGD("Max URI handlers  : %d", config.max_uri_handlers);
     MDF_LOGD("Max open sessions : %d", config.max_open_sockets);
+    MDF_LOGD("Request queue size: %d", MLINK_HTTPD_QUEUE_SIZE);
     MDF_LOGD("Max header length : %d", HTTPD_MAX_REQ_HDR_LEN);
     MDF_LOGD("Max URI length    : %d", HTTPD_MAX_URI_LEN);
     MDF_LOGD("Max stack size    : %d", config.stack_size);
 
     if (!g_mlink_queue) {
-        g_mlink_queue = xQueueCreate(3, sizeof(mlink_httpd_t *));
+        g_mlink_queue = xQueueCreate(MLINK_HTTPD_QUEUE_SIZE, sizeof(mlink_httpd_t *));
     }
 
     if (!g_conn_list) {
-        g_conn_list = MDF_CALLOC(MLINK_HTTPD_MAX_CONNECT, sizeof(mlink_connection_t));
+        g_conn_list = MDF_CALLOC(MLINK_HTTPD_CONN_TABLE_SIZE, sizeof(mlink_connection_t));
         MDF_ERROR_CHECK(!g_conn_list, MDF_ERR_NO_MEM, "");
     }
 
+    if (!g_batch_lock) {
+        g_batch_lock = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_batch_lock, MDF_ERR_NO_MEM, "");
+    }
+
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+
+    if (!g_event_lock) {
+        g_event_lock = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_event_lock, MDF_ERR_NO_MEM, "");
+    }
+
+    if (!g_event_timer) {
+        g_event_timer = xTimerCreate("event_timer", MLINK_HTTPD_EVENTS_FLUSH_MS / portTICK_RATE_MS,
+                                     true, NULL, mlink_event_timer_cb);
+        MDF_ERROR_CHECK(!g_event_timer, MDF_ERR_NO_MEM, "");
+    }
+
+    xTimerStart(g_event_timer, portMAX_DELAY);
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
+    ret = mlink_shadow_init(CONFIG_MLINK_SHADOW_NODE_MAX_NUM);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Initialize the shadow");
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
+
     ret = httpd_start(&g_httpd_handle, &config);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "Starts the web server");
 
@@ -964,12 +1745,28 @@ mdf_err_t mlink_httpd_stop(void)
     xQueueSend(g_mlink_queue, &mlink_queue_exit, 0);
 
     if (g_conn_list) {
-        for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
+        for (int i = 0; i < MLINK_HTTPD_CONN_TABLE_SIZE; ++i) {
             mlink_connection_remove(g_conn_list + i);
         }
 
         MDF_FREE(g_conn_list);
     }
 
+#ifdef CONFIG_MLINK_HTTPD_EVENTS_ENABLE
+    xTimerStop(g_event_timer, portMAX_DELAY);
+    xSemaphoreTake(g_event_lock, portMAX_DELAY);
+
+    /**< The sockets are closed by the server */
+    for (int i = 0; i < CONFIG_MLINK_HTTPD_EVENTS_MAX_NUM; ++i) {
+        mlink_event_sub_remove(g_event_subs + i, false);
+    }
+
+    xSemaphoreGive(g_event_lock);
+#endif /**< CONFIG_MLINK_HTTPD_EVENTS_ENABLE */
+
+#ifdef CONFIG_MLINK_SHADOW_ENABLE
+    mlink_shadow_deinit();
+#endif /**< CONFIG_MLINK_SHADOW_ENABLE */
+
     return MDF_OK;
 }
@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <math.h>
+#include <stdarg.h>
+
 #include "cJSON.h"
 #include "mlink_json.h"
 
@@ -155,93 +158,190 @@ ERR_EXIT:
     return ESP_FAIL;
 }
 
-ssize_t __mlink_json_pack(char **json_ptr, const char *key, int value, int value_type)
+/**
+ * @brief Make sure there is room for size bytes and the terminating '\0' behind the string
+ */
+static mdf_err_t mlink_json_buf_reserve(mlink_json_buf_t *buf, size_t size)
 {
-    MDF_PARAM_CHECK(key);
-    MDF_PARAM_CHECK(json_ptr);
-
-    char *json_str = (char *)json_ptr;
-
-    MDF_LOGV("key: %s, value: %d, value_type: %d", key, value, value_type);
-
-    if (value_type / MLINK_JSON_TYPE_POINTER) {
-        value_type %= MLINK_JSON_TYPE_POINTER;
-        MDF_ERROR_CHECK(value_type == MLINK_JSON_TYPE_STRING && !value,
-                        MDF_ERR_INVALID_ARG, "<MDF_ERR_INVALID_ARG> !(value)");
-
-        size_t value_len = (value_type == MLINK_JSON_TYPE_STRING) ? strlen((char *)value) : 10;
+    if (buf->size + size + 1 <= buf->capacity) {
+        return MDF_OK;
+    }
 
-        if (!*json_ptr) {
-            *json_ptr = MDF_CALLOC(1, value_len + strlen(key) + 16);
-        } else {
-            *json_ptr = MDF_REALLOC_RETRY(*json_ptr, value_len + strlen(key) + 16 + strlen(*json_ptr));
-        }
+    MDF_ERROR_CHECK(buf->fixed, MDF_ERR_BUF, "size: %d, capacity: %d", buf->size + size + 1, buf->capacity);
 
-        json_str = *json_ptr;
-    }
+    size_t capacity = MAX(buf->capacity * 2, buf->size + size + 1);
+    buf->data       = MDF_REALLOC_RETRY(buf->data, capacity);
+    buf->capacity   = capacity;
 
+    return MDF_OK;
+}
 
+/**
+ * @brief Write the separator and the key of a new item, the returned pointer
+ *        is where the value should be written
+ */
+static char *mlink_json_buf_open(mlink_json_buf_t *buf, const char *key, char *identifier)
+{
     /**< start symbol of a json object */
-    char identifier = '{';
+    *identifier = '{';
 
     /**< pack data into array that has been existed */
     if (*key == '[') {
-        identifier = '[';
+        *identifier = '[';
         key = NULL;
     }
 
-    int index = 0;
+    char *json_str = buf->data;
 
-    if (*json_str == identifier) {
-        index     = strlen(json_str) - 1;
-        json_str += index;
+    if (buf->size > 0 && *json_str == *identifier) {
+        json_str += buf->size - 1;
         *json_str = ',';
     } else {
-        *json_str = identifier;
+        *json_str = *identifier;
     }
 
     /**< forward to key field by "++" */
     json_str++;
-    index++;
 
     /**< pack key into json_str */
-    int tmp_len = key ? sprintf(json_str, "\"%s\":", key) : 0;
-    json_str += tmp_len;
-    index    += tmp_len;
+    if (key) {
+        size_t key_size = strlen(key);
+
+        *json_str++ = '\"';
+        memcpy(json_str, key, key_size);
+        json_str += key_size;
+        *json_str++ = '\"';
+        *json_str++ = ':';
+    }
+
+    return json_str;
+}
+
+/**
+ * @brief Finish the string with '}' or ']' behind the value, the closing symbol
+ *        of the object or array is always kept at the end of the string
+ */
+static ssize_t mlink_json_buf_close(mlink_json_buf_t *buf, char *json_str, char identifier)
+{
+    *json_str++ = identifier == '{' ? '}' : ']';
+    *json_str   = '\0';
+
+    buf->size = json_str - buf->data;
+
+    return buf->size;
+}
+
+/**
+ * @brief The space needed by the separator, the key and the closing symbol of an item
+ */
+static inline size_t mlink_json_buf_item_size(const char *key)
+{
+    return (*key == '[') ? 2 : strlen(key) + 5;
+}
+
+/**
+ * @brief Append a key-value pair whose value has been formatted
+ */
+static ssize_t mlink_json_buf_append(mlink_json_buf_t *buf, const char *key,
+                                     const char *value, size_t value_size, bool quote)
+{
+    mdf_err_t ret   = MDF_OK;
+    char identifier = '{';
+
+    ret = mlink_json_buf_reserve(buf, mlink_json_buf_item_size(key) + value_size + 2);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "");
+
+    char *json_str = mlink_json_buf_open(buf, key, &identifier);
+
+    if (quote) {
+        *json_str++ = '\"';
+    }
+
+    memcpy(json_str, value, value_size);
+    json_str += value_size;
+
+    if (quote) {
+        *json_str++ = '\"';
+    }
+
+    return mlink_json_buf_close(buf, json_str, identifier);
+}
+
+static ssize_t mlink_json_buf_append_value(mlink_json_buf_t *buf, const char *key, int value, int value_type)
+{
+    char value_str[12] = {0};
 
     switch (value_type) {
         case MLINK_JSON_TYPE_INT8: /**< integral number */
         case MLINK_JSON_TYPE_INT16: /**< integral number */
         case MLINK_JSON_TYPE_INT32: /**< integral number */
-            tmp_len = sprintf(json_str, "%d", value);
-            break;
+            return mlink_json_buf_append(buf, key, value_str, sprintf(value_str, "%d", value), false);
 
         case MLINK_JSON_TYPE_STRING: /**< string */
-            if (*((char *)value) == '{' || *((char *)value) == '[') {
-                tmp_len = sprintf(json_str, "%s", (char *)value);
-            } else {
-                tmp_len = sprintf(json_str, "\"%s\"", (char *)value);
-            }
+            MDF_ERROR_CHECK(!value, MDF_ERR_INVALID_ARG, "!(value)");
 
-            break;
+            /**< a sub json object or array is packed as is */
+            return mlink_json_buf_append(buf, key, (char *)value, strlen((char *)value),
+                                         *((char *)value) != '{' && *((char *)value) != '[');
 
         default:
             MDF_LOGE("key: %s, invalid type: %d", key, value_type);
             return ESP_FAIL;
     }
+}
+
+ssize_t __mlink_json_pack(char **json_ptr, const char *key, int value, int value_type)
+{
+    MDF_PARAM_CHECK(key);
+    MDF_PARAM_CHECK(json_ptr);
 
-    /**< update json_str and index after packed key */
-    json_str += tmp_len;
-    index    += tmp_len;
+    MDF_LOGV("key: %s, value: %d, value_type: %d", key, value, value_type);
 
-    /**< finish json_str with '}' or ']' */
-    *json_str = identifier == '{' ? '}' : ']';
-    json_str++;
-    *json_str = '\0';
+    /**< The buffer is not allocated by mlink_json_pack, its capacity is unknown */
+    mlink_json_buf_t buf = {
+        .data     = (char *)json_ptr,
+        .capacity = SIZE_MAX,
+        .fixed    = true,
+    };
+
+    if (value_type / MLINK_JSON_TYPE_POINTER) {
+        value_type %= MLINK_JSON_TYPE_POINTER;
+        MDF_ERROR_CHECK(value_type == MLINK_JSON_TYPE_STRING && !value,
+                        MDF_ERR_INVALID_ARG, "<MDF_ERR_INVALID_ARG> !(value)");
+
+        size_t value_len = (value_type == MLINK_JSON_TYPE_STRING) ? strlen((char *)value) : 10;
+        size_t json_len  = *json_ptr ? strlen(*json_ptr) : 0;
 
-    index++;
+        buf.capacity = value_len + strlen(key) + 16 + json_len;
+        buf.data     = MDF_REALLOC_RETRY(*json_ptr, buf.capacity);
+        buf.size     = json_len;
+        *json_ptr    = buf.data;
 
-    return index;
+        if (!json_len) {
+            *buf.data = '\0';
+        }
+    } else if (*buf.data == '{' || *buf.data == '[') {
+        buf.size = strlen(buf.data);
+    }
+
+    return mlink_json_buf_append_value(&buf, key, value, value_type);
+}
+
+/**
+ * @brief Print a double as a json number, with the fewest of 15 or 17 digits that
+ *        read back the same value as cJSON does. nan and inf are not json numbers
+ */
+static mdf_err_t mlink_json_double_print(double value, char *value_str, size_t size, size_t *value_size)
+{
+    MDF_ERROR_CHECK(!isfinite(value), MDF_ERR_INVALID_ARG, "The value is not a finite number");
+
+    *value_size = snprintf(value_str, size, "%.15g", value);
+
+    if (strtod(value_str, NULL) != value) {
+        *value_size = snprintf(value_str, size, "%.17g", value);
+    }
+
+    return MDF_OK;
 }
 
 ssize_t mlink_json_pack_double(char **json_ptr, const char *key, double value)
@@ -249,53 +349,126 @@ ssize_t mlink_json_pack_double(char **json_ptr, const char *key, double value)
     MDF_PARAM_CHECK(key);
     MDF_PARAM_CHECK(json_ptr);
 
-    if (!*json_ptr) {
-        *json_ptr = MDF_REALLOC_RETRY(NULL, strlen(key) + 32);
-        memset(*json_ptr, 0, strlen(key) + 32);
-    } else {
-        *json_ptr = MDF_REALLOC_RETRY(*json_ptr, strlen(key) + 32 + strlen(*json_ptr));
+    char value_str[32]   = {0};
+    size_t value_size    = 0;
+    size_t json_len      = *json_ptr ? strlen(*json_ptr) : 0;
+    mlink_json_buf_t buf = {
+        .capacity = strlen(key) + sizeof(value_str) + 16 + json_len,
+        .size     = json_len,
+        .fixed    = true,
+    };
+
+    mdf_err_t ret = mlink_json_double_print(value, value_str, sizeof(value_str), &value_size);
+
+    if (ret != MDF_OK) {
+        return ret;
     }
 
-    char *json_str = *json_ptr;
-    /**< start symbol of a json object */
-    char identifier = '{';
+    buf.data  = MDF_REALLOC_RETRY(*json_ptr, buf.capacity);
+    *json_ptr = buf.data;
 
-    /**< pack data into array that has been existed */
-    if (*key == '[') {
-        identifier = '[';
-        key = NULL;
+    if (!json_len) {
+        *buf.data = '\0';
     }
 
-    int index = 0;
+    return mlink_json_buf_append(&buf, key, value_str, value_size, false);
+}
 
-    if (*json_str == identifier) {
-        index     = strlen(json_str) - 1;
-        json_str += index;
-        *json_str = ',';
-    } else {
-        *json_str = identifier;
+mdf_err_t mlink_json_buf_init(mlink_json_buf_t *buf, char *data, size_t capacity)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(!data || capacity > 0);
+
+    buf->data     = data;
+    buf->size     = 0;
+    buf->capacity = data ? capacity : 0;
+    buf->fixed    = data ? true : false;
+
+    if (!data && capacity > 0) {
+        buf->data     = MDF_REALLOC_RETRY(NULL, capacity);
+        buf->capacity = capacity;
     }
 
-    /**< forward to key field by "++" */
-    json_str++;
-    index++;
+    if (buf->data) {
+        *buf->data = '\0';
+    }
 
-    /**< pack key into json_str */
-    int tmp_len = key ? sprintf(json_str, "\"%s\":", key) : 0;
-    json_str += tmp_len;
-    index    += tmp_len;
-    tmp_len = sprintf(json_str, "%lf", value);
+    return MDF_OK;
+}
 
-    /**< update json_str and index after packed key */
-    json_str += tmp_len;
-    index    += tmp_len;
+void mlink_json_buf_free(mlink_json_buf_t *buf)
+{
+    if (!buf) {
+        return;
+    }
 
-    /**< finish json_str with '}' or ']' */
-    *json_str = identifier == '{' ? '}' : ']';
-    json_str++;
-    *json_str = '\0';
+    if (!buf->fixed) {
+        MDF_FREE(buf->data);
+    }
+
+    buf->data     = NULL;
+    buf->size     = 0;
+    buf->capacity = 0;
+}
+
+ssize_t __mlink_json_buf_pack(mlink_json_buf_t *buf, const char *key, int value, int value_type)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(key);
+
+    MDF_LOGV("key: %s, value: %d, value_type: %d", key, value, value_type);
+
+    return mlink_json_buf_append_value(buf, key, value, value_type);
+}
+
+ssize_t mlink_json_buf_pack_double(mlink_json_buf_t *buf, const char *key, double value)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(key);
+
+    char value_str[32] = {0};
+    size_t value_size  = 0;
+    mdf_err_t ret      = mlink_json_double_print(value, value_str, sizeof(value_str), &value_size);
+
+    if (ret != MDF_OK) {
+        return ret;
+    }
+
+    return mlink_json_buf_append(buf, key, value_str, value_size, false);
+}
+
+ssize_t mlink_json_buf_pack_raw(mlink_json_buf_t *buf, const char *key, const char *raw, size_t size)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(key);
+    MDF_PARAM_CHECK(raw);
+
+    return mlink_json_buf_append(buf, key, raw, size, false);
+}
+
+ssize_t mlink_json_buf_pack_format(mlink_json_buf_t *buf, const char *key, const char *format, ...)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(key);
+    MDF_PARAM_CHECK(format);
+
+    mdf_err_t ret   = MDF_OK;
+    char identifier = '{';
+    va_list args;
+
+    va_start(args, format);
+    int value_size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    MDF_ERROR_CHECK(value_size < 0, MDF_FAIL, "vsnprintf, format: %s", format);
+
+    ret = mlink_json_buf_reserve(buf, mlink_json_buf_item_size(key) + value_size);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "");
+
+    char *json_str = mlink_json_buf_open(buf, key, &identifier);
 
-    index++;
+    va_start(args, format);
+    json_str += vsnprintf(json_str, value_size + 1, format, args);
+    va_end(args);
 
-    return index;
+    return mlink_json_buf_close(buf, json_str, identifier);
 }
@@ -17,11 +17,16 @@
 #include "mdf_common.h"
 
 #define MLINK_HTTP_SERVER_PORT            (80)
-#define MLINK_NOTICE_UDP_QUEUE_NUM        (10)
 #define MLINK_NOTICE_UDP_RETRY_COUNT      (5)
 #define MLINK_NOTICE_SOCKET_INVALID_FD    (-1)
 #define MLINK_NOTICE_UDP_RECV_TIMEROUT_MS (100)
 #define MLINK_NOTICE_UDP_BUF_SIZE         (64)
+#define MLINK_NOTICE_UDP_MSG_MAX_LEN      (1400) /**< A broadcast that fits in one frame */
+#define MLINK_NOTICE_UDP_MSG_TAIL_LEN     (64)   /**< Space for the flag and the type */
+#define MLINK_NOTICE_TYPE_MAX_NUM         (4)
+#define MLINK_NOTICE_MAC_MAX_NUM          CONFIG_MLINK_NOTICE_MAC_MAX_NUM
+#define MLINK_NOTICE_FLUSH_DELAY_MS       CONFIG_MLINK_NOTICE_FLUSH_DELAY_MS
+#define MLINK_NOTICE_FLUSH_MAX_DELAY_MS   CONFIG_MLINK_NOTICE_FLUSH_MAX_DELAY_MS
 
 #ifndef CONFIG_MLINK_NOTIC_UDP_CLIENT_PORT
 #define CONFIG_MLINK_NOTIC_UDP_CLIENT_PORT    1025
@@ -33,17 +38,27 @@
 #endif /**< CONFIG_MLINK_NOTICE_UDP_SERVER_PORT */
 #define MLINK_NOTICE_UDP_SERVER_PORT CONFIG_MLINK_NOTICE_UDP_SERVER_PORT
 
-static QueueHandle_t *g_notice_udp_queue       = NULL;
+/**
+ * @brief The addresses notified with the same type since the last broadcast of
+ *        the type, they are sent together when the set is flushed
+ */
+typedef struct {
+    char type[16];          /**< Type of the notice, empty if the set is free */
+    uint8_t (*addrs)[6];
+    uint16_t *index;        /**< Hash of the address to the position in addrs plus 1 */
+    size_t num;
+    TickType_t first_tick;  /**< When the first address was added */
+    TickType_t last_tick;   /**< When the last address was added */
+} notice_set_t;
+
+static notice_set_t g_notice_sets[MLINK_NOTICE_TYPE_MAX_NUM];
+static SemaphoreHandle_t g_notice_lock         = NULL;
+static size_t g_notice_index_num               = 0;
 static SemaphoreHandle_t g_notice_udp_exit_sem = NULL;
 static bool g_notice_udp_exit_flag             = true;
 static bool g_notice_mdns_init_flag            = false;
 static const char *TAG                         = "mlink_notice";
 
-typedef struct {
-    uint8_t mac[6];
-    char message[0];
-} notice_udp_data_t;
-
 static mdf_err_t mlink_notice_mdns_init(void)
 {
     if (g_notice_mdns_init_flag) {
@@ -157,22 +172,185 @@ ERR_EXIT:
     return MLINK_NOTICE_SOCKET_INVALID_FD;
 }
 
+static inline uint32_t mlink_notice_addr_hash(const uint8_t *addr)
+{
+    uint32_t hash = 2166136261U; /**< FNV-1a */
+
+    for (int i = 0; i < 6; ++i) {
+        hash = (hash ^ addr[i]) * 16777619U;
+    }
+
+    return hash & (g_notice_index_num - 1);
+}
+
+static int mlink_notice_addr_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, 6);
+}
+
+/**
+ * @brief Send the broadcast a few times, fewer when more broadcasts are waiting,
+ *        so that a burst of notices does not flood the network
+ */
+static void mlink_notice_udp_broadcast(int sockfd, const char *msg, size_t size, size_t backlog)
+{
+    mdf_err_t ret   = MDF_OK;
+    int retry_count = MLINK_NOTICE_UDP_RETRY_COUNT / (backlog ? backlog : 1);
+    struct sockaddr_in broadcast_addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(MLINK_NOTICE_UDP_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_BROADCAST),
+    };
+
+    retry_count = (retry_count < 2) ? 2 : retry_count;
+
+    MDF_LOGD("Mlink notice udp broadcast, size: %d, retry_count: %d, data:\n%s", size, retry_count, msg);
+
+    for (int i = 0, delay_time_ms = 0; i < retry_count; ++i, delay_time_ms += delay_time_ms) {
+        vTaskDelay(delay_time_ms / portTICK_RATE_MS);
+        delay_time_ms = (i == 0) ? 10 : delay_time_ms;
+        delay_time_ms = (delay_time_ms > 50) ? 50 : delay_time_ms;
+
+        ret = sendto(sockfd, msg, size, 0, (struct sockaddr *)&broadcast_addr, sizeof(struct sockaddr));
+
+        if (ret < 0 && errno == ENOMEM) {
+            MDF_LOGD("sendto not enough space, delay 100ms");
+            vTaskDelay(100 / portTICK_RATE_MS);
+        }
+    }
+}
+
+/**
+ * @brief Broadcast the addresses of a flushed set, split into as many broadcasts as needed
+ *
+ * @note  With CONFIG_MLINK_NOTICE_COMPACT_FORMAT the addresses are sent as "macs=", where
+ *        an address that has the same first three bytes as the one before it is written
+ *        as its last three bytes only
+ */
+static mdf_err_t mlink_notice_udp_send(int sockfd, const char *type, uint8_t (*addrs)[6], size_t num, size_t pending)
+{
+    static uint32_t s_flag = 0;
+    char *msg = MDF_MALLOC(MLINK_NOTICE_UDP_MSG_MAX_LEN);
+    MDF_ERROR_CHECK(!msg, MDF_ERR_NO_MEM, "");
+
+    /**< Sorted, the addresses of the same vendor are next to each other */
+    qsort(addrs, num, 6, mlink_notice_addr_cmp);
+
+    for (size_t i = 0, datagram_num = 0; i < num; ++datagram_num) {
+        size_t size = 0;
+
+#ifdef CONFIG_MLINK_NOTICE_COMPACT_FORMAT
+        size = sprintf(msg, "macs=");
+
+        for (size_t start = i; i < num && size < MLINK_NOTICE_UDP_MSG_MAX_LEN - MLINK_NOTICE_UDP_MSG_TAIL_LEN; ++i) {
+            size += sprintf(msg + size, (i == start) ? "" : ",");
+
+            if (i == start || memcmp(addrs[i], addrs[i - 1], 3)) {
+                size += sprintf(msg + size, "%02x%02x%02x%02x%02x%02x", MAC2STR(addrs[i]));
+            } else {
+                size += sprintf(msg + size, "%02x%02x%02x", addrs[i][3], addrs[i][4], addrs[i][5]);
+            }
+        }
+#else
+        size = sprintf(msg, "mac=");
+
+        for (size_t start = i; i < num && size < MLINK_NOTICE_UDP_MSG_MAX_LEN - MLINK_NOTICE_UDP_MSG_TAIL_LEN; ++i) {
+            size += sprintf(msg + size, "%s%02x%02x%02x%02x%02x%02x", (i == start) ? "" : ",", MAC2STR(addrs[i]));
+        }
+#endif /**< CONFIG_MLINK_NOTICE_COMPACT_FORMAT */
+
+        /**< The flag of each broadcast differs, so that the app does not drop one as a retry */
+        s_flag  = (xTaskGetTickCount() > s_flag) ? xTaskGetTickCount() : s_flag + 1;
+        size   += sprintf(msg + size, "\r\nflag=%d\r\ntype=%s\r\n", s_flag, type);
+
+        /**< Rough number of broadcasts still to be sent, including this one */
+        size_t backlog = pending + 1 + (num - i) * 13 / (MLINK_NOTICE_UDP_MSG_MAX_LEN - MLINK_NOTICE_UDP_MSG_TAIL_LEN);
+        mlink_notice_udp_broadcast(sockfd, msg, size, backlog);
+    }
+
+    MDF_FREE(msg);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Take the first set whose deadline has passed
+ *
+ * @param  type       Type of the set
+ * @param  addrs      Receives the addresses of the set
+ * @param  num        Receives the number of addresses
+ * @param  pending    Receives the number of other sets that are not empty
+ * @param  wait_ticks Receives the time until the next deadline
+ *
+ * @return true if a set is taken
+ */
+static bool mlink_notice_set_take(char type[16], uint8_t (*addrs)[6], size_t *num,
+                                  size_t *pending, TickType_t *wait_ticks)
+{
+    notice_set_t *due = NULL;
+    TickType_t now    = xTaskGetTickCount();
+
+    *pending    = 0;
+    *wait_ticks = pdMS_TO_TICKS(MLINK_NOTICE_UDP_RECV_TIMEROUT_MS);
+
+    xSemaphoreTake(g_notice_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MLINK_NOTICE_TYPE_MAX_NUM; ++i) {
+        notice_set_t *set = g_notice_sets + i;
+
+        if (!set->num) {
+            continue;
+        }
+
+        /**< Flushed when no address is added for a while, but not later than the maximum delay */
+        TickType_t deadline = set->last_tick + pdMS_TO_TICKS(MLINK_NOTICE_FLUSH_DELAY_MS);
+        TickType_t max_deadline = set->first_tick + pdMS_TO_TICKS(MLINK_NOTICE_FLUSH_MAX_DELAY_MS);
+        deadline = ((int32_t)(max_deadline - deadline) < 0) ? max_deadline : deadline;
+
+        if (!due && (set->num >= MLINK_NOTICE_MAC_MAX_NUM || (int32_t)(deadline - now) <= 0)) {
+            due = set;
+            continue;
+        }
+
+        ++*pending;
+
+        if ((int32_t)(deadline - now) > 0 && deadline - now < *wait_ticks) {
+            *wait_ticks = deadline - now;
+        }
+    }
+
+    if (due) {
+        strncpy(type, due->type, 15);
+        memcpy(addrs, due->addrs, due->num * 6);
+        memset(due->index, 0, g_notice_index_num * sizeof(uint16_t));
+        *num        = due->num;
+        due->num    = 0;
+        due->type[0] = '\0';
+        *wait_ticks = 0;
+    }
+
+    xSemaphoreGive(g_notice_lock);
+
+    return due ? true : false;
+}
+
 static void mlink_notice_udp_task(void *arg)
 {
-    mdf_err_t ret                = MDF_OK;
-    char message_tmp[32]         = {0};
-    char *broadcast_msg_buf      = NULL;
-    size_t broadcast_msg_size    = 0;
-    notice_udp_data_t *q_data    = NULL;
+    char type[16]                = {0};
+    size_t addrs_num             = 0;
+    size_t pending               = 0;
+    TickType_t wait_ticks        = 0;
     struct sockaddr_in from_addr = {0};
     uint8_t root_mac[6]          = {0};
     char *udp_server_buf         = MDF_MALLOC(MLINK_NOTICE_UDP_BUF_SIZE);
+    uint8_t (*addrs)[6]          = MDF_MALLOC(MLINK_NOTICE_MAC_MAX_NUM * 6);
     socklen_t from_addr_len      = sizeof(struct sockaddr_in);
     int udp_client_sockfd        = mlink_notice_udp_broadcast_create();
     int udp_server_sockfd        = mlink_notice_udp_server_create(MLINK_NOTIC_UDP_CLIENT_PORT);
 
     if (udp_client_sockfd == MLINK_NOTICE_SOCKET_INVALID_FD
-            || udp_server_sockfd == MLINK_NOTICE_SOCKET_INVALID_FD) {
+            || udp_server_sockfd == MLINK_NOTICE_SOCKET_INVALID_FD
+            || !udp_server_buf || !addrs) {
         MDF_LOGE("Failed to create UDP notification service");
 
         if (udp_client_sockfd != MLINK_NOTICE_SOCKET_INVALID_FD) {
@@ -183,6 +361,8 @@ static void mlink_notice_udp_task(void *arg)
             close(udp_server_sockfd);
         }
 
+        MDF_FREE(udp_server_buf);
+        MDF_FREE(addrs);
         vTaskDelete(NULL);
         return ;
     }
@@ -192,62 +372,27 @@ static void mlink_notice_udp_task(void *arg)
     while (!g_notice_udp_exit_flag) {
         memset(udp_server_buf, 0, MLINK_NOTICE_UDP_BUF_SIZE);
 
-        if (xQueueReceive(g_notice_udp_queue, &q_data, MLINK_NOTICE_UDP_RECV_TIMEROUT_MS / portTICK_RATE_MS)) {
-            strncpy(message_tmp, q_data->message, sizeof(message_tmp) - 1);
-            broadcast_msg_buf  = MDF_MALLOC(MLINK_NOTICE_UDP_QUEUE_NUM * 13 + 64);
-            broadcast_msg_size = sprintf(broadcast_msg_buf, "mac=%02x%02x%02x%02x%02x%02x", MAC2STR(q_data->mac));
-            MDF_FREE(q_data);
-
-            do {
-                if (!g_notice_udp_queue || !xQueueReceive(g_notice_udp_queue, &q_data,
-                        MLINK_NOTICE_UDP_RECV_TIMEROUT_MS / portTICK_RATE_MS)) {
-                    break;
-                }
-
-                if (strncmp(q_data->message, message_tmp, sizeof(message_tmp))) {
-                    if (!xQueueSend(g_notice_udp_queue, &q_data, 0)) {
-                        MDF_FREE(q_data);
-                    }
-
-                    break;
-                }
-
-                if (strcmp(q_data->message, "http")) {
-                    broadcast_msg_size += sprintf(broadcast_msg_buf + broadcast_msg_size,
-                                                  ",%02x%02x%02x%02x%02x%02x", MAC2STR(q_data->mac));
-                }
-
-                MDF_FREE(q_data);
-            } while (broadcast_msg_size < MLINK_NOTICE_UDP_QUEUE_NUM * 13);
+        if (mlink_notice_set_take(type, addrs, &addrs_num, &pending, &wait_ticks)) {
+            mlink_notice_udp_send(udp_client_sockfd, type, addrs, addrs_num, pending);
+            continue;
+        }
 
-            broadcast_msg_size += sprintf(broadcast_msg_buf + broadcast_msg_size,
-                                          "\r\nflag=%d\r\ntype=%s\r\n", xTaskGetTickCount(), message_tmp);
+        /**< Wait for a discovery request until the next set is due */
+        fd_set read_fds;
+        struct timeval timeout = {
+            .tv_sec  = 0,
+            .tv_usec = (wait_ticks ? wait_ticks : 1) * portTICK_RATE_MS * 1000,
+        };
 
-            MDF_LOGD("Mlink notice udp broadcast, size: %d, data:\n%s", broadcast_msg_size, broadcast_msg_buf);
+        FD_ZERO(&read_fds);
+        FD_SET(udp_server_sockfd, &read_fds);
 
-            for (int i = 0, delay_time_ms = 0; i < MLINK_NOTICE_UDP_RETRY_COUNT; ++i, delay_time_ms += delay_time_ms) {
-                vTaskDelay(delay_time_ms / portTICK_RATE_MS);
-                delay_time_ms = (i == 0) ? 10 : delay_time_ms;
-                delay_time_ms = (delay_time_ms > 50) ? 50 : delay_time_ms;
-
-                struct sockaddr_in broadcast_addr = {
-                    .sin_family      = AF_INET,
-                    .sin_port        = htons(MLINK_NOTICE_UDP_SERVER_PORT),
-                    .sin_addr.s_addr = htonl(INADDR_BROADCAST),
-                };
-
-                ret = sendto(udp_client_sockfd, broadcast_msg_buf, strlen(broadcast_msg_buf), 0,
-                             (struct sockaddr *)&broadcast_addr, sizeof(struct sockaddr));
-
-                if (ret < 0 && errno == ENOMEM) {
-                    MDF_LOGD("sendto not enough space, delay 100ms");
-                    vTaskDelay(100 / portMAX_DELAY);
-                }
-            }
+        if (select(udp_server_sockfd + 1, &read_fds, NULL, NULL, &timeout) <= 0) {
+            continue;
+        }
 
-            MDF_FREE(broadcast_msg_buf);
-        } else if (recvfrom(udp_server_sockfd, udp_server_buf, MLINK_NOTICE_UDP_BUF_SIZE,
-                            0, (struct sockaddr *)&from_addr, (socklen_t *)&from_addr_len) > 0) {
+        if (recvfrom(udp_server_sockfd, udp_server_buf, MLINK_NOTICE_UDP_BUF_SIZE,
+                     0, (struct sockaddr *)&from_addr, (socklen_t *)&from_addr_len) > 0) {
             MDF_LOGD("Mlink notice udp recvfrom, sockfd: %d, port: %d, ip: %s, udp_server_buf: %s",
                      udp_server_sockfd, ntohs(((struct sockaddr_in *)&from_addr)->sin_port),
                      inet_ntoa(((struct sockaddr_in *)&from_addr)->sin_addr), udp_server_buf);
@@ -281,33 +426,92 @@ static void mlink_notice_udp_task(void *arg)
     close(udp_client_sockfd);
     close(udp_server_sockfd);
     MDF_FREE(udp_server_buf);
+    MDF_FREE(addrs);
     vTaskDelete(NULL);
 }
 
+static mdf_err_t mlink_notice_lock_init()
+{
+    if (g_notice_lock) {
+        return MDF_OK;
+    }
+
+    for (g_notice_index_num = 16; g_notice_index_num < MLINK_NOTICE_MAC_MAX_NUM * 2;) {
+        g_notice_index_num <<= 1;
+    }
+
+    g_notice_lock = xSemaphoreCreateMutex();
+    MDF_ERROR_CHECK(!g_notice_lock, MDF_ERR_NO_MEM, "xSemaphoreCreateMutex");
+
+    return MDF_OK;
+}
+
 mdf_err_t mlink_notice_write(const char *message, size_t size, const uint8_t *addr)
 {
     MDF_PARAM_CHECK(addr);
     MDF_PARAM_CHECK(message);
     MDF_PARAM_CHECK(size > 0);
 
-    if (!g_notice_udp_queue) {
-        g_notice_udp_queue = xQueueCreate(MLINK_NOTICE_UDP_QUEUE_NUM, sizeof(void *));
+    mdf_err_t ret     = MDF_OK;
+    char type[16]     = {0};
+    notice_set_t *set = NULL;
+
+    ret = mlink_notice_lock_init();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_notice_lock_init");
+
+    memcpy(type, message, MIN(size, sizeof(type) - 1));
+
+    xSemaphoreTake(g_notice_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MLINK_NOTICE_TYPE_MAX_NUM && !set; ++i) {
+        set = !strcmp(g_notice_sets[i].type, type) ? g_notice_sets + i : NULL;
+    }
+
+    for (int i = 0; i < MLINK_NOTICE_TYPE_MAX_NUM && !set; ++i) {
+        set = !g_notice_sets[i].type[0] ? g_notice_sets + i : NULL;
     }
 
-    notice_udp_data_t *q_data = NULL;
+    ret = set ? MDF_OK : MDF_ERR_BUF;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Too many types of notices are waiting, type: %s", type);
 
-    if (!uxQueueSpacesAvailable(g_notice_udp_queue)
-            && xQueueReceive(g_notice_udp_queue, &q_data, 0)) {
-        MDF_LOGD("g_notice_udp_queue is full, delete the front item");
-        MDF_FREE(q_data);
+    if (!set->addrs) {
+        set->addrs = MDF_MALLOC(MLINK_NOTICE_MAC_MAX_NUM * 6);
+        set->index = MDF_CALLOC(g_notice_index_num, sizeof(uint16_t));
+
+        if (!set->addrs || !set->index) {
+            MDF_FREE(set->addrs);
+            MDF_FREE(set->index);
+            ret = MDF_ERR_NO_MEM;
+            goto EXIT;
+        }
     }
 
-    q_data = MDF_CALLOC(1, size + sizeof(notice_udp_data_t) + 1);
-    memcpy(q_data->message, message, size);
-    memcpy(q_data->mac, addr, 6);
-    xQueueSend(g_notice_udp_queue, &q_data, 0);
+    if (!set->num) {
+        strcpy(set->type, type);
+        set->first_tick = xTaskGetTickCount();
+    } else if (!strcmp(type, "http")) {
+        /**< The app only needs to know that the network changed */
+        goto EXIT;
+    }
 
-    return MDF_OK;
+    uint32_t pos = mlink_notice_addr_hash(addr);
+
+    for (; set->index[pos]; pos = (pos + 1) & (g_notice_index_num - 1)) {
+        if (!memcmp(set->addrs[set->index[pos] - 1], addr, 6)) {
+            goto EXIT;
+        }
+    }
+
+    ret = (set->num < MLINK_NOTICE_MAC_MAX_NUM) ? MDF_OK : MDF_ERR_BUF;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "The notice set is full, type: %s, addr: " MACSTR, type, MAC2STR(addr));
+
+    memcpy(set->addrs[set->num], addr, 6);
+    set->index[pos] = ++set->num;
+    set->last_tick  = xTaskGetTickCount();
+
+EXIT:
+    xSemaphoreGive(g_notice_lock);
+    return ret;
 }
 
 static mdf_err_t mlink_notice_udp_init()
@@ -316,11 +520,10 @@ static mdf_err_t mlink_notice_udp_init()
         return MDF_OK;
     }
 
-    g_notice_udp_exit_flag = false;
+    mdf_err_t ret = mlink_notice_lock_init();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_notice_lock_init");
 
-    if (!g_notice_udp_queue) {
-        g_notice_udp_queue = xQueueCreate(MLINK_NOTICE_UDP_QUEUE_NUM, sizeof(void *));
-    }
+    g_notice_udp_exit_flag = false;
 
     if (!g_notice_udp_exit_sem) {
         g_notice_udp_exit_sem = xSemaphoreCreateBinary();
@@ -349,15 +552,16 @@ static void mlink_notice_udp_deinit()
         g_notice_udp_exit_sem  = NULL;
     }
 
-    if (g_notice_udp_queue) {
-        notice_udp_data_t *q_data    = NULL;
+    if (g_notice_lock) {
+        xSemaphoreTake(g_notice_lock, portMAX_DELAY);
 
-        while (xQueueReceive(g_notice_udp_queue, &q_data, 0)) {
-            MDF_FREE(q_data);
+        for (int i = 0; i < MLINK_NOTICE_TYPE_MAX_NUM; ++i) {
+            MDF_FREE(g_notice_sets[i].addrs);
+            MDF_FREE(g_notice_sets[i].index);
+            memset(g_notice_sets + i, 0, sizeof(notice_set_t));
         }
 
-        vQueueDelete(g_notice_udp_queue);
-        g_notice_udp_queue = NULL;
+        xSemaphoreGive(g_notice_lock);
     }
 }
 
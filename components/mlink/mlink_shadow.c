@@ -0,0 +1,453 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cJSON.h"
+
+#include "mlink.h"
+#include "mwifi.h"
+
+/**
+ * @brief The cached value of a characteristic
+ */
+typedef struct {
+    uint16_t cid;          /**< The identifier of the characteristic */
+    TickType_t timestamp;  /**< The time of the last update, 0 means outdated */
+    char *value;           /**< The value as a json string */
+} mlink_shadow_value_t;
+
+/**
+ * @brief The shadow of a node
+ */
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];  /**< The address of the node */
+    uint32_t version;              /**< Increased when a value changes */
+    TickType_t timestamp;          /**< The time of the last response of the node */
+    uint16_t values_num;           /**< The number of cached values */
+    mlink_shadow_value_t *values;  /**< The cached values */
+} mlink_shadow_node_t;
+
+static const char *TAG                      = "mlink_shadow";
+static SemaphoreHandle_t g_shadow_lock      = NULL;
+static mlink_shadow_node_t **g_shadow_table = NULL; /**< Open addressing hash table indexed by the address */
+static size_t g_shadow_table_size           = 0;    /**< A power of 2, at least twice the maximum number */
+static size_t g_shadow_num                  = 0;
+static size_t g_shadow_max_num              = 0;
+
+mdf_err_t mlink_shadow_init(size_t max_num)
+{
+    MDF_PARAM_CHECK(max_num > 0);
+
+    if (g_shadow_table) {
+        return MDF_OK;
+    }
+
+    for (g_shadow_table_size = 16; g_shadow_table_size < max_num * 2; g_shadow_table_size <<= 1);
+
+    g_shadow_table = MDF_CALLOC(g_shadow_table_size, sizeof(mlink_shadow_node_t *));
+    MDF_ERROR_CHECK(!g_shadow_table, MDF_ERR_NO_MEM, "");
+
+    g_shadow_lock = xSemaphoreCreateMutex();
+
+    if (!g_shadow_lock) {
+        MDF_FREE(g_shadow_table);
+        return MDF_ERR_NO_MEM;
+    }
+
+    g_shadow_num     = 0;
+    g_shadow_max_num = max_num;
+
+    return MDF_OK;
+}
+
+static void mlink_shadow_node_free(mlink_shadow_node_t *node)
+{
+    if (!node) {
+        return;
+    }
+
+    for (int j = 0; j < node->values_num; ++j) {
+        MDF_FREE(node->values[j].value);
+    }
+
+    MDF_FREE(node->values);
+    MDF_FREE(node);
+}
+
+mdf_err_t mlink_shadow_deinit(void)
+{
+    if (!g_shadow_table) {
+        return MDF_OK;
+    }
+
+    for (int i = 0; i < g_shadow_table_size; ++i) {
+        mlink_shadow_node_free(g_shadow_table[i]);
+    }
+
+    MDF_FREE(g_shadow_table);
+    vSemaphoreDelete(g_shadow_lock);
+    g_shadow_lock = NULL;
+    g_shadow_num  = 0;
+
+    return MDF_OK;
+}
+
+static inline size_t mlink_shadow_hash(const uint8_t *addr)
+{
+    uint32_t key = (addr[2] << 24) | (addr[3] << 16) | (addr[4] << 8) | addr[5];
+
+    return (key * 2654435761U) >> 8;
+}
+
+/**
+ * @brief Remove the node of a slot, the nodes after it in the same run of
+ *        slots are moved back so that they are still found
+ */
+static void mlink_shadow_remove(size_t slot)
+{
+    size_t mask = g_shadow_table_size - 1;
+
+    mlink_shadow_node_free(g_shadow_table[slot]);
+    g_shadow_table[slot] = NULL;
+    g_shadow_num--;
+
+    for (size_t next = (slot + 1) & mask; g_shadow_table[next]; next = (next + 1) & mask) {
+        size_t home = mlink_shadow_hash(g_shadow_table[next]->addr) & mask;
+
+        /**< A node stays if its home slot is between the free slot and itself */
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            g_shadow_table[slot] = g_shadow_table[next];
+            g_shadow_table[next] = NULL;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * @brief Remove the node that has not responded for the longest time, nodes that
+ *        left the mesh or were replaced are dropped this way
+ */
+static void mlink_shadow_evict(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    size_t stalest = g_shadow_table_size;
+
+    for (size_t i = 0; i < g_shadow_table_size; ++i) {
+        if (g_shadow_table[i] && (stalest == g_shadow_table_size
+                                  || now - g_shadow_table[i]->timestamp > now - g_shadow_table[stalest]->timestamp)) {
+            stalest = i;
+        }
+    }
+
+    if (stalest < g_shadow_table_size) {
+        MDF_LOGD("The shadow is full, evict: " MACSTR, MAC2STR(g_shadow_table[stalest]->addr));
+        mlink_shadow_remove(stalest);
+    }
+}
+
+/**
+ * @brief Find the shadow of a node, and add it if create is true
+ */
+static mlink_shadow_node_t *mlink_shadow_find(const uint8_t *addr, bool create)
+{
+    size_t mask = g_shadow_table_size - 1;
+    size_t slot = mlink_shadow_hash(addr) & mask;
+
+    for (; g_shadow_table[slot]; slot = (slot + 1) & mask) {
+        if (!memcmp(g_shadow_table[slot]->addr, addr, MWIFI_ADDR_LEN)) {
+            return g_shadow_table[slot];
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    /**< The removal may move nodes into the run of slots of the address */
+    if (g_shadow_num >= g_shadow_max_num) {
+        mlink_shadow_evict();
+
+        for (slot = mlink_shadow_hash(addr) & mask; g_shadow_table[slot]; slot = (slot + 1) & mask);
+    }
+
+    mlink_shadow_node_t *node = MDF_CALLOC(1, sizeof(mlink_shadow_node_t));
+    MDF_ERROR_CHECK(!node, NULL, "");
+
+    memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+    g_shadow_table[slot] = node;
+    g_shadow_num++;
+
+    return node;
+}
+
+static mlink_shadow_value_t *mlink_shadow_find_value(mlink_shadow_node_t *node, uint16_t cid)
+{
+    for (int i = 0; i < node->values_num; ++i) {
+        if (node->values[i].cid == cid) {
+            return node->values + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Set a value of a node, the version is increased if the value changes
+ */
+static mdf_err_t mlink_shadow_set_value(mlink_shadow_node_t *node, uint16_t cid, char *value)
+{
+    mlink_shadow_value_t *shadow_value = mlink_shadow_find_value(node, cid);
+
+    if (!shadow_value) {
+        mlink_shadow_value_t *values = MDF_REALLOC(node->values, (node->values_num + 1) * sizeof(mlink_shadow_value_t));
+        MDF_ERROR_CHECK(!values, MDF_ERR_NO_MEM, "");
+
+        node->values = values;
+        shadow_value = node->values + node->values_num++;
+        shadow_value->cid   = cid;
+        shadow_value->value = NULL;
+    }
+
+    if (!shadow_value->value || strcmp(shadow_value->value, value)) {
+        node->version++;
+    }
+
+    MDF_FREE(shadow_value->value);
+    shadow_value->value     = value;
+    shadow_value->timestamp = xTaskGetTickCount() | 1;
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_shadow_update(const uint8_t *addr, const char *data, size_t size)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(!g_shadow_table, MDF_ERR_NOT_INIT, "mlink_shadow is not initialized");
+
+    mdf_err_t ret = MDF_ERR_NOT_FOUND;
+
+    char *json_str = MDF_MALLOC(size + 1);
+    MDF_ERROR_CHECK(!json_str, MDF_ERR_NO_MEM, "");
+    memcpy(json_str, data, size);
+    json_str[size] = '\0';
+
+    /**< Only responses that may carry characteristic values are parsed */
+    cJSON *pJson = strstr(json_str, "\"characteristics\"") ? cJSON_Parse(json_str) : NULL;
+    MDF_FREE(json_str);
+
+    if (!pJson) {
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    cJSON *pList = cJSON_GetObjectItem(pJson, "characteristics");
+
+    if (!pList || pList->type != cJSON_Array) {
+        cJSON_Delete(pJson);
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    xSemaphoreTake(g_shadow_lock, portMAX_DELAY);
+
+    mlink_shadow_node_t *node = mlink_shadow_find(addr, true);
+
+    if (!node) {
+        ret = MDF_ERR_NO_MEM;
+        goto EXIT;
+    }
+
+    node->timestamp = xTaskGetTickCount();
+
+    for (cJSON *pItem = pList->child; pItem; pItem = pItem->next) {
+        cJSON *pCid   = cJSON_GetObjectItem(pItem, "cid");
+        cJSON *pValue = cJSON_GetObjectItem(pItem, "value");
+
+        if (!pCid || pCid->type != cJSON_Number || !pValue) {
+            continue;
+        }
+
+        char *value = cJSON_PrintUnformatted(pValue);
+        MDF_ERROR_BREAK(!value, "cJSON_PrintUnformatted");
+
+        ret = mlink_shadow_set_value(node, pCid->valueint, value);
+
+        if (ret != MDF_OK) {
+            MDF_FREE(value);
+            break;
+        }
+    }
+
+EXIT:
+    xSemaphoreGive(g_shadow_lock);
+    cJSON_Delete(pJson);
+
+    return ret;
+}
+
+mdf_err_t mlink_shadow_invalidate(const uint8_t *addr)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_ERROR_CHECK(!g_shadow_table, MDF_ERR_NOT_INIT, "mlink_shadow is not initialized");
+
+    bool all = MWIFI_ADDR_IS_ANY(addr) || MWIFI_ADDR_IS_BROADCAST(addr);
+
+    xSemaphoreTake(g_shadow_lock, portMAX_DELAY);
+
+    for (int i = 0; i < g_shadow_table_size; ++i) {
+        mlink_shadow_node_t *node = g_shadow_table[i];
+
+        if (!node || (!all && memcmp(node->addr, addr, MWIFI_ADDR_LEN))) {
+            continue;
+        }
+
+        for (int j = 0; j < node->values_num; ++j) {
+            node->values[j].timestamp = 0;
+        }
+
+        if (!all) {
+            break;
+        }
+    }
+
+    xSemaphoreGive(g_shadow_lock);
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_shadow_get_status(const uint8_t *addr, const char *req_data, uint32_t max_age_ms,
+                                  char **resp_data, size_t *resp_size)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(req_data);
+    MDF_PARAM_CHECK(resp_data);
+    MDF_PARAM_CHECK(resp_size);
+    MDF_ERROR_CHECK(!g_shadow_table, MDF_ERR_NOT_INIT, "mlink_shadow is not initialized");
+
+    mdf_err_t ret            = MDF_ERR_NOT_SUPPORTED;
+    uint32_t age_ms          = 0;
+    mlink_json_buf_t resp    = {0};
+    mlink_json_buf_t characteristics_list = {0};
+    TickType_t now           = xTaskGetTickCount();
+
+    cJSON *pJson = cJSON_Parse(req_data);
+    MDF_ERROR_CHECK(!pJson, MDF_ERR_NOT_SUPPORTED, "cJSON_Parse");
+
+    cJSON *pRequest = cJSON_GetObjectItem(pJson, "request");
+    cJSON *pCids    = cJSON_GetObjectItem(pJson, "cids");
+
+    if (!pRequest || !pCids || pCids->type != cJSON_Array || !pCids->child
+            || !((pRequest->type == cJSON_String && !strcasecmp(pRequest->valuestring, "get_status"))
+                 || (pRequest->type == cJSON_Number && pRequest->valueint == MLINK_HANDLE_ID_GET_STATUS))) {
+        cJSON_Delete(pJson);
+        return MDF_ERR_NOT_SUPPORTED;
+    }
+
+    xSemaphoreTake(g_shadow_lock, portMAX_DELAY);
+
+    ret = MDF_ERR_NOT_FOUND;
+    mlink_shadow_node_t *node = mlink_shadow_find(addr, false);
+
+    if (!node) {
+        goto EXIT;
+    }
+
+    for (cJSON *pCid = pCids->child; pCid; pCid = pCid->next) {
+        /**< A malformed request is forwarded, the node answers it with an error */
+        if (pCid->type != cJSON_Number) {
+            goto EXIT;
+        }
+
+        mlink_shadow_value_t *value = mlink_shadow_find_value(node, pCid->valueint);
+
+        if (!value || !value->timestamp) {
+            goto EXIT;
+        }
+
+        age_ms = MAX(age_ms, (now - value->timestamp) * portTICK_PERIOD_MS);
+
+        if (age_ms > max_age_ms) {
+            goto EXIT;
+        }
+
+        mlink_json_buf_pack_format(&characteristics_list, "[]", "{\"cid\":%d,\"value\":%s}",
+                                   value->cid, value->value);
+    }
+
+    mlink_json_buf_pack_raw(&resp, "characteristics", characteristics_list.data, characteristics_list.size);
+    mlink_json_buf_pack(&resp, "shadow_version", node->version);
+    mlink_json_buf_pack(&resp, "shadow_age", age_ms);
+    mlink_json_buf_pack(&resp, "status_msg", mdf_err_to_name(MDF_OK));
+    mlink_json_buf_pack(&resp, "status_code", 0);
+
+    *resp_data = resp.data;
+    *resp_size = resp.size;
+    ret = MDF_OK;
+
+EXIT:
+    xSemaphoreGive(g_shadow_lock);
+    mlink_json_buf_free(&characteristics_list);
+    cJSON_Delete(pJson);
+
+    return ret;
+}
+
+mdf_err_t mlink_shadow_report(const uint16_t *cids, size_t cids_num)
+{
+    MDF_PARAM_CHECK(cids);
+    MDF_PARAM_CHECK(cids_num > 0);
+
+    mdf_err_t ret             = MDF_OK;
+    mlink_json_buf_t req      = {0};
+    mlink_json_buf_t cids_list = {0};
+    mwifi_data_type_t data_type = {
+        .compression = true,
+        .protocol    = MLINK_PROTO_HTTPD,
+    };
+
+    /**< The report is a response that no http connection is waiting for */
+    mlink_httpd_type_t httpd_type = {
+        .format = MLINK_HTTPD_FORMAT_JSON,
+        .from   = MLINK_HTTPD_FROM_DEVICE,
+        .resp   = true,
+    };
+
+    for (int i = 0; i < cids_num; ++i) {
+        mlink_json_buf_pack(&cids_list, "[]", cids[i]);
+    }
+
+    mlink_json_buf_pack(&req, "request", "get_status");
+    mlink_json_buf_pack_raw(&req, "cids", cids_list.data, cids_list.size);
+    mlink_json_buf_free(&cids_list);
+    MDF_ERROR_CHECK(!req.size, MDF_ERR_NO_MEM, "");
+
+    mlink_handle_data_t handle_data = {
+        .req_data    = req.data,
+        .req_size    = req.size,
+        .req_fromat  = MLINK_HTTPD_FORMAT_JSON,
+        .resp_data   = NULL,
+        .resp_size   = 0,
+        .resp_fromat = MLINK_HTTPD_FORMAT_JSON,
+    };
+
+    ret = mlink_handle_request_id(MLINK_HANDLE_ID_GET_STATUS, &handle_data);
+    mlink_json_buf_free(&req);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mlink_handle_request_id", mdf_err_to_name(ret));
+
+    memcpy(&data_type.custom, &httpd_type, sizeof(mlink_httpd_type_t));
+    ret = mwifi_write(NULL, &data_type, handle_data.resp_data, handle_data.resp_size, true);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mwifi_write", mdf_err_to_name(ret));
+
+EXIT:
+    MDF_FREE(handle_data.resp_data);
+    return ret;
+}
@@ -15,6 +15,7 @@
 #include "esp_wifi.h"
 
 #include "mlink.h"
+#include "mwifi.h"
 
 /**
  * @brief Wi-Fi packet format
@@ -27,17 +28,68 @@ typedef struct {
     uint8_t payload[0];
 } sniffer_payload_t;
 
-typedef struct sniffer_data_list {
-    struct sniffer_data_list *next;
-    mlink_sniffer_data_t data;
-} __attribute__((packed)) sniffer_data_list_t;
+#define MLINK_SNIFFER_QUEUE_SIZE        CONFIG_MLINK_SNIFFER_QUEUE_SIZE
+#define MLINK_SNIFFER_ADV_MAX_LEN       (31)  /**< Space for the name and the manufacturer of a BLE device */
+#define MLINK_SNIFFER_DRAIN_INTERVAL_MS (100)
+#define MLINK_SNIFFER_OUI_TABLE_SIZE    (64)  /**< Power of two, larger than twice the number of OUIs */
+#define MLINK_SNIFFER_BATCH_SIZE        MWIFI_PAYLOAD_LEN
+#define MLINK_SNIFFER_DELTA_RSSI        (3)   /**< A smaller change of the RSSI is not reported by a delta report */
+
+#define SNIFFER_DEVICE_REPORTED         (1 << 0) /**< The device was sent by the previous report */
+
+/**
+ * @brief A captured packet, only the fields up to adv are kept for Wi-Fi
+ */
+typedef struct {
+    uint8_t type;             /**< MLINK_SNIFFER_WIFI or MLINK_SNIFFER_BLE */
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t addr[6];
+    uint8_t name_len;
+    uint8_t manufacturer_len;
+    uint32_t timestamp;
+    uint8_t adv[MLINK_SNIFFER_ADV_MAX_LEN]; /**< The name followed by the manufacturer */
+} sniffer_record_t;
+
+/**
+ * @brief Ring between the receive callback and the sniffer task, it has a single
+ *        producer and a single consumer, so no lock is taken by the callback
+ */
+typedef struct {
+    uint8_t *buf;
+    uint16_t elem_size;
+    uint16_t num;             /**< A power of 2 */
+    uint32_t head;            /**< Written by the producer only */
+    uint32_t tail;            /**< Written by the consumer only */
+} sniffer_ring_t;
+
+/**
+ * @brief A device of the table, the packets of the same device are merged into it
+ */
+typedef struct {
+    sniffer_record_t record;  /**< The last packet of the device */
+    int32_t rssi_sum;
+    uint16_t rssi_count;      /**< 0 if the device is not seen since the previous report */
+    uint8_t flag;
+    int8_t report_rssi;       /**< The values sent by the previous report */
+    uint8_t report_channel;
+} sniffer_device_t;
 
 #define sniffer_timestamp() (xTaskGetTickCount() * portTICK_RATE_MS)
 
 static const char *TAG       = "mlink_sniffer";
 static void *g_sniffer_lock  = NULL;
 static uint32_t g_device_num = 0;
-static sniffer_data_list_t *g_sniffer_list = NULL;
+static bool g_sniffer_running         = false;
+static TaskHandle_t g_sniffer_task    = NULL;
+static SemaphoreHandle_t g_sniffer_exit_sem = NULL;
+static sniffer_ring_t *g_wifi_ring    = NULL;
+static sniffer_ring_t *g_ble_ring     = NULL;
+static sniffer_device_t *g_device_list = NULL; /**< buffer_num devices in the order they are found */
+static uint16_t *g_device_index       = NULL;  /**< Hash of the address to the position in g_device_list plus 1 */
+static size_t g_device_index_num      = 0;
+static size_t g_device_max_num        = 0;
+static uint32_t g_esp_oui_table[MLINK_SNIFFER_OUI_TABLE_SIZE] = {0};
 static mlink_sniffer_config_t g_sniffer_config   = {
     .enable_type       = MLINK_SNIFFER_NONE,
     .notice_percentage = 50,
@@ -47,7 +99,7 @@ static mlink_sniffer_config_t g_sniffer_config   = {
     .ble_scan_window   = 50,
 };
 
-static const uint8_t esp_module_addr[32][3] = {
+static const uint8_t esp_module_addr[][3] = {
     {0x54, 0x5A, 0xA6}, {0x24, 0x0A, 0xC4}, {0xD8, 0xA0, 0x1D}, {0xEC, 0xFA, 0xBC},
     {0xA0, 0x20, 0xA6}, {0x90, 0x97, 0xD5}, {0x18, 0xFE, 0x34}, {0x60, 0x01, 0x94},
     {0x2C, 0x3A, 0xE8}, {0xA4, 0x7B, 0x9D}, {0xDC, 0x4F, 0x22}, {0x5C, 0xCF, 0x7F},
@@ -67,134 +119,284 @@ static uint8_t ltv_data_insert(uint8_t *data, uint8_t type, uint8_t length, cons
     return length + sizeof(length) + sizeof(type);
 }
 
-static uint8_t *ltv_data_get(const uint8_t *data, uint8_t type,
-                             uint8_t total_length, uint8_t *length)
+static inline uint32_t sniffer_oui_hash(uint32_t oui)
 {
-    uint8_t *value = (uint8_t *)data;
-
-    for (uint8_t tmp_len = *value++; tmp_len && (value - data <= total_length);
-            value += tmp_len - sizeof(tmp_len) /* skip the length of data */, tmp_len = *value++) {
-        if (*value++ == type) {
-            /* length doesn't include itself */
-            *length = tmp_len - sizeof(tmp_len); /* minus the length of type */
-            return value;
+    return (oui * 2654435761U) >> 26;
+}
+
+static void sniffer_oui_table_init()
+{
+    for (int i = 0; i < sizeof(esp_module_addr) / sizeof(esp_module_addr[0]); ++i) {
+        uint32_t oui = (esp_module_addr[i][0] << 16) | (esp_module_addr[i][1] << 8) | esp_module_addr[i][2];
+        uint32_t pos = sniffer_oui_hash(oui);
+
+        while (g_esp_oui_table[pos] && g_esp_oui_table[pos] != oui) {
+            pos = (pos + 1) & (MLINK_SNIFFER_OUI_TABLE_SIZE - 1);
         }
+
+        g_esp_oui_table[pos] = oui;
     }
+}
+
+/**
+ * @brief Whether the address is of an espressif module, the OUIs are never 0,
+ *        which marks a free position of the table
+ */
+static bool sniffer_oui_is_esp(const uint8_t *addr)
+{
+    uint32_t oui = (addr[0] << 16) | (addr[1] << 8) | addr[2];
 
-    *length = 0;
-    return NULL;
+    for (uint32_t pos = sniffer_oui_hash(oui); g_esp_oui_table[pos];
+            pos = (pos + 1) & (MLINK_SNIFFER_OUI_TABLE_SIZE - 1)) {
+        if (g_esp_oui_table[pos] == oui) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-static mdf_err_t mlink_sniffer_list_insert(const mlink_sniffer_data_t *sniffer_data)
+/**
+ * @brief Create a ring, the number of slots is rounded up to a power of 2 so
+ *        that the slots stay in order when the counters wrap around
+ */
+static sniffer_ring_t *sniffer_ring_create(size_t elem_size, size_t num)
 {
-    sniffer_data_list_t *sniffer_node = NULL;
-    uint8_t addr_len                  = 0;
-    static int notice_percentage      = 0;
-    uint8_t *sniffer_data_addr        = ltv_data_get(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
-                                        sniffer_data->size - 1, &addr_len);
+    size_t ring_num = 1;
 
-    if (!g_sniffer_list) {
-        g_sniffer_list       = MDF_MALLOC(sizeof(sniffer_data_list_t));
-        g_sniffer_list->next = NULL;
+    while (ring_num < num) {
+        ring_num <<= 1;
     }
 
-    if (!g_sniffer_lock) {
-        g_sniffer_lock  = xSemaphoreCreateMutex();
+    sniffer_ring_t *ring = MDF_CALLOC(1, sizeof(sniffer_ring_t) + elem_size * ring_num);
+    MDF_ERROR_CHECK(!ring, NULL, "");
+
+    ring->buf       = (uint8_t *)(ring + 1);
+    ring->elem_size = elem_size;
+    ring->num       = ring_num;
+
+    return ring;
+}
+
+static inline uint32_t sniffer_ring_count(const sniffer_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Get the free slot at the head of the ring, NULL if it is full
+ */
+static inline void *sniffer_ring_reserve(sniffer_ring_t *ring)
+{
+    uint32_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->num) {
+        return NULL;
     }
 
-    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+    return ring->buf + (head & (ring->num - 1)) * ring->elem_size;
+}
 
-    if (/* esp_get_free_heap_size() < 20 * 1024 || */ g_device_num > g_sniffer_config.buffer_num) {
-        g_device_num = 0;
+static inline void sniffer_ring_commit(sniffer_ring_t *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
 
-        for (sniffer_node = g_sniffer_list->next; sniffer_node; sniffer_node = g_sniffer_list->next) {
-            g_sniffer_list->next = sniffer_node->next;
-            MDF_FREE(sniffer_node);
-        }
+    if (sniffer_ring_count(ring) == ring->num / 2 && g_sniffer_task) {
+        xTaskNotifyGive(g_sniffer_task);
     }
+}
 
-    notice_percentage = (!g_device_num) ? g_sniffer_config.notice_percentage : notice_percentage;
+/**
+ * @brief Get the slot at the tail of the ring, NULL if it is empty
+ */
+static inline void *sniffer_ring_peek(sniffer_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
 
-    if (notice_percentage && g_device_num > g_sniffer_config.buffer_num * notice_percentage / 100) {
-        mdf_event_loop_send(MDF_EVENT_MLINK_BUFFER_FULL, NULL);
-        MDF_LOGD("sniffer notice percentage: %d%%, g_device_num: %d",
-                 notice_percentage, g_device_num);
-        notice_percentage += notice_percentage;
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return NULL;
     }
 
+    return ring->buf + (tail & (ring->num - 1)) * ring->elem_size;
+}
 
-    for (int i = 0; g_sniffer_config.esp_filter && i < 32; ++i) {
-        if (!memcmp(sniffer_data_addr, esp_module_addr[i], 3)) {
-            xSemaphoreGive(g_sniffer_lock);
-            return MDF_OK;
-        }
+static inline void sniffer_ring_release(sniffer_ring_t *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t sniffer_device_hash(uint8_t type, const uint8_t *addr)
+{
+    uint32_t hash = 2166136261U ^ type; /**< FNV-1a */
+
+    for (int i = 0; i < 6; ++i) {
+        hash = (hash ^ addr[i]) * 16777619U;
     }
 
-    for (sniffer_node = g_sniffer_list->next; sniffer_node; sniffer_node = sniffer_node->next) {
-        uint8_t *sniffer_node_addr = ltv_data_get(sniffer_node->data.data, MLINK_SNIFFER_DATA_ADDR,
-                                     sniffer_node->data.size - 1, &addr_len);
+    return hash;
+}
 
-        if (!sniffer_node_addr) {
-            esp_log_buffer_hex(TAG, sniffer_node->data.data, sniffer_node->data.size);
-        }
+/**
+ * @brief Allocate the device table, all the devices that are found are dropped
+ */
+static mdf_err_t mlink_sniffer_table_resize(size_t max_num)
+{
+    size_t index_num = 16;
 
-        MDF_ERROR_BREAK(!sniffer_node_addr, "ltv_data_get, ret: %p", sniffer_node_addr);
+    max_num = (max_num > 0 && max_num < UINT16_MAX) ? max_num : UINT16_MAX - 1;
 
-        if (!memcmp(sniffer_node_addr, sniffer_data_addr, addr_len)) {
-            if (sniffer_node->data.size < sniffer_data->size) {
-                MDF_LOGD("new broadcast packet data length changes");
-                sniffer_node = NULL;
-            }
+    while (index_num < max_num * 2) {
+        index_num <<= 1;
+    }
+
+    MDF_FREE(g_device_list);
+    MDF_FREE(g_device_index);
+    g_device_num       = 0;
+    g_device_max_num   = 0;
+    g_device_index_num = 0;
+
+    g_device_list  = MDF_MALLOC(max_num * sizeof(sniffer_device_t));
+    g_device_index = MDF_CALLOC(index_num, sizeof(uint16_t));
+
+    if (!g_device_list || !g_device_index) {
+        MDF_FREE(g_device_list);
+        MDF_FREE(g_device_index);
+        return MDF_ERR_NO_MEM;
+    }
+
+    g_device_max_num   = max_num;
+    g_device_index_num = index_num;
+
+    return MDF_OK;
+}
 
+static void mlink_sniffer_table_clear()
+{
+    if (g_device_index) {
+        memset(g_device_index, 0, g_device_index_num * sizeof(uint16_t));
+    }
+
+    g_device_num = 0;
+}
+
+static mdf_err_t mlink_sniffer_table_insert(const sniffer_record_t *record, size_t record_size)
+{
+    static int notice_percentage = 0;
+    sniffer_device_t *device     = NULL;
+    uint32_t pos = sniffer_device_hash(record->type, record->addr) & (g_device_index_num - 1);
+
+    for (; g_device_index[pos]; pos = (pos + 1) & (g_device_index_num - 1)) {
+        device = g_device_list + g_device_index[pos] - 1;
+
+        if (device->record.type == record->type && !memcmp(device->record.addr, record->addr, 6)) {
             break;
         }
+
+        device = NULL;
+    }
+
+    if (device) {
+        if (device->rssi_count == UINT16_MAX) {
+            device->rssi_sum   /= 2;
+            device->rssi_count /= 2;
+        }
+
+        memcpy(&device->record, record, record_size);
+        device->rssi_sum += record->rssi;
+        device->rssi_count++;
+
+        return MDF_OK;
     }
 
-    if (!sniffer_node) {
-        sniffer_node         = MDF_MALLOC(sizeof(sniffer_data_list_t) + sniffer_data->size);
-        sniffer_node->next   = g_sniffer_list->next;
-        g_sniffer_list->next = sniffer_node;
+    /**< Keep the devices already found until the application takes them */
+    if (g_device_num >= g_device_max_num) {
+        MDF_LOGD("sniffer buffer is full, drop: " MACSTR, MAC2STR(record->addr));
+        return MDF_ERR_BUF;
     }
 
-    memcpy(&sniffer_node->data, sniffer_data, sniffer_data->size + sizeof(sniffer_data->size));
-    g_device_num++;
+    device = g_device_list + g_device_num;
+    memcpy(&device->record, record, record_size);
+    device->rssi_sum   = record->rssi;
+    device->rssi_count = 1;
+    device->flag       = 0;
+    g_device_index[pos] = ++g_device_num;
 
-    xSemaphoreGive(g_sniffer_lock);
+    notice_percentage = (g_device_num == 1) ? g_sniffer_config.notice_percentage : notice_percentage;
+
+    if (notice_percentage && g_device_num > g_sniffer_config.buffer_num * notice_percentage / 100) {
+        mdf_event_loop_send(MDF_EVENT_MLINK_BUFFER_FULL, NULL);
+        MDF_LOGD("sniffer notice percentage: %d%%, g_device_num: %d",
+                 notice_percentage, g_device_num);
+        notice_percentage += notice_percentage;
+    }
 
     return MDF_OK;
 }
 
+/**
+ * @brief Move the packets of the rings into the device table, g_sniffer_lock must be held
+ */
+static void mlink_sniffer_drain()
+{
+    sniffer_ring_t *rings[] = {g_wifi_ring, g_ble_ring};
+
+    for (int i = 0; i < sizeof(rings) / sizeof(rings[0]); ++i) {
+        for (sniffer_record_t *record = NULL; rings[i] && (record = sniffer_ring_peek(rings[i]));
+                sniffer_ring_release(rings[i])) {
+            if (g_device_index) {
+                mlink_sniffer_table_insert(record, rings[i]->elem_size);
+            }
+        }
+    }
+}
+
+static void mlink_sniffer_task(void *arg)
+{
+    while (g_sniffer_running) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MLINK_SNIFFER_DRAIN_INTERVAL_MS));
+
+        xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+        mlink_sniffer_drain();
+        xSemaphoreGive(g_sniffer_lock);
+    }
+
+    MDF_LOGD("mlink_sniffer_task exit");
+
+    g_sniffer_task = NULL;
+    xSemaphoreGive(g_sniffer_exit_sem);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Runs in the Wi-Fi task for every packet, the packet is only copied into the ring
+ */
 static void sniffer_wifi_cb(void *recv_buf, wifi_promiscuous_pkt_type_t type)
 {
     wifi_promiscuous_pkt_t *wifi_promiscuous_pkt = (wifi_promiscuous_pkt_t *)recv_buf;
     sniffer_payload_t *sniffer_payload           = (sniffer_payload_t *)wifi_promiscuous_pkt->payload;
+    sniffer_record_t *record                     = NULL;
 
-    if (sniffer_payload->header[0] != 0x40) {
+    if (sniffer_payload->header[0] != 0x40 || !g_wifi_ring) {
         return;
     }
 
-    int8_t rssi        = wifi_promiscuous_pkt->rx_ctrl.rssi;
-    uint8_t channel    = wifi_promiscuous_pkt->rx_ctrl.channel;
-    uint32_t timestamp = sniffer_timestamp();
-    mlink_sniffer_data_t *sniffer_data = MDF_CALLOC(1, 22);
-
-    MDF_LOGD("Wi-Fi, addr: "MACSTR", rssi: %d, channel: %d",
-             MAC2STR(sniffer_payload->source_addr), rssi, channel);
+    if (g_sniffer_config.esp_filter && sniffer_oui_is_esp(sniffer_payload->source_addr)) {
+        return;
+    }
 
-    sniffer_data->type  = MLINK_SNIFFER_WIFI;
-    sniffer_data->size  = ltv_data_insert(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
-                                          6, sniffer_payload->source_addr);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_TIMESTAMP,
-                                          sizeof(uint32_t), &timestamp);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_RSSI,
-                                          sizeof(uint8_t), &rssi);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_CHANNEL,
-                                          sizeof(uint8_t), &channel);
-    sniffer_data->size += sizeof(sniffer_data->type);
+    if (!(record = sniffer_ring_reserve(g_wifi_ring))) {
+        return;
+    }
 
-    mlink_sniffer_list_insert(sniffer_data);
+    record->type      = MLINK_SNIFFER_WIFI;
+    record->rssi      = wifi_promiscuous_pkt->rx_ctrl.rssi;
+    record->channel   = wifi_promiscuous_pkt->rx_ctrl.channel;
+    record->timestamp = sniffer_timestamp();
+    record->name_len  = 0;
+    record->manufacturer_len = 0;
+    memcpy(record->addr, sniffer_payload->source_addr, 6);
 
-    MDF_FREE(sniffer_data);
+    sniffer_ring_commit(g_wifi_ring);
 }
 
 #if CONFIG_BT_ENABLED
@@ -221,24 +423,28 @@ static mdf_err_t mlink_sniffer_ble_cb(void *data, size_t size)
              adv_name_len, adv_name_len, (char *)adv_name, adv_manufacturer_len,
              (adv_manufacturer_len ? * ((uint16_t *)adv_manufacturer) : 0));
 
-    uint32_t timestamp = sniffer_timestamp();
-    mlink_sniffer_data_t *sniffer_data = MDF_CALLOC(1, sizeof(mlink_sniffer_data_t) + 21 + adv_name_len + adv_manufacturer_len);
-
-    sniffer_data->type = MLINK_SNIFFER_BLE;
-    sniffer_data->size += ltv_data_insert(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
-                                          6, scan_result->scan_rst.bda);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_TIMESTAMP,
-                                          sizeof(uint32_t), &timestamp);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_RSSI,
-                                          sizeof(uint8_t), &scan_result->scan_rst.rssi);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_NAME,
-                                          adv_name_len, adv_name);
-    sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_MANUFACTURER,
-                                          adv_manufacturer_len, adv_manufacturer);
-    sniffer_data->size += sizeof(sniffer_data->type);
-    mlink_sniffer_list_insert(sniffer_data);
-
-    MDF_FREE(sniffer_data);
+    sniffer_record_t *record = NULL;
+
+    if (!g_ble_ring || (g_sniffer_config.esp_filter && sniffer_oui_is_esp(scan_result->scan_rst.bda))) {
+        return MDF_OK;
+    }
+
+    if (!(record = sniffer_ring_reserve(g_ble_ring))) {
+        return MDF_OK;
+    }
+
+    /**< A name or a manufacturer that does not fit in the record is truncated */
+    record->type             = MLINK_SNIFFER_BLE;
+    record->rssi             = scan_result->scan_rst.rssi;
+    record->channel          = 0;
+    record->timestamp        = sniffer_timestamp();
+    record->name_len         = MIN(adv_name_len, MLINK_SNIFFER_ADV_MAX_LEN);
+    record->manufacturer_len = MIN(adv_manufacturer_len, MLINK_SNIFFER_ADV_MAX_LEN - record->name_len);
+    memcpy(record->addr, scan_result->scan_rst.bda, 6);
+    memcpy(record->adv, adv_name, record->name_len);
+    memcpy(record->adv + record->name_len, adv_manufacturer, record->manufacturer_len);
+
+    sniffer_ring_commit(g_ble_ring);
 
 #endif /**< CONFIG_BT_ENABLED */
 
@@ -250,8 +456,24 @@ mdf_err_t mlink_sniffer_set_config(const mlink_sniffer_config_t *config)
 {
     MDF_PARAM_CHECK(config);
 
+    mdf_err_t ret = MDF_OK;
+
+    if (g_sniffer_lock) {
+        xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+    }
+
+    if (g_device_index && config->buffer_num != g_sniffer_config.buffer_num) {
+        ret = mlink_sniffer_table_resize(config->buffer_num);
+    }
+
     memcpy(&g_sniffer_config, config, sizeof(mlink_sniffer_config_t));
 
+    if (g_sniffer_lock) {
+        xSemaphoreGive(g_sniffer_lock);
+    }
+
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_sniffer_table_resize, buffer_num: %d", config->buffer_num);
+
     return MDF_OK;
 }
 
@@ -272,37 +494,71 @@ mdf_err_t mlink_sniffer_data(uint8_t **data, size_t *size)
     *size = 0;
     *data = NULL;
 
-    if (!g_sniffer_list || !g_sniffer_list->next || !g_sniffer_lock) {
+    if (!g_sniffer_lock) {
         MDF_LOGD("sniffer data NULL");
         return ESP_OK;
     }
 
     xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
 
-    uint32_t timestamp  = sniffer_timestamp();
+    mlink_sniffer_drain();
 
-    for (sniffer_data_list_t *sniffer_node = g_sniffer_list->next; sniffer_node;
-            sniffer_node = g_sniffer_list->next) {
-        size_t data_size       = *size;
-        uint8_t timestamp_len  = 0;
-        uint8_t *timestamp_ptr = ltv_data_get(sniffer_node->data.data, MLINK_SNIFFER_DATA_TIMESTAMP,
-                                              sniffer_node->data.size - 1, &timestamp_len);
+    size_t data_size   = 0;
+    uint32_t timestamp = sniffer_timestamp();
 
-        *size += sniffer_node->data.size + sizeof(sniffer_node->data.size);
+    for (int i = 0; i < g_device_num; ++i) {
+        const sniffer_record_t *record = &g_device_list[i].record;
 
-        if (!(*data = MDF_REALLOC(*data, *size))) {
-            MDF_FREE(*data);
-            return MDF_ERR_NO_MEM;
+        if (!g_device_list[i].rssi_count) {
+            continue;
         }
 
-        *((uint32_t *)timestamp_ptr) = timestamp - *((uint32_t *)timestamp_ptr);
-        memcpy(*data + data_size, &sniffer_node->data, sniffer_node->data.size + sizeof(sniffer_node->data.size));
+        /**< The length and the type of each field take 2 bytes */
+        data_size += sizeof(mlink_sniffer_data_t) + (2 + 6) + (2 + sizeof(uint32_t))
+                     + (2 + sizeof(int8_t)) + (2 + sizeof(uint8_t))
+                     + (record->name_len ? record->name_len + 2 : 0)
+                     + (record->manufacturer_len ? record->manufacturer_len + 2 : 0);
+    }
 
-        g_sniffer_list->next = sniffer_node->next;
-        MDF_FREE(sniffer_node);
+    if (data_size && !(*data = MDF_MALLOC(data_size))) {
+        xSemaphoreGive(g_sniffer_lock);
+        return MDF_ERR_NO_MEM;
     }
 
-    g_device_num = 0;
+    for (int i = 0; i < g_device_num; ++i) {
+        const sniffer_record_t *record     = &g_device_list[i].record;
+        mlink_sniffer_data_t *sniffer_data = (mlink_sniffer_data_t *)(*data + *size);
+
+        if (!g_device_list[i].rssi_count) {
+            continue;
+        }
+
+        int8_t rssi   = g_device_list[i].rssi_sum / g_device_list[i].rssi_count;
+        uint32_t time = timestamp - record->timestamp;
+
+        sniffer_data->type  = record->type;
+        sniffer_data->size  = ltv_data_insert(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
+                                              6, record->addr);
+        sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_TIMESTAMP,
+                                              sizeof(uint32_t), &time);
+        sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_RSSI,
+                                              sizeof(uint8_t), &rssi);
+
+        if (record->type == MLINK_SNIFFER_WIFI) {
+            sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_CHANNEL,
+                                                  sizeof(uint8_t), &record->channel);
+        } else {
+            sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_NAME,
+                                                  record->name_len, record->adv);
+            sniffer_data->size += ltv_data_insert(sniffer_data->data + sniffer_data->size, MLINK_SNIFFER_DATA_MANUFACTURER,
+                                                  record->manufacturer_len, record->adv + record->name_len);
+        }
+
+        sniffer_data->size += sizeof(sniffer_data->type);
+        *size += sniffer_data->size + sizeof(sniffer_data->size);
+    }
+
+    mlink_sniffer_table_clear();
     MDF_LOGD("sniffer_node, total_size: %d", *size);
 
     xSemaphoreGive(g_sniffer_lock);
@@ -310,10 +566,171 @@ mdf_err_t mlink_sniffer_data(uint8_t **data, size_t *size)
     return MDF_OK;
 }
 
+/**
+ * @brief Whether a device goes into the report, a device that is not seen since
+ *        the previous report is only sent by a delta report, as removed
+ */
+static bool mlink_sniffer_device_reported(const sniffer_device_t *device, bool delta)
+{
+    if (!device->rssi_count) {
+        return delta && (device->flag & SNIFFER_DEVICE_REPORTED);
+    }
+
+    int8_t rssi = device->rssi_sum / device->rssi_count;
+
+    return !delta || !(device->flag & SNIFFER_DEVICE_REPORTED)
+           || abs(rssi - device->report_rssi) >= MLINK_SNIFFER_DELTA_RSSI
+           || device->record.channel != device->report_channel;
+}
+
+/**
+ * @brief Update the devices of a batch once report_cb has taken it, the devices
+ *        that are not seen since the previous report are removed from the list
+ */
+static size_t mlink_sniffer_batch_commit(int begin, int end, size_t device_num, bool delta)
+{
+    for (int i = begin; i < end; ++i) {
+        sniffer_device_t *device = g_device_list + i;
+
+        if (!device->rssi_count) {
+            continue;
+        }
+
+        if (mlink_sniffer_device_reported(device, delta)) {
+            device->flag          |= SNIFFER_DEVICE_REPORTED;
+            device->report_rssi    = device->rssi_sum / device->rssi_count;
+            device->report_channel = device->record.channel;
+        }
+
+        device->rssi_sum   = 0;
+        device->rssi_count = 0;
+        g_device_list[device_num++] = *device;
+    }
+
+    return device_num;
+}
+
+static mdf_err_t mlink_sniffer_batch_flush(mlink_sniffer_batch_t *batch, bool last,
+        mlink_sniffer_report_cb_t report_cb, void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+
+    batch->flag |= last ? MLINK_SNIFFER_REPORT_LAST : 0;
+
+    ret = report_cb((uint8_t *)batch, sizeof(mlink_sniffer_batch_t) + batch->num * sizeof(mlink_sniffer_record_t), arg);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "report_cb, seq: %d, index: %d", batch->seq, batch->index);
+
+    batch->index++;
+    batch->num = 0;
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_sniffer_report(bool delta, mlink_sniffer_report_cb_t report_cb, void *arg)
+{
+    MDF_PARAM_CHECK(report_cb);
+    MDF_ERROR_CHECK(!g_sniffer_lock, MDF_ERR_NOT_INIT, "Sniffer is not initialized");
+
+    static uint16_t s_report_seq = 0;
+    mdf_err_t ret          = MDF_OK;
+    size_t device_num      = 0;
+    int batch_begin        = 0;
+    int i                  = 0;
+    mlink_sniffer_record_t *records = NULL;
+    mlink_sniffer_batch_t *batch    = MDF_CALLOC(1, MLINK_SNIFFER_BATCH_SIZE);
+    const size_t batch_max_num      = (MLINK_SNIFFER_BATCH_SIZE - sizeof(mlink_sniffer_batch_t)) / sizeof(mlink_sniffer_record_t);
+    MDF_ERROR_CHECK(!batch, MDF_ERR_NO_MEM, "");
+
+    records        = (mlink_sniffer_record_t *)(batch + 1);
+    batch->version = MLINK_SNIFFER_REPORT_VERSION;
+    batch->flag    = delta ? MLINK_SNIFFER_REPORT_DELTA : 0;
+    batch->seq     = s_report_seq++;
+
+    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+
+    mlink_sniffer_drain();
+
+    uint32_t timestamp = sniffer_timestamp();
+
+    for (i = 0; i < g_device_num; ++i) {
+        sniffer_device_t *device       = g_device_list + i;
+        mlink_sniffer_record_t *record = records + batch->num;
+
+        if (batch->num == batch_max_num) {
+            ret = mlink_sniffer_batch_flush(batch, false, report_cb, arg);
+            MDF_ERROR_BREAK(ret != MDF_OK, "mlink_sniffer_batch_flush");
+            device_num  = mlink_sniffer_batch_commit(batch_begin, i, device_num, delta);
+            batch_begin = i;
+            record      = records;
+        }
+
+        if (!mlink_sniffer_device_reported(device, delta)) {
+            continue;
+        }
+
+        memcpy(record->addr, device->record.addr, 6);
+        record->timestamp = timestamp - device->record.timestamp;
+
+        /**< A device that is not seen since the previous report is removed */
+        if (!device->rssi_count) {
+            record->type    = MLINK_SNIFFER_NONE;
+            record->rssi    = 0;
+            record->channel = 0;
+        } else {
+            record->type    = device->record.type;
+            record->rssi    = device->rssi_sum / device->rssi_count;
+            record->channel = device->record.channel;
+        }
+
+        batch->num++;
+    }
+
+    if (ret == MDF_OK) {
+        ret = mlink_sniffer_batch_flush(batch, true, report_cb, arg);
+    }
+
+    if (ret == MDF_OK) {
+        device_num  = mlink_sniffer_batch_commit(batch_begin, g_device_num, device_num, delta);
+        batch_begin = g_device_num;
+    }
+
+    /**< The devices of a batch that report_cb failed to take are kept as they are */
+    for (i = batch_begin; i < g_device_num; ++i) {
+        g_device_list[device_num++] = g_device_list[i];
+    }
+
+    /**< Rebuild the index over the devices that are kept */
+    mlink_sniffer_table_clear();
+
+    for (i = 0; i < device_num; ++i) {
+        uint32_t pos = sniffer_device_hash(g_device_list[i].record.type, g_device_list[i].record.addr)
+                       & (g_device_index_num - 1);
+
+        while (g_device_index[pos]) {
+            pos = (pos + 1) & (g_device_index_num - 1);
+        }
+
+        g_device_index[pos] = ++g_device_num;
+    }
+
+    xSemaphoreGive(g_sniffer_lock);
+
+    MDF_LOGD("sniffer report, seq: %d, batch_num: %d, device_num: %d", batch->seq, batch->index, device_num);
+
+    MDF_FREE(batch);
+
+    return ret;
+}
+
 mdf_err_t mlink_sniffer_wifi_start()
 {
     mdf_err_t ret = MDF_OK;
 
+    if (!g_wifi_ring) {
+        g_wifi_ring = sniffer_ring_create(offsetof(sniffer_record_t, adv), MLINK_SNIFFER_QUEUE_SIZE);
+        MDF_ERROR_CHECK(!g_wifi_ring, MDF_ERR_NO_MEM, "sniffer_ring_create");
+    }
+
     ret = esp_wifi_set_promiscuous_rx_cb(sniffer_wifi_cb);
     MDF_ERROR_CHECK(ret != ESP_OK, ret, "esp_wifi_set_promiscuous_rx_cb");
 
@@ -345,6 +762,11 @@ mdf_err_t mlink_sniffer_ble_start()
 {
     mdf_err_t ret = MDF_OK;
 
+    if (!g_ble_ring) {
+        g_ble_ring = sniffer_ring_create(sizeof(sniffer_record_t), MLINK_SNIFFER_QUEUE_SIZE);
+        MDF_ERROR_CHECK(!g_ble_ring, MDF_ERR_NO_MEM, "sniffer_ring_create");
+    }
+
     ret = mlink_ble_set_scan((uint16_t)(g_sniffer_config.ble_scan_interval * 1.6),
                              (uint16_t)g_sniffer_config.ble_scan_window * 1.6, mlink_sniffer_ble_cb);
     MDF_ERROR_CHECK(ret != ESP_OK, ret, "ble_set_scan");
@@ -367,15 +789,40 @@ mdf_err_t mlink_sniffer_ble_stop()
 }
 #endif
 
+/**
+ * @note The rings are never freed, the callbacks may still run for a while
+ *       after the sniffer is de-initialized
+ */
 mdf_err_t mlink_sniffer_init()
 {
-    if (!g_sniffer_list) {
-        g_sniffer_list = MDF_MALLOC(sizeof(sniffer_data_list_t));
-        g_sniffer_list->next = NULL;
-    }
+    mdf_err_t ret = MDF_OK;
 
     if (!g_sniffer_lock) {
-        g_sniffer_lock  = xSemaphoreCreateMutex();
+        g_sniffer_lock     = xSemaphoreCreateMutex();
+        g_sniffer_exit_sem = xSemaphoreCreateBinary();
+        sniffer_oui_table_init();
+    }
+
+    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+
+    if (!g_device_index) {
+        ret = mlink_sniffer_table_resize(g_sniffer_config.buffer_num);
+    }
+
+    xSemaphoreGive(g_sniffer_lock);
+
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_sniffer_table_resize, buffer_num: %d", g_sniffer_config.buffer_num);
+
+    if (!g_sniffer_running) {
+        g_sniffer_running = true;
+
+        if (xTaskCreatePinnedToCore(mlink_sniffer_task, "mlink_sniffer", 2 * 1024,
+                                    NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
+                                    &g_sniffer_task, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+            g_sniffer_running = false;
+            MDF_LOGE("Create the sniffer task");
+            return MDF_ERR_NO_MEM;
+        }
     }
 
     return MDF_OK;
@@ -387,15 +834,16 @@ mdf_err_t mlink_sniffer_deinit()
         return MDF_OK;
     }
 
-    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+    if (g_sniffer_running) {
+        g_sniffer_running = false;
+        xTaskNotifyGive(g_sniffer_task);
+        xSemaphoreTake(g_sniffer_exit_sem, portMAX_DELAY);
+    }
 
-    g_device_num = 0;
+    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
 
-    for (sniffer_data_list_t *sniffer_node = g_sniffer_list->next; sniffer_node;
-            sniffer_node = g_sniffer_list->next) {
-        g_sniffer_list->next = sniffer_node->next;
-        MDF_FREE(sniffer_node);
-    }
+    mlink_sniffer_drain();
+    mlink_sniffer_table_clear();
 
     xSemaphoreGive(g_sniffer_lock);
 
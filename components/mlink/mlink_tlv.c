@@ -0,0 +1,175 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mlink_tlv.h"
+
+#define MLINK_TLV_BUF_INIT_SIZE (32)
+
+static const char *TAG = "mlink_tlv";
+
+void mlink_tlv_buf_free(mlink_tlv_buf_t *buf)
+{
+    if (!buf) {
+        return;
+    }
+
+    MDF_FREE(buf->data);
+    buf->size     = 0;
+    buf->capacity = 0;
+}
+
+/**
+ * @brief Make sure there is room for size bytes behind the frame
+ */
+static void mlink_tlv_buf_reserve(mlink_tlv_buf_t *buf, size_t size)
+{
+    if (buf->size + size <= buf->capacity) {
+        return;
+    }
+
+    size_t capacity = MAX(MAX(buf->capacity * 2, MLINK_TLV_BUF_INIT_SIZE), buf->size + size);
+    buf->data       = MDF_REALLOC_RETRY(buf->data, capacity);
+    buf->capacity   = capacity;
+}
+
+mdf_err_t mlink_tlv_pack_request(mlink_tlv_buf_t *buf, uint16_t request)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_ERROR_CHECK(buf->size, MDF_ERR_INVALID_ARG, "The request must be written first");
+
+    mlink_tlv_buf_reserve(buf, MLINK_TLV_REQUEST_LEN);
+    buf->data[buf->size++] = request & 0xff;
+    buf->data[buf->size++] = request >> 8;
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_tlv_pack(mlink_tlv_buf_t *buf, uint8_t type, const void *value, size_t len)
+{
+    MDF_PARAM_CHECK(buf);
+    MDF_PARAM_CHECK(value || !len);
+    MDF_ERROR_CHECK(len > MLINK_TLV_VALUE_MAX_LEN, MDF_ERR_INVALID_ARG,
+                    "type: %d, len: %d, the maximum length: %d", type, len, MLINK_TLV_VALUE_MAX_LEN);
+
+    mlink_tlv_buf_reserve(buf, MLINK_TLV_HEAD_LEN + len);
+    buf->data[buf->size++] = type;
+    buf->data[buf->size++] = len;
+
+    if (len) {
+        memcpy(buf->data + buf->size, value, len);
+        buf->size += len;
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_tlv_pack_uint16(mlink_tlv_buf_t *buf, uint8_t type, uint16_t value)
+{
+    uint8_t value_le[2] = {value & 0xff, value >> 8};
+
+    return mlink_tlv_pack(buf, type, value_le, sizeof(value_le));
+}
+
+mdf_err_t mlink_tlv_pack_int32(mlink_tlv_buf_t *buf, uint8_t type, int32_t value)
+{
+    uint8_t value_le[4] = {0};
+
+    for (int i = 0; i < sizeof(value_le); ++i) {
+        value_le[i] = ((uint32_t)value >> (i * 8)) & 0xff;
+    }
+
+    return mlink_tlv_pack(buf, type, value_le, sizeof(value_le));
+}
+
+mdf_err_t mlink_tlv_pack_double(mlink_tlv_buf_t *buf, uint8_t type, double value)
+{
+    /**< The ESP32 is little endian, the IEEE 754 representation is copied as is */
+    return mlink_tlv_pack(buf, type, &value, sizeof(value));
+}
+
+mdf_err_t mlink_tlv_parse_request(const uint8_t *data, size_t size, uint16_t *request)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_PARAM_CHECK(request);
+    MDF_ERROR_CHECK(size < MLINK_TLV_REQUEST_LEN, MDF_ERR_INVALID_SIZE, "size: %d", size);
+
+    *request = data[0] | (data[1] << 8);
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_tlv_next(const uint8_t **data, size_t *size, mlink_tlv_t *tlv)
+{
+    MDF_PARAM_CHECK(data && *data);
+    MDF_PARAM_CHECK(size);
+    MDF_PARAM_CHECK(tlv);
+
+    if (!*size) {
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    MDF_ERROR_CHECK(*size < MLINK_TLV_HEAD_LEN || *size - MLINK_TLV_HEAD_LEN < (*data)[1],
+                    MDF_ERR_INVALID_SIZE, "The item is truncated, size: %d", *size);
+
+    tlv->type  = (*data)[0];
+    tlv->len   = (*data)[1];
+    tlv->value = *data + MLINK_TLV_HEAD_LEN;
+
+    *data += MLINK_TLV_HEAD_LEN + tlv->len;
+    *size -= MLINK_TLV_HEAD_LEN + tlv->len;
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_tlv_get_int32(const mlink_tlv_t *tlv, int32_t *value)
+{
+    MDF_PARAM_CHECK(tlv);
+    MDF_PARAM_CHECK(value);
+    MDF_ERROR_CHECK(!tlv->len || tlv->len > sizeof(int32_t), MDF_ERR_INVALID_SIZE,
+                    "type: %d, len: %d", tlv->type, tlv->len);
+
+    uint32_t value_u32 = 0;
+
+    for (int i = 0; i < tlv->len; ++i) {
+        value_u32 |= (uint32_t)tlv->value[i] << (i * 8);
+    }
+
+    /**< Sign extend the shorter integers */
+    if (tlv->len < sizeof(int32_t) && (tlv->value[tlv->len - 1] & 0x80)) {
+        value_u32 |= UINT32_MAX << (tlv->len * 8);
+    }
+
+    *value = (int32_t)value_u32;
+
+    return MDF_OK;
+}
+
+mdf_err_t mlink_tlv_get_double(const mlink_tlv_t *tlv, double *value)
+{
+    MDF_PARAM_CHECK(tlv);
+    MDF_PARAM_CHECK(value);
+
+    if (tlv->len == sizeof(double)) {
+        memcpy(value, tlv->value, sizeof(double));
+        return MDF_OK;
+    }
+
+    int32_t value_int = 0;
+    mdf_err_t ret = mlink_tlv_get_int32(tlv, &value_int);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "");
+
+    *value = value_int;
+
+    return MDF_OK;
+}
@@ -16,8 +16,12 @@
 #include "mwifi.h"
 #include "mlink_trigger.h"
 
-#define MLINK_TRIGGER_LIST_MAX_NUM 32
-#define MLINK_TRIGGER_STORE_KEY    "MLINK_TRIGGER"
+#define MLINK_TRIGGER_LIST_MAX_NUM CONFIG_MLINK_TRIGGER_MAX_NUM
+#define MLINK_TRIGGER_STORE_KEY    "MLINK_TRIGGER_2"
+#define MLINK_TRIGGER_STORE_KEY_V1 "MLINK_TRIGGER"   /**< Index of the triggers saved only as json */
+#define MLINK_TRIGGER_BIN_VERSION  (1)
+#define MLINK_TRIGGER_SYNC_MAX_LEN (96)             /**< Length of the set_status sent by a sync trigger */
+#define MLINK_TRIGGER_CID_MAX_NUM  (256) /**< trigger_cid is a uint8_t */
 
 /**
  * @brief Used to compare whether the trigger condition is met
@@ -68,22 +72,104 @@ typedef struct mlink_trigger {
     uint16_t raw_data_size;
     uint16_t addrs_num;
     uint8_t *addrs_list;
-    char *execute_content;
+    char *execute_content;   /**< The request sent to addrs_list, the start of it for sync */
+    uint16_t execute_size;   /**< Length of execute_content */
     struct mlink_trigger *next;
 } mlink_trigger_t;
 
 /**
- * @brief Store trigger function
+ * @brief Compiled form of a trigger saved in flash, it is followed by the
+ *        addresses and execute_content, so the json is not parsed at boot
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t trigger_cid;
+    uint8_t trigger_type;
+    uint8_t communicate_type;
+    int32_t trigger_params[3];
+    trigger_compare_t trigger_compare;
+    uint16_t addrs_num;
+    uint16_t execute_size;
+    char name[16];           /**< The key is a hash of the name, a collision is found by comparing it */
+} mlink_trigger_bin_t;
+
+/**
+ * @brief Store trigger function, the json of the trigger is saved with the name
+ *        as key for get_event, the compiled form with mlink_trigger_bin_key()
  */
 typedef struct {
     uint16_t size;
+    uint16_t bin_size;
     char name[16];
 } mlink_trigger_store_t;
 
+/**
+ * @brief Store trigger function of MLINK_TRIGGER_STORE_KEY_V1
+ */
+typedef struct {
+    uint16_t size;
+    char name[16];
+} mlink_trigger_store_v1_t;
+
 static const char *TAG                 = "mlink_trigger";
 static mlink_trigger_t *g_trigger_list = NULL;
+static size_t g_trigger_num            = 0;
+static SemaphoreHandle_t g_trigger_lock = NULL;
+
+/**
+ * @brief The characteristics whose value has changed since the last mlink_trigger_handle(), one bit per cid
+ */
+static uint32_t g_trigger_changed[MLINK_TRIGGER_CID_MAX_NUM / 32] = {0};
 extern mlink_characteristic_func_t mlink_device_get_value;
 
+static void mlink_trigger_free(mlink_trigger_t *trigger_item)
+{
+    MDF_FREE(trigger_item->addrs_list);
+    MDF_FREE(trigger_item->execute_content);
+    MDF_FREE(trigger_item);
+}
+
+/**
+ * @brief The triggers of a cid are kept next to each other, so that the
+ *        value of the cid is only read once by mlink_trigger_handle()
+ */
+static void mlink_trigger_insert(mlink_trigger_t *trigger_item)
+{
+    mlink_trigger_t *trigger_prior = g_trigger_list;
+
+    /**< Behind the last trigger of the same cid, or at the head if there is none */
+    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
+        if (trigger_idex->trigger_cid == trigger_item->trigger_cid) {
+            trigger_prior = trigger_idex;
+        } else if (trigger_prior != g_trigger_list) {
+            break;
+        }
+    }
+
+    trigger_item->next  = trigger_prior->next;
+    trigger_prior->next = trigger_item;
+    g_trigger_num++;
+}
+
+/**
+ * @brief Remove the trigger with the given name
+ *
+ * @return The removed trigger, NULL if there is no trigger with the name
+ */
+static mlink_trigger_t *mlink_trigger_unlink(const char *name)
+{
+    for (mlink_trigger_t *trigger_prior = g_trigger_list, *trigger_idex = g_trigger_list->next;
+            trigger_idex; trigger_prior = trigger_idex, trigger_idex = trigger_idex->next) {
+        if (!strcasecmp(trigger_idex->name, name)) {
+            trigger_prior->next = trigger_idex->next;
+            g_trigger_num--;
+            return trigger_idex;
+        }
+    }
+
+    return NULL;
+}
+
 static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
 {
     mdf_err_t ret                      = MDF_OK;
@@ -148,6 +234,12 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
         trigger_item->trigger_type = TRIGGER_SYNC;
         ret = mlink_json_parse(trigger_content_str, "execute_cid", (int *)trigger_item->trigger_params);
         MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
+
+        /**< Only the value is appended when the trigger fires */
+        ret = asprintf(&trigger_item->execute_content, "{\"request\":\"set_status\",\"characteristics\":[{\"cid\":%d,\"value\":",
+                       trigger_item->trigger_params[0]);
+        MDF_ERROR_GOTO(ret < 0, EXIT, "asprintf");
+        ret = MDF_OK;
     } else if (!strcasecmp(request_str, "linkage")) {
         trigger_item->trigger_type = TRIGGER_LINKAGE;
         ret = mlink_json_parse(raw_data, "execute_content", &trigger_item->execute_content);
@@ -158,6 +250,8 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
         goto EXIT;
     }
 
+    trigger_item->execute_size = strlen(trigger_item->execute_content);
+
     if (mlink_json_parse(raw_data, "communicate_type", communicate_str) == MDF_OK) {
         if (!strcasecmp(communicate_str, "group")) {
             trigger_item->communicate_type = MLINK_ESPNOW_COMMUNICATE_GROUP;
@@ -179,15 +273,163 @@ EXIT:
     return (ret == MDF_OK) ? trigger_item : NULL;
 }
 
+/**
+ * @brief The key of the compiled trigger, the name is used as the key of the json
+ */
+static char *mlink_trigger_bin_key(const char *name, char key[16])
+{
+    uint32_t hash = 2166136261; /**< FNV-1a */
+
+    for (const char *p = name; *p; ++p) {
+        hash = (hash ^ (uint8_t)*p) * 16777619;
+    }
+
+    snprintf(key, 16, "MLTRG_%08x", hash);
+
+    return key;
+}
+
+static size_t mlink_trigger_bin_size(const mlink_trigger_t *trigger_item)
+{
+    return sizeof(mlink_trigger_bin_t) + trigger_item->addrs_num * MWIFI_ADDR_LEN + trigger_item->execute_size;
+}
+
+static mdf_err_t mlink_trigger_bin_save(const mlink_trigger_t *trigger_item)
+{
+    mdf_err_t ret   = MDF_OK;
+    char key[16]    = {0};
+    size_t bin_size = mlink_trigger_bin_size(trigger_item);
+    mlink_trigger_bin_t *bin = MDF_CALLOC(1, bin_size);
+    MDF_ERROR_CHECK(!bin, MDF_ERR_NO_MEM, "");
+
+    bin->version          = MLINK_TRIGGER_BIN_VERSION;
+    bin->trigger_cid      = trigger_item->trigger_cid;
+    bin->trigger_type     = trigger_item->trigger_type;
+    bin->communicate_type = trigger_item->communicate_type;
+    bin->trigger_compare  = trigger_item->trigger_compare;
+    bin->addrs_num        = trigger_item->addrs_num;
+    bin->execute_size     = trigger_item->execute_size;
+    strncpy(bin->name, trigger_item->name, sizeof(bin->name) - 1);
+
+    for (int i = 0; i < 3; ++i) {
+        bin->trigger_params[i] = trigger_item->trigger_params[i];
+    }
+
+    memcpy(bin + 1, trigger_item->addrs_list, trigger_item->addrs_num * MWIFI_ADDR_LEN);
+    memcpy((uint8_t *)(bin + 1) + trigger_item->addrs_num * MWIFI_ADDR_LEN,
+           trigger_item->execute_content, trigger_item->execute_size);
+
+    ret = mdf_info_save(mlink_trigger_bin_key(trigger_item->name, key), bin, bin_size);
+    MDF_FREE(bin);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Save the compiled trigger, name: %s", trigger_item->name);
+
+    return MDF_OK;
+}
+
+static mlink_trigger_t *mlink_trigger_bin_load(const char *name, size_t bin_size)
+{
+    mdf_err_t ret = MDF_OK;
+    char key[16]  = {0};
+    mlink_trigger_t *trigger_item = NULL;
+    mlink_trigger_bin_t *bin      = NULL;
+
+    MDF_ERROR_CHECK(bin_size < sizeof(mlink_trigger_bin_t), NULL, "");
+
+    bin = MDF_MALLOC(bin_size);
+    MDF_ERROR_CHECK(!bin, NULL, "");
+
+    ret = mdf_info_load(mlink_trigger_bin_key(name, key), bin, bin_size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Load the compiled trigger, name: %s", mdf_err_to_name(ret), name);
+
+    bin->name[sizeof(bin->name) - 1] = '\0';
+    ret = (bin->version == MLINK_TRIGGER_BIN_VERSION && !strcasecmp(bin->name, name)
+           && sizeof(mlink_trigger_bin_t) + bin->addrs_num * MWIFI_ADDR_LEN + bin->execute_size == bin_size) ? MDF_OK : MDF_FAIL;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "The compiled trigger is invalid, name: %s", name);
+
+    ret = MDF_ERR_NO_MEM;
+    trigger_item = MDF_CALLOC(1, sizeof(mlink_trigger_t));
+    MDF_ERROR_GOTO(!trigger_item, EXIT, "");
+    trigger_item->addrs_list      = MDF_MALLOC(bin->addrs_num * MWIFI_ADDR_LEN + 1);
+    trigger_item->execute_content = MDF_MALLOC(bin->execute_size + 1);
+    MDF_ERROR_GOTO(!trigger_item->addrs_list || !trigger_item->execute_content, EXIT, "");
+
+    strncpy(trigger_item->name, bin->name, sizeof(trigger_item->name) - 1);
+    trigger_item->trigger_cid      = bin->trigger_cid;
+    trigger_item->trigger_type     = bin->trigger_type;
+    trigger_item->communicate_type = bin->communicate_type;
+    trigger_item->trigger_compare  = bin->trigger_compare;
+    trigger_item->addrs_num        = bin->addrs_num;
+    trigger_item->execute_size     = bin->execute_size;
+
+    for (int i = 0; i < 3; ++i) {
+        trigger_item->trigger_params[i] = bin->trigger_params[i];
+    }
+
+    memcpy(trigger_item->addrs_list, bin + 1, bin->addrs_num * MWIFI_ADDR_LEN);
+    memcpy(trigger_item->execute_content, (uint8_t *)(bin + 1) + bin->addrs_num * MWIFI_ADDR_LEN, bin->execute_size);
+    trigger_item->execute_content[bin->execute_size] = '\0';
+    trigger_item->trigger_compare.value = -1;
+    ret = MDF_OK;
+
+EXIT:
+
+    if (ret != MDF_OK && trigger_item) {
+        mlink_trigger_free(trigger_item);
+        trigger_item = NULL;
+    }
+
+    MDF_FREE(bin);
+    return trigger_item;
+}
+
+/**
+ * @brief Load a trigger, the json is only parsed if the compiled form is missing
+ *        or invalid, the compiled form is saved again in that case
+ */
+static mlink_trigger_t *mlink_trigger_load(const char *name, size_t size, size_t bin_size)
+{
+    mdf_err_t ret                 = MDF_OK;
+    char *trigger_raw_data        = NULL;
+    mlink_trigger_t *trigger_item = NULL;
+
+    trigger_item = bin_size ? mlink_trigger_bin_load(name, bin_size) : NULL;
+
+    if (trigger_item) {
+        trigger_item->raw_data_size = size;
+        return trigger_item;
+    }
+
+    trigger_raw_data = MDF_CALLOC(1, size);
+    MDF_ERROR_CHECK(!trigger_raw_data, NULL, "");
+
+    ret = mdf_info_load(name, trigger_raw_data, size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Load the information", mdf_err_to_name(ret));
+
+    trigger_item = mlink_trigger_parse(trigger_raw_data);
+    MDF_ERROR_GOTO(!trigger_item, EXIT, "mlink_trigger_parse");
+
+    mlink_trigger_bin_save(trigger_item);
+
+EXIT:
+    MDF_FREE(trigger_raw_data);
+    return trigger_item;
+}
+
 mdf_err_t mlink_trigger_store_update()
 {
     mdf_err_t ret   = MDF_OK;
     int trigger_num = 0;
-    mlink_trigger_store_t *trigger_store = MDF_CALLOC(MLINK_TRIGGER_LIST_MAX_NUM, sizeof(mlink_trigger_store_t));
+    mlink_trigger_store_t *trigger_store = NULL;
+
+    if (g_trigger_num > 0) {
+        trigger_store = MDF_CALLOC(g_trigger_num, sizeof(mlink_trigger_store_t));
+        MDF_ERROR_CHECK(!trigger_store, MDF_ERR_NO_MEM, "");
+    }
 
     for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next, trigger_num++) {
         strncpy(trigger_store[trigger_num].name, trigger_idex->name, sizeof(trigger_store[trigger_num].name));
-        trigger_store[trigger_num].size = trigger_idex->raw_data_size;
+        trigger_store[trigger_num].size     = trigger_idex->raw_data_size;
+        trigger_store[trigger_num].bin_size = mlink_trigger_bin_size(trigger_idex);
     }
 
     if (trigger_num > 0) {
@@ -204,28 +446,31 @@ mdf_err_t mlink_trigger_store_update()
 
 static mdf_err_t mlink_handle_get_trigger(mlink_handle_data_t *handle_data)
 {
-    mdf_err_t ret      = ESP_OK;
-    char *trigger_json = NULL;
-    char *raw_data     = NULL;
+    mdf_err_t ret                = ESP_OK;
+    mlink_json_buf_t trigger_json = {0};
+    mlink_json_buf_t resp        = {0};
+    char *raw_data               = NULL;
 
     for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
         raw_data = MDF_MALLOC(trigger_idex->raw_data_size);
         ret = mdf_info_load(trigger_idex->name, raw_data, trigger_idex->raw_data_size);
         MDF_ERROR_GOTO(ret != MDF_OK, EXIT, " Load the information");
 
-        mlink_json_pack(&trigger_json, "[]", raw_data);
+        mlink_json_buf_pack(&trigger_json, "[]", raw_data);
         MDF_FREE(raw_data);
     }
 
-    if (!trigger_json) {
+    if (!trigger_json.size) {
         return MDF_OK;
     }
 
-    handle_data->resp_size = mlink_json_pack(&handle_data->resp_data, "trigger", trigger_json);
+    mlink_json_buf_pack_raw(&resp, "trigger", trigger_json.data, trigger_json.size);
+    handle_data->resp_data = resp.data;
+    handle_data->resp_size = resp.size;
 
 EXIT:
     MDF_FREE(raw_data);
-    MDF_FREE(trigger_json);
+    mlink_json_buf_free(&trigger_json);
     return ret;
 }
 
@@ -235,34 +480,41 @@ mdf_err_t mlink_trigger_add(const char *trigger_raw_data)
     MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
 
     mdf_err_t ret = MDF_OK;
-    mlink_trigger_t *trigger_list = g_trigger_list;
     mlink_trigger_t *trigger_item = NULL;
+    mlink_trigger_t *trigger_old  = NULL;
 
     trigger_item = mlink_trigger_parse(trigger_raw_data);
     MDF_ERROR_CHECK(!trigger_item, MDF_FAIL, "mlink_trigger_parse");
 
-    for (mlink_trigger_t *trigger_idex = trigger_list->next; trigger_idex;
-            trigger_list = trigger_idex, trigger_idex = trigger_idex->next) {
-        if (!strcasecmp(trigger_idex->name, trigger_item->name)) {
-            MDF_LOGD("remove event: %s", trigger_idex->name);
-            ret = mdf_info_erase(trigger_idex->name);
-            MDF_ERROR_CONTINUE(ret != MDF_OK, "mdf_info_erase, ret: %d", ret);
-
-            trigger_list->next = trigger_idex->next;
-            MDF_FREE(trigger_idex->addrs_list);
-            MDF_FREE(trigger_idex->execute_content);
-            MDF_FREE(trigger_idex);
-            trigger_idex = trigger_list;
-            break;
-        }
+    trigger_old = mlink_trigger_unlink(trigger_item->name);
+
+    if (trigger_old) {
+        MDF_LOGD("remove event: %s", trigger_old->name);
+        ret = mdf_info_erase(trigger_old->name);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdf_info_erase, ret: %d", ret);
+        mlink_trigger_free(trigger_old);
     }
 
-    trigger_item->next   = g_trigger_list->next;
-    g_trigger_list->next = trigger_item;
+    /**< The compiled form of a trigger with the same name is overwritten below */
+
+    if (g_trigger_num >= MLINK_TRIGGER_LIST_MAX_NUM) {
+        MDF_LOGW("The number of triggers reaches the limit: %d", MLINK_TRIGGER_LIST_MAX_NUM);
+        mlink_trigger_free(trigger_item);
+        return MDF_ERR_NOT_SUPPORTED;
+    }
+
+    mlink_trigger_insert(trigger_item);
 
     ret = mdf_info_save(trigger_item->name, trigger_raw_data, strlen(trigger_raw_data) + 1);
     MDF_ERROR_CHECK(ret < 0, ret, "Save the information");
 
+    /**< The compiled form is only a cache of the json, the trigger is compiled from
+         the json at boot if it fails to load, but a stale one must not be left */
+    if (mlink_trigger_bin_save(trigger_item) != MDF_OK) {
+        char key[16] = {0};
+        mdf_info_erase(mlink_trigger_bin_key(trigger_item->name, key));
+    }
+
     ret = mlink_trigger_store_update();
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_store_update");
 
@@ -273,24 +525,35 @@ static mdf_err_t mlink_handle_set_trigger(mlink_handle_data_t *handle_data)
 {
     mdf_err_t ret   = MDF_OK;
     int trigger_num = 0;
-    char *trigger_raw_data[MLINK_TRIGGER_LIST_MAX_NUM] = {NULL};
+    char **trigger_raw_data = NULL;
 
     ret = mlink_json_parse(handle_data->req_data, "events", &trigger_num);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    MDF_ERROR_CHECK(trigger_num <= 0, MDF_ERR_INVALID_ARG, "No events");
+
+    trigger_raw_data = MDF_CALLOC(trigger_num, sizeof(char *));
+    MDF_ERROR_CHECK(!trigger_raw_data, MDF_ERR_NO_MEM, "");
 
     ret = mlink_json_parse(handle_data->req_data, "events", trigger_raw_data);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Parse the json formatted string");
 
     for (int i = 0; i < trigger_num; ++i) {
         ret = mlink_trigger_add(trigger_raw_data[i]);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_add");
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_add");
 
         MDF_LOGD("mlink_handle_set_trigger success");
     }
 
     mdf_event_loop_send(MDF_EVENT_MLINK_SET_TRIGGER, NULL);
 
-    return MDF_OK;
+EXIT:
+
+    for (int i = 0; i < trigger_num; ++i) {
+        MDF_FREE(trigger_raw_data[i]);
+    }
+
+    MDF_FREE(trigger_raw_data);
+    return ret;
 }
 
 static mdf_err_t mlink_handle_remove_trigger(mlink_handle_data_t *handle_data)
@@ -298,114 +561,185 @@ static mdf_err_t mlink_handle_remove_trigger(mlink_handle_data_t *handle_data)
     mdf_err_t ret         = ESP_OK;
     char trigger_name[16] = {0};
     int trigger_num       = 0;
-    char *trigger_list[MLINK_TRIGGER_LIST_MAX_NUM] = {0};
+    char **trigger_list   = NULL;
 
     ret = mlink_json_parse(handle_data->req_data, "events", &trigger_num);
     MDF_ERROR_CHECK(ret < 0, ret, "Parse the json formatted string");
+    MDF_ERROR_CHECK(trigger_num <= 0, MDF_ERR_INVALID_ARG, "No events");
+
+    trigger_list = MDF_CALLOC(trigger_num, sizeof(char *));
+    MDF_ERROR_CHECK(!trigger_list, MDF_ERR_NO_MEM, "");
 
     ret = mlink_json_parse(handle_data->req_data, "events", trigger_list);
-    MDF_ERROR_CHECK(ret < 0, ret, "Parse the json formatted string");
+    MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
 
     for (int i = 0; i < trigger_num; ++i) {
         ret = mlink_json_parse(trigger_list[i], "name", trigger_name);
-        MDF_FREE(trigger_list[i]);
         MDF_ERROR_CONTINUE(ret < 0, "Parse the json formatted string");
 
-        mlink_trigger_t *trigger_idex_prior = g_trigger_list;
-
-        for (mlink_trigger_t *trigger_idex = trigger_idex_prior->next; trigger_idex;
-                trigger_idex_prior = trigger_idex, trigger_idex = trigger_idex->next) {
-            if (!strcasecmp(trigger_idex->name, trigger_name)) {
-                MDF_LOGD("remove event: %s", trigger_idex->name);
-                ret = mdf_info_erase(trigger_idex->name);
-                MDF_ERROR_CHECK(ret < 0, ESP_FAIL, "mdf_info_erase, ret: %d", ret);
-
-                trigger_idex_prior->next = trigger_idex->next;
-                MDF_FREE(trigger_idex->addrs_list);
-                MDF_FREE(trigger_idex->execute_content);
-                MDF_FREE(trigger_idex);
-                trigger_idex = trigger_idex_prior;
-                break;
-            }
+        mlink_trigger_t *trigger_item = mlink_trigger_unlink(trigger_name);
+
+        if (trigger_item) {
+            char key[16] = {0};
+
+            MDF_LOGD("remove event: %s", trigger_item->name);
+            mdf_info_erase(mlink_trigger_bin_key(trigger_item->name, key));
+            ret = mdf_info_erase(trigger_item->name);
+            mlink_trigger_free(trigger_item);
+            MDF_ERROR_GOTO(ret < 0, EXIT, "mdf_info_erase, ret: %d", ret);
         }
     }
 
     ret = mlink_trigger_store_update();
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_store_update");
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_store_update");
 
-    return ESP_OK;
+EXIT:
+
+    for (int i = 0; i < trigger_num; ++i) {
+        MDF_FREE(trigger_list[i]);
+    }
+
+    MDF_FREE(trigger_list);
+    return ret;
+}
+
+mdf_err_t mlink_trigger_notify(uint16_t cid)
+{
+    /**< Called for every value that is set, applications without triggers are not an error */
+    if (!g_trigger_lock) {
+        return MDF_ERR_NOT_INIT;
+    }
+
+    if (cid >= MLINK_TRIGGER_CID_MAX_NUM) {
+        return MDF_OK;
+    }
+
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+    g_trigger_changed[cid / 32] |= (1U << (cid % 32));
+    xSemaphoreGive(g_trigger_lock);
+
+    return MDF_OK;
 }
 
 mdf_err_t mlink_trigger_handle(mlink_communicate_t communicate)
 {
     mdf_err_t ret = ESP_OK;
     int value     = -1;
+    int value_cid = -1;
+    mdf_err_t value_ret = MDF_FAIL;
+    uint32_t changed[MLINK_TRIGGER_CID_MAX_NUM / 32] = {0};
 
     MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
 
-    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
-        trigger_compare_t *cmp = &trigger_idex->trigger_compare;
-        ret = mlink_device_get_value(trigger_idex->trigger_cid, &value);
-        MDF_ERROR_CONTINUE(ret < 0, "<%s> mlink_device_get_value, cid: %d", mdf_err_to_name(ret), trigger_idex->trigger_cid);
-
-        bool equal        = (!cmp->flag.equal        || (cmp->flag.equal        && cmp->equal == value)) ? true       : false;
-        bool unequal      = (!cmp->flag.unequal      || (cmp->flag.unequal      && cmp->unequal != value)) ? true     : false;
-        bool greater_than = (!cmp->flag.greater_than || (cmp->flag.greater_than && cmp->greater_than < value)) ? true : false;
-        bool less_than    = (!cmp->flag.less_than    || (cmp->flag.less_than    && cmp->less_than > value)) ? true    : false;
-        bool variation    = (!cmp->flag.variation    || (cmp->flag.variation    && cmp->variation <= abs(value - cmp->value))) ? true : false;
-        bool rising       = (!cmp->flag.rising       || (cmp->flag.rising       && (value - cmp->value >= variation))) ? true : false;
-        bool falling      = (!cmp->flag.falling      || (cmp->flag.falling      && (cmp->value - value >= variation))) ? true : false;
-
-        MDF_LOGD("name: %s, cid: %d, value: %d, trigger_type: %d, variation: %d, trigger: %d, rising: %d",
-                 trigger_idex->name, trigger_idex->trigger_cid, value,
-                 trigger_idex->trigger_type, variation, cmp->value, cmp->rising);
-
-        if (trigger_idex->trigger_type == TRIGGER_SYNC) {
-            if (cmp->value == value) {
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MLINK_TRIGGER_CID_MAX_NUM / 32; ++i) {
+        changed[i] = g_trigger_changed[i];
+        g_trigger_changed[i] = 0;
+    }
+
+    xSemaphoreGive(g_trigger_lock);
+
+    /**
+     * @brief The triggers of the characteristics notified by mlink_trigger_notify() are
+     *        evaluated first, then the others, whose values may have been changed by the
+     *        application without notifying them. With CONFIG_MLINK_TRIGGER_NOTIFY_ONLY,
+     *        the application notifies every change and only the first pass is done
+     */
+#ifdef CONFIG_MLINK_TRIGGER_NOTIFY_ONLY
+    const int pass_num = 1;
+#else
+    const int pass_num = 2;
+#endif /**< CONFIG_MLINK_TRIGGER_NOTIFY_ONLY */
+
+    for (int pass = 0; pass < pass_num; ++pass) {
+        for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
+            trigger_compare_t *cmp = &trigger_idex->trigger_compare;
+
+            bool notified = changed[trigger_idex->trigger_cid / 32] & (1U << (trigger_idex->trigger_cid % 32));
+
+            if (notified != (pass == 0)) {
                 continue;
             }
 
-            asprintf(&trigger_idex->execute_content, "{\"request\":\"set_status\",\"characteristics\":[{\"cid\":%d,\"value\":%d}]}",
-                     trigger_idex->trigger_params[0], value);
-        }
+            /**< The triggers of a cid are next to each other, the value is read once for all of them */
+            if (trigger_idex->trigger_cid != value_cid) {
+                value_cid = trigger_idex->trigger_cid;
+                value_ret = mlink_device_get_value(value_cid, &value);
+            }
 
-        cmp->value = value;
+            ret = value_ret;
+            MDF_ERROR_CONTINUE(ret < 0, "<%s> mlink_device_get_value, cid: %d", mdf_err_to_name(ret), trigger_idex->trigger_cid);
 
-        if (!equal || !unequal || !greater_than || !less_than || !variation || !rising || !falling) {
-            continue;
-        }
+            bool equal        = (!cmp->flag.equal        || (cmp->flag.equal        && cmp->equal == value)) ? true       : false;
+            bool unequal      = (!cmp->flag.unequal      || (cmp->flag.unequal      && cmp->unequal != value)) ? true     : false;
+            bool greater_than = (!cmp->flag.greater_than || (cmp->flag.greater_than && cmp->greater_than < value)) ? true : false;
+            bool less_than    = (!cmp->flag.less_than    || (cmp->flag.less_than    && cmp->less_than > value)) ? true    : false;
+            bool variation    = (!cmp->flag.variation    || (cmp->flag.variation    && cmp->variation <= abs(value - cmp->value))) ? true : false;
+            bool rising       = (!cmp->flag.rising       || (cmp->flag.rising       && (value - cmp->value >= variation))) ? true : false;
+            bool falling      = (!cmp->flag.falling      || (cmp->flag.falling      && (cmp->value - value >= variation))) ? true : false;
+
+            MDF_LOGD("name: %s, cid: %d, value: %d, trigger_type: %d, variation: %d, trigger: %d, rising: %d",
+                     trigger_idex->name, trigger_idex->trigger_cid, value,
+                     trigger_idex->trigger_type, variation, cmp->value, cmp->rising);
 
-        if (communicate == MLINK_COMMUNICATE_MESH) {
-            mwifi_data_type_t data_type  = {
-                .protocol = MLINK_PROTO_HTTPD,
-                .group    = (trigger_idex->communicate_type == MLINK_ESPNOW_COMMUNICATE_GROUP) ? true : false,
-            };
-            mlink_httpd_type_t httpd_type = {
-                .format = MLINK_HTTPD_FORMAT_JSON,
-                .from   = MLINK_HTTPD_FROM_DEVICE,
-                .resp   = false,
-            };
-
-            memcpy(&data_type.custom, &httpd_type, sizeof(mlink_httpd_type_t));
-
-            for (int i = 0; i < trigger_idex->addrs_num; ++i) {
-                ret = mwifi_write(trigger_idex->addrs_list + 6 * i, &data_type,
-                                  trigger_idex->execute_content, strlen(trigger_idex->execute_content), true);
+            if (trigger_idex->trigger_type == TRIGGER_SYNC && cmp->value == value) {
+                continue;
             }
-        } else if (communicate == MLINK_COMMUNICATE_ESPNOW) {
-            ret = mlink_espnow_write(trigger_idex->addrs_list, trigger_idex->addrs_num, trigger_idex->execute_content,
-                                     strlen(trigger_idex->execute_content), trigger_idex->communicate_type, portMAX_DELAY);
-        }
 
-        MDF_LOGD("addrs_num: %d, addrs_list: " MACSTR ", execute_content: %s",
-                 trigger_idex->addrs_num, MAC2STR(trigger_idex->addrs_list),
-                 trigger_idex->execute_content);
+            cmp->value = value;
 
-        if (trigger_idex->trigger_type == TRIGGER_SYNC) {
-            MDF_FREE(trigger_idex->execute_content);
-        }
+            if (!equal || !unequal || !greater_than || !less_than || !variation || !rising || !falling) {
+                continue;
+            }
+
+            const char *execute_content = trigger_idex->execute_content;
+            size_t execute_size         = trigger_idex->execute_size;
+            char sync_content[MLINK_TRIGGER_SYNC_MAX_LEN];
+
+            if (trigger_idex->trigger_type == TRIGGER_SYNC) {
+                ret = snprintf(sync_content, sizeof(sync_content), "%s%d}]}", trigger_idex->execute_content, value);
+                MDF_ERROR_CONTINUE(ret < 0 || ret >= (int)sizeof(sync_content), "The content of the sync trigger is too long");
+                execute_content = sync_content;
+                execute_size    = ret;
+                ret             = MDF_OK;
+            }
 
-        MDF_ERROR_CHECK(ret != ESP_OK, ret, "mlink_espnow_write");
+            if (communicate == MLINK_COMMUNICATE_MESH) {
+                mwifi_data_type_t data_type  = {
+                    .protocol = MLINK_PROTO_HTTPD,
+                    .group    = (trigger_idex->communicate_type == MLINK_ESPNOW_COMMUNICATE_GROUP) ? true : false,
+                };
+                mlink_httpd_type_t httpd_type = {
+                    .format = MLINK_HTTPD_FORMAT_JSON,
+                    .from   = MLINK_HTTPD_FROM_DEVICE,
+                    .resp   = false,
+                };
+
+                memcpy(&data_type.custom, &httpd_type, sizeof(mlink_httpd_type_t));
+
+                if (esp_mesh_is_root() && !data_type.group && trigger_idex->addrs_num > 1) {
+                    /**< The root sends one packet to all the addresses */
+                    data_type.communicate = MWIFI_COMMUNICATE_MULTICAST;
+                    ret = mwifi_root_write(trigger_idex->addrs_list, trigger_idex->addrs_num, &data_type,
+                                           execute_content, execute_size, true);
+                } else {
+                    for (int i = 0; i < trigger_idex->addrs_num; ++i) {
+                        ret = mwifi_write(trigger_idex->addrs_list + 6 * i, &data_type,
+                                          execute_content, execute_size, true);
+                    }
+                }
+            } else if (communicate == MLINK_COMMUNICATE_ESPNOW) {
+                ret = mlink_espnow_write(trigger_idex->addrs_list, trigger_idex->addrs_num, execute_content,
+                                         execute_size, trigger_idex->communicate_type, portMAX_DELAY);
+            }
+
+            MDF_LOGD("addrs_num: %d, addrs_list: " MACSTR ", execute_content: %.*s",
+                     trigger_idex->addrs_num, MAC2STR(trigger_idex->addrs_list),
+                     (int)execute_size, execute_content);
+
+            MDF_ERROR_CHECK(ret != ESP_OK, ret, "mlink_espnow_write");
+        }
     }
 
     return MDF_OK;
@@ -417,30 +751,42 @@ mdf_err_t mlink_trigger_init()
         return MDF_OK;
     }
 
-    mdf_err_t ret                 = MDF_OK;
-    g_trigger_list                = MDF_CALLOC(1, sizeof(mlink_trigger_t));
-    char *trigger_raw_data        = NULL;
     mlink_trigger_t *trigger_item = NULL;
+    g_trigger_list                = MDF_CALLOC(1, sizeof(mlink_trigger_t));
+    g_trigger_lock                = xSemaphoreCreateMutex();
     mlink_trigger_store_t *trigger_store = MDF_CALLOC(MLINK_TRIGGER_LIST_MAX_NUM, sizeof(mlink_trigger_store_t));
+    mlink_trigger_store_v1_t *trigger_store_v1 = NULL;
 
     if (mdf_info_load(MLINK_TRIGGER_STORE_KEY, trigger_store,
                       MLINK_TRIGGER_LIST_MAX_NUM * sizeof(mlink_trigger_store_t)) == MDF_OK) {
         for (int i = 0; i < MLINK_TRIGGER_LIST_MAX_NUM && trigger_store[i].size; ++i) {
-            MDF_FREE(trigger_raw_data);
-            trigger_raw_data = MDF_CALLOC(1, trigger_store[i].size);
-            ret = mdf_info_load(trigger_store[i].name, trigger_raw_data, trigger_store[i].size);
-            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Load the information", mdf_err_to_name(ret));
+            trigger_item = mlink_trigger_load(trigger_store[i].name, trigger_store[i].size, trigger_store[i].bin_size);
+            MDF_ERROR_CONTINUE(!trigger_item, "mlink_trigger_load, name: %s", trigger_store[i].name);
+
+            mlink_trigger_insert(trigger_item);
+        }
+    } else {
+        /**< Compile the triggers saved by an older firmware once */
+        trigger_store_v1 = MDF_CALLOC(MLINK_TRIGGER_LIST_MAX_NUM, sizeof(mlink_trigger_store_v1_t));
 
-            trigger_item = mlink_trigger_parse(trigger_raw_data);
-            MDF_ERROR_CONTINUE(!trigger_item, "<%s> mlink_trigger_parse", mdf_err_to_name(ret));
+        if (trigger_store_v1 && mdf_info_load(MLINK_TRIGGER_STORE_KEY_V1, trigger_store_v1,
+                                              MLINK_TRIGGER_LIST_MAX_NUM * sizeof(mlink_trigger_store_v1_t)) == MDF_OK) {
+            for (int i = 0; i < MLINK_TRIGGER_LIST_MAX_NUM && trigger_store_v1[i].size; ++i) {
+                trigger_item = mlink_trigger_load(trigger_store_v1[i].name, trigger_store_v1[i].size, 0);
+                MDF_ERROR_CONTINUE(!trigger_item, "mlink_trigger_load, name: %s", trigger_store_v1[i].name);
 
-            trigger_item->next   = g_trigger_list->next;
-            g_trigger_list->next = trigger_item;
+                mlink_trigger_insert(trigger_item);
+            }
+
+            if (mlink_trigger_store_update() == MDF_OK) {
+                mdf_info_erase(MLINK_TRIGGER_STORE_KEY_V1);
+            }
         }
+
+        MDF_FREE(trigger_store_v1);
     }
 
     MDF_FREE(trigger_store);
-    MDF_FREE(trigger_raw_data);
 
     mlink_set_handle("set_event", mlink_handle_set_trigger);
     mlink_set_handle("get_event", mlink_handle_get_trigger);
@@ -60,25 +60,83 @@ extern "C" {
  */
 #define MUPGRADE_GET_BITS(data, bits)        ( ((data)[(bits) >> 0x3]) & ( 1 << ((bits) & 0x7)) )
 #define MUPGRADE_SET_BITS(data, bits)        do { ((data)[(bits) >> 0x3]) |= ( 1 << ((bits) & 0x7)); } while(0);
+#define MUPGRADE_CLEAR_BITS(data, bits)      do { ((data)[(bits) >> 0x3]) &= ~( 1 << ((bits) & 0x7)); } while(0);
 
 /**
  * @brief Type of packet
  */
 #define MUPGRADE_TYPE_DATA                   (0x1)
 #define MUPGRADE_TYPE_STATUS                 (0x2)
+#define MUPGRADE_TYPE_PARITY                 (0x3)
+#define MUPGRADE_TYPE_RELAY                  (0x4)
+#define MUPGRADE_TYPE_DEFLATE                (0x5)
+#define MUPGRADE_TYPE_DELTA                  (0x6)
+
+/**
+ * @brief Maximum number of packets compressed together, a flash sector. The zlib stream
+ *        is sent in fewer MUPGRADE_TYPE_DEFLATE fragments than the packets it replaces
+ */
+#define MUPGRADE_DEFLATE_PACKET_NUM          (4)
+#define MUPGRADE_DEFLATE_FRAGMENT_MAX_NUM    (MUPGRADE_DEFLATE_PACKET_NUM - 1)
+
+/**
+ * @brief Delta update, the firmware sent is a patch against the running app
+ *
+ * @note A patch is generated by tools/gen_mupgrade_delta.py, it starts with
+ *       mupgrade_delta_head_t followed by commands, all numbers are little endian.
+ *       A command is mupgrade_delta_cmd_t, followed by size bytes of data for
+ *       MUPGRADE_DELTA_CMD_INSERT, the outputs of the commands are concatenated
+ *       into the new image.
+ *
+ *       The patch is written at MUPGRADE_DELTA_OFFSET of the update partition and
+ *       the new image is rebuilt at the start of the partition once it is complete.
+ *       The root requests the status with MUPGRADE_TYPE_DELTA instead of
+ *       MUPGRADE_TYPE_STATUS, devices that do not support it do not respond.
+ */
+#define MUPGRADE_DELTA_MAGIC                 (0x4450554d) /**< "MUPD" */
+#define MUPGRADE_DELTA_CMD_COPY              (0x1) /**< Copy size bytes of the running app from offset */
+#define MUPGRADE_DELTA_CMD_INSERT            (0x2) /**< Insert the size bytes that follow the command */
+#define MUPGRADE_DELTA_OFFSET(partition_size, patch_size) \
+    (((partition_size) - (patch_size)) & ~(SPI_FLASH_SEC_SIZE - 1))
 
 /**
  * @brief Firmware packet
+ *
+ * @note For MUPGRADE_TYPE_PARITY, seq is the first packet of a block, size is the number
+ *       of packets in the block and data is the XOR of these packets, each padded with
+ *       zeros to MUPGRADE_PACKET_MAX_SIZE. It is sent when CONFIG_MUPGRADE_FEC_BLOCK_SIZE
+ *       is not 0 and lets a device rebuild one packet of the block that it has lost.
  */
 typedef struct {
-    uint8_t type;   /**< Type of packet, MUPGRADE_TYPE_DATA */
+    uint8_t type;   /**< Type of packet, MUPGRADE_TYPE_DATA or MUPGRADE_TYPE_PARITY */
     uint16_t seq;   /**< Sequence */
     uint16_t size;  /**< Size */
     uint8_t data[MUPGRADE_PACKET_MAX_SIZE]; /**< Firmware */
 }  __attribute__((packed)) mupgrade_packet_t;
 
+/**
+ * @brief Fragment of compressed firmware packets
+ *
+ * @note The zlib stream of the packets from seq, a multiple of MUPGRADE_DEFLATE_PACKET_NUM,
+ *       is split into fragments of MUPGRADE_PACKET_MAX_SIZE, the last one may be shorter.
+ *       A device inflates the stream once it has all the fragments. Only the header and
+ *       the data of a fragment are sent.
+ */
+typedef struct {
+    uint8_t type;           /**< Type of packet, MUPGRADE_TYPE_DEFLATE */
+    uint16_t seq;           /**< Sequence of the first compressed packet */
+    uint16_t size;          /**< Length of data */
+    uint8_t packet_num;     /**< Number of the compressed packets */
+    uint8_t fragment_index; /**< Index of the fragment in the stream */
+    uint8_t fragment_num;   /**< Number of the fragments of the stream */
+    uint8_t data[MUPGRADE_PACKET_MAX_SIZE]; /**< Part of the zlib stream */
+}  __attribute__((packed)) mupgrade_deflate_t;
+
 /**
  * @brief Status packet
+ *
+ * @note A device that is able to relay the firmware appends the station address of
+ *       its parent to the status it responds, the root uses it to find the relay of a device.
  */
 typedef struct {
     uint8_t type;              /**< Type of packet, MUPGRADE_TYPE_STATUS */
@@ -89,6 +147,39 @@ typedef struct {
     uint8_t progress_array[0]; /**< Identify if each packet of data has been written */
 } __attribute__((packed)) mupgrade_status_t;
 
+/**
+ * @brief Header of a delta patch
+ */
+typedef struct {
+    uint32_t magic;            /**< MUPGRADE_DELTA_MAGIC */
+    uint32_t base_size;        /**< Length of the image the patch is generated against */
+    uint8_t base_sha256[32];   /**< SHA-256 of the image the patch is generated against */
+    uint32_t image_size;       /**< Length of the new image */
+    uint8_t image_sha256[32];  /**< SHA-256 of the new image */
+} __attribute__((packed)) mupgrade_delta_head_t;
+
+/**
+ * @brief Command of a delta patch
+ */
+typedef struct {
+    uint8_t type;              /**< MUPGRADE_DELTA_CMD_COPY or MUPGRADE_DELTA_CMD_INSERT */
+    uint32_t offset;           /**< Offset in the running app, 0 for MUPGRADE_DELTA_CMD_INSERT */
+    uint32_t size;             /**< Length of the output of the command */
+} __attribute__((packed)) mupgrade_delta_cmd_t;
+
+/**
+ * @brief Relay request, the root asks a device that has completed the upgrade to send
+ *        the packets that are missing to devices of its sub-network
+ */
+typedef struct {
+    uint8_t type;              /**< Type of packet, MUPGRADE_TYPE_RELAY */
+    char name[32];             /**< Unique identifier of the firmware */
+    size_t total_size;         /**< Total length of firmware */
+    uint16_t addrs_num;        /**< Number of the destination devices */
+    uint8_t progress_array[MUPGRADE_PACKET_MAX_NUM / 8]; /**< Packets received by all destination devices */
+    uint8_t addrs_list[0];     /**< MAC address of the destination devices */
+} __attribute__((packed)) mupgrade_relay_t;
+
 /**
  * @brief Mupgrade config
  */
@@ -98,6 +189,7 @@ typedef struct {
     const esp_partition_t *partition; /**< Pointer to partition structure obtained using
                                            esp_partition_find_first or esp_partition_get. */
     uint32_t start_time;       /**< Start time of the upgrade */
+    size_t delta_offset;       /**< Offset of the patch in the partition, 0 if it is not a delta update */
     mupgrade_status_t status;  /**< Upgrade status */
 } mupgrade_config_t;
 
@@ -171,11 +263,30 @@ mdf_err_t mupgrade_firmware_download_finished(size_t image_size);
  */
 mdf_err_t mupgrade_firmware_check(const esp_partition_t *partition);
 
+/**
+ * @brief  Rebuild the new image from a delta patch and check its hash
+ *
+ * @param  partition    The partition where the patch is located, the image is written at its start
+ * @param  patch_offset Offset of the patch in the partition, see MUPGRADE_DELTA_OFFSET
+ * @param  patch_size   The length of the patch
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_INVALID_ARG
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID: the patch is corrupted, not generated against the
+ *                                         running app or the new image does not match its hash
+ */
+mdf_err_t mupgrade_delta_apply(const esp_partition_t *partition, size_t patch_offset, size_t patch_size);
+
 /**
  * @brief  Root sends firmware to other nodes
  *
  * @attention Only called at the root
  *
+ * @note   With CONFIG_MUPGRADE_PIPELINE, it may be called while the firmware is still downloaded
+ *         in another task, the packets are sent as they are downloaded. Call `mupgrade_firmware_stop()`
+ *         if the download fails
+ *
  * @param  dest_addrs     Destination nodes of mac
  * @param  dest_addrs_num Number of destination nodes
  * @param  result         Must call mupgrade_result_free to free memory
@@ -191,6 +302,8 @@ mdf_err_t mupgrade_firmware_send(const uint8_t *dest_addrs, size_t dest_addrs_nu
 /**
  * @brief Stop Root to send firmware to other nodes
  *
+ * @note  With CONFIG_MUPGRADE_PIPELINE, a download in progress is stopped as well
+ *
  * @return
  *    - MDF_OK
  *   - MDF_ERR_NOT_SUPPORTED
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "mupgrade.h"
+#include "mbedtls/sha256.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32S2
 #include "esp32s2/rom/rtc.h"
@@ -218,3 +219,118 @@ mdf_err_t mupgrade_firmware_check(const esp_partition_t *partition)
 }
 
 #endif /**< CONFIG_MUPGRADE_FIRMWARE_CHECK */
+
+#define MUPGRADE_DELTA_BUFFER_SIZE (1024)
+
+static mdf_err_t mupgrade_sha256(const esp_partition_t *partition, size_t offset, size_t size,
+                                 uint8_t *buffer, uint8_t *sha256)
+{
+    mdf_err_t ret = MDF_OK;
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, false);
+
+    for (size_t read_size = 0; size > 0; offset += read_size, size -= read_size) {
+        read_size = MIN(size, MUPGRADE_DELTA_BUFFER_SIZE);
+        ret = esp_partition_read(partition, offset, buffer, read_size);
+        MDF_ERROR_BREAK(ret != MDF_OK, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+        mbedtls_sha256_update(&ctx, buffer, read_size);
+    }
+
+    mbedtls_sha256_finish(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+
+    return ret;
+}
+
+mdf_err_t mupgrade_delta_apply(const esp_partition_t *partition, size_t patch_offset, size_t patch_size)
+{
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(patch_size >= sizeof(mupgrade_delta_head_t));
+    MDF_PARAM_CHECK(patch_offset <= partition->size && patch_size <= partition->size - patch_offset);
+
+    mdf_err_t ret                  = MDF_OK;
+    mupgrade_delta_head_t head     = {0};
+    mupgrade_delta_cmd_t cmd       = {0};
+    uint8_t sha256[32]             = {0};
+    size_t image_size              = 0;
+    size_t erased_size             = 0;
+    size_t patch_end               = patch_offset + patch_size;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    uint8_t *buffer                = MDF_MALLOC(MUPGRADE_DELTA_BUFFER_SIZE);
+    MDF_ERROR_CHECK(!buffer, MDF_ERR_NO_MEM, "");
+
+    ret = esp_partition_read(partition, patch_offset, &head, sizeof(mupgrade_delta_head_t));
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+    MDF_ERROR_GOTO(head.magic != MUPGRADE_DELTA_MAGIC || head.base_size > running->size
+                   || head.image_size > patch_offset, EXIT,
+                   "Invalid patch, magic: 0x%x, base_size: %d, image_size: %d, patch_offset: %d",
+                   head.magic, head.base_size, head.image_size, patch_offset);
+
+    /**< A patch only rebuilds the new image from the image it is generated against */
+    ret = mupgrade_sha256(running, 0, head.base_size, buffer, sha256);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mupgrade_sha256", mdf_err_to_name(ret));
+    ret = memcmp(sha256, head.base_sha256, sizeof(sha256)) ? MDF_ERR_MUPGRADE_FIRMWARE_INVALID : MDF_OK;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "The patch is not generated against the running app");
+
+    MDF_LOGI("Apply the patch, base_size: %d, image_size: %d, patch_size: %d",
+             head.base_size, head.image_size, patch_size);
+
+    for (size_t offset = patch_offset + sizeof(mupgrade_delta_head_t); offset < patch_end;) {
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        MDF_ERROR_GOTO(patch_end - offset < sizeof(mupgrade_delta_cmd_t), EXIT, "The command is truncated");
+
+        ret = esp_partition_read(partition, offset, &cmd, sizeof(mupgrade_delta_cmd_t));
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+        offset += sizeof(mupgrade_delta_cmd_t);
+
+        bool insert = (cmd.type == MUPGRADE_DELTA_CMD_INSERT);
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        MDF_ERROR_GOTO((cmd.type != MUPGRADE_DELTA_CMD_COPY && !insert)
+                       || cmd.size > head.image_size - image_size
+                       || (!insert && (cmd.offset > head.base_size || cmd.size > head.base_size - cmd.offset))
+                       || (insert && cmd.size > patch_end - offset), EXIT,
+                       "Invalid command, type: %d, offset: %d, size: %d", cmd.type, cmd.offset, cmd.size);
+
+        const esp_partition_t *src_partition = insert ? partition : running;
+        size_t src_offset = insert ? offset : cmd.offset;
+
+        for (size_t copy_size = 0; copy_size < cmd.size; copy_size += MUPGRADE_DELTA_BUFFER_SIZE) {
+            size_t write_size = MIN(MUPGRADE_DELTA_BUFFER_SIZE, cmd.size - copy_size);
+
+            /**< Erase the sectors just before writing to them, not to block the device for seconds */
+            if (image_size + write_size > erased_size) {
+                ret = esp_partition_erase_range(partition, erased_size, SPI_FLASH_SEC_SIZE);
+                MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_erase_range", mdf_err_to_name(ret));
+                erased_size += SPI_FLASH_SEC_SIZE;
+            }
+
+            ret = esp_partition_read(src_partition, src_offset + copy_size, buffer, write_size);
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+            ret = esp_partition_write(partition, image_size, buffer, write_size);
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_write", mdf_err_to_name(ret));
+            image_size += write_size;
+        }
+
+        if (insert) {
+            offset += cmd.size;
+        }
+    }
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+    MDF_ERROR_GOTO(image_size != head.image_size, EXIT, "The patch is incomplete, image_size: %d", image_size);
+
+    ret = mupgrade_sha256(partition, 0, head.image_size, buffer, sha256);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mupgrade_sha256", mdf_err_to_name(ret));
+    ret = memcmp(sha256, head.image_sha256, sizeof(sha256)) ? MDF_ERR_MUPGRADE_FIRMWARE_INVALID : MDF_OK;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "The new image does not match the hash of the patch");
+
+EXIT:
+    MDF_FREE(buffer);
+    return ret;
+}
@@ -13,40 +13,438 @@
 // limitations under the License.
 
 #include "mupgrade.h"
-
-#define MUPGRADE_STORE_CONFIG_KEY "mupugrad_config"
+#include "miniz.h"
+
+#define MUPGRADE_STORE_CONFIG_KEY  "mupugrad_config"
+#define MUPGRADE_SECTOR_PACKET_NUM (SPI_FLASH_SEC_SIZE / MUPGRADE_PACKET_MAX_SIZE)
+
+/**
+ * @brief Packets of a flash sector waiting to be written
+ */
+typedef struct {
+    int32_t sector;                   /**< Index of the sector, -1 if the buffer is free */
+    uint32_t used_count;              /**< Value of g_mupgrade_sector_count when a packet is last buffered */
+    uint8_t packet_bits;              /**< Packets of the sector that are buffered */
+    uint8_t data[SPI_FLASH_SEC_SIZE]; /**< Data of the sector */
+} mupgrade_sector_t;
+
+/**
+ * @brief Entry of the progress journal, a run of packets written to flash.
+ *        It is 16 bytes, the unit of writes to an encrypted partition
+ */
+typedef struct {
+    uint16_t seq;        /**< Sequence of the first packet */
+    uint16_t num;        /**< Number of the packets */
+    uint32_t check;      /**< ~(seq << 16 | num), a torn or erased entry does not match */
+    uint8_t reserved[8]; /**< Reserved */
+} mupgrade_journal_t;
+
+/**
+ * @brief Fragments of a zlib stream waiting to be inflated
+ */
+typedef struct {
+    uint16_t seq;           /**< Sequence of the first compressed packet */
+    uint8_t packet_num;     /**< Number of the compressed packets */
+    uint8_t fragment_num;   /**< Number of the fragments of the stream, 0 if the buffer is free */
+    uint8_t fragment_bits;  /**< Fragments that are received */
+    size_t size;            /**< Length of the stream, known once the last fragment is received */
+    uint8_t data[MUPGRADE_DEFLATE_FRAGMENT_MAX_NUM * MUPGRADE_PACKET_MAX_SIZE]; /**< Data of the stream */
+} mupgrade_stream_t;
+
+#define MUPGRADE_JOURNAL_NUM             (SPI_FLASH_SEC_SIZE / sizeof(mupgrade_journal_t))
+#define MUPGRADE_JOURNAL_NONE            (0xffff) /**< The journal is not used, progress is saved to NVS periodically */
+#define MUPGRADE_JOURNAL_CHECK(seq, num) (~((uint32_t)(seq) << 16 | (num)))
 
 static const char *TAG = "mupgrade_node";
 static mupgrade_config_t *g_upgrade_config = NULL;
 static bool g_upgrade_finished_flag        = false;
+static bool g_upgrade_relay_running_flag   = false;
+static mupgrade_sector_t *g_mupgrade_sector_list = NULL;
+static mupgrade_stream_t *g_mupgrade_stream      = NULL;
+static uint32_t g_mupgrade_sector_count    = 0;
+static uint8_t g_mupgrade_erased_array[MUPGRADE_PACKET_MAX_NUM / MUPGRADE_SECTOR_PACKET_NUM / 8] = {0};
+static uint16_t g_mupgrade_journal_index   = MUPGRADE_JOURNAL_NONE;
+
+/**
+ * @brief Respond the status to the root, followed by the address of the parent
+ */
+static mdf_err_t mupgrade_status_write(size_t size)
+{
+    mdf_err_t ret               = MDF_OK;
+    mesh_addr_t parent_bssid    = {0};
+    mwifi_data_type_t data_type = {.upgrade = true};
+    uint8_t *status             = MDF_MALLOC(size + MWIFI_ADDR_LEN);
+    MDF_ERROR_CHECK(!status, MDF_ERR_NO_MEM, "");
+
+    memcpy(status, &g_upgrade_config->status, size);
+
+    /**< The station address of the parent is one less than its softAP address */
+    esp_mesh_get_parent_bssid(&parent_bssid);
+    uint32_t addr_low = (parent_bssid.addr[2] << 24 | parent_bssid.addr[3] << 16
+                         | parent_bssid.addr[4] << 8 | parent_bssid.addr[5]) - 1;
+    memcpy(status + size, parent_bssid.addr, 2);
+    status[size + 2] = addr_low >> 24;
+    status[size + 3] = addr_low >> 16;
+    status[size + 4] = addr_low >> 8;
+    status[size + 5] = addr_low;
+
+    ret = mwifi_write(NULL, &data_type, status, size + MWIFI_ADDR_LEN, true);
+    MDF_FREE(status);
+
+    return ret;
+}
+
+/**
+ * @brief The journal takes the sector after the firmware, or the sector
+ *        before the patch of a delta update
+ */
+static mdf_err_t mupgrade_journal_offset(size_t *offset)
+{
+    const esp_partition_t *partition = g_upgrade_config->partition;
+    size_t total_size = g_upgrade_config->status.total_size;
+
+    if (!partition || !total_size) {
+        return MDF_ERR_NOT_SUPPORTED;
+    }
+
+    if (g_upgrade_config->delta_offset) {
+        if (g_upgrade_config->delta_offset < SPI_FLASH_SEC_SIZE) {
+            return MDF_ERR_NOT_SUPPORTED;
+        }
+
+        *offset = g_upgrade_config->delta_offset - SPI_FLASH_SEC_SIZE;
+        return MDF_OK;
+    }
+
+    *offset = (total_size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+
+    if (*offset + SPI_FLASH_SEC_SIZE > partition->size) {
+        return MDF_ERR_NOT_SUPPORTED;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Erase the journal, it is done before the progress it belongs to is saved to NVS
+ */
+static mdf_err_t mupgrade_journal_reset()
+{
+    size_t offset = 0;
+    mdf_err_t ret = mupgrade_journal_offset(&offset);
+
+    g_mupgrade_journal_index = MUPGRADE_JOURNAL_NONE;
+
+    if (ret != MDF_OK) {
+        return ret;
+    }
+
+    ret = esp_partition_erase_range(g_upgrade_config->partition, offset, SPI_FLASH_SEC_SIZE);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_erase_range");
+
+    g_mupgrade_journal_index = 0;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Record a run of packets written to flash, nothing is recorded once the journal is full
+ */
+static void mupgrade_journal_append(uint16_t seq, uint16_t num)
+{
+    size_t offset = 0;
+
+    if (g_mupgrade_journal_index >= MUPGRADE_JOURNAL_NUM
+            || mupgrade_journal_offset(&offset) != MDF_OK) {
+        return;
+    }
+
+    mupgrade_journal_t journal = {
+        .seq   = seq,
+        .num   = num,
+        .check = MUPGRADE_JOURNAL_CHECK(seq, num),
+    };
+
+    /**< The entry is skipped even if the write fails, flash is only written once after erase */
+    offset += g_mupgrade_journal_index++ * sizeof(mupgrade_journal_t);
+    mdf_err_t ret = esp_partition_write(g_upgrade_config->partition, offset, &journal, sizeof(mupgrade_journal_t));
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> Write the journal, index: %d", mdf_err_to_name(ret), g_mupgrade_journal_index - 1);
+    }
+}
+
+/**
+ * @brief Add the packets recorded in the journal to the progress loaded from NVS
+ *
+ * @note  Erased flash reads back as garbage from an encrypted partition, so no
+ *        entry is seen as free and the journal is compacted on the next packet
+ */
+static void mupgrade_journal_replay()
+{
+    size_t offset          = 0;
+    uint16_t packet_num    = (g_upgrade_config->status.total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+    uint16_t replay_num    = 0;
+    mupgrade_journal_t journal_list[16];
+
+    g_mupgrade_journal_index = MUPGRADE_JOURNAL_NONE;
+
+    if (mupgrade_journal_offset(&offset) != MDF_OK) {
+        return;
+    }
+
+    g_mupgrade_journal_index = 0;
+
+    for (int i = 0; i < MUPGRADE_JOURNAL_NUM; i += sizeof(journal_list) / sizeof(mupgrade_journal_t)) {
+        mdf_err_t ret = esp_partition_read(g_upgrade_config->partition, offset + i * sizeof(mupgrade_journal_t),
+                                           journal_list, sizeof(journal_list));
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> esp_partition_read", mdf_err_to_name(ret));
+            g_mupgrade_journal_index = MUPGRADE_JOURNAL_NONE;
+            break;
+        }
+
+        for (int j = 0; j < sizeof(journal_list) / sizeof(mupgrade_journal_t); ++j) {
+            const mupgrade_journal_t *journal = journal_list + j;
+
+            /**< New entries are appended after the last one that is not erased */
+            if (journal->seq == 0xffff && journal->num == 0xffff && journal->check == 0xffffffff) {
+                continue;
+            }
+
+            g_mupgrade_journal_index = i + j + 1;
+
+            if (journal->check != MUPGRADE_JOURNAL_CHECK(journal->seq, journal->num)
+                    || !journal->num || journal->seq + journal->num > packet_num) {
+                continue;
+            }
+
+            for (int seq = journal->seq; seq < journal->seq + journal->num; ++seq) {
+                if (!MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, seq)) {
+                    MUPGRADE_SET_BITS(g_upgrade_config->status.progress_array, seq);
+                    g_upgrade_config->status.written_size += MIN(MUPGRADE_PACKET_MAX_SIZE,
+                            g_upgrade_config->status.total_size - seq * MUPGRADE_PACKET_MAX_SIZE);
+                    replay_num++;
+                }
+            }
+        }
+    }
+
+    MDF_LOGD("Replay the journal, packet_num: %d, journal_index: %d", replay_num, g_mupgrade_journal_index);
+}
+
+/**
+ * @brief Write the buffered packets of a sector to flash, the packets are
+ *        marked as missing again if it fails
+ */
+static mdf_err_t mupgrade_sector_flush(mupgrade_sector_t *sector)
+{
+    if (sector->sector < 0) {
+        return MDF_OK;
+    }
+
+    mdf_err_t ret = MDF_OK;
+    uint16_t seq  = sector->sector * MUPGRADE_SECTOR_PACKET_NUM;
+    size_t offset = g_upgrade_config->delta_offset + sector->sector * SPI_FLASH_SEC_SIZE;
+
+    if (!MUPGRADE_GET_BITS(g_mupgrade_erased_array, sector->sector)) {
+        ret = esp_partition_erase_range(g_upgrade_config->partition, offset, SPI_FLASH_SEC_SIZE);
+
+        if (ret == MDF_OK) {
+            MUPGRADE_SET_BITS(g_mupgrade_erased_array, sector->sector);
+        }
+    }
+
+    /**< Write each run of consecutive packets at once, that is the whole sector once it is complete */
+    for (int i = 0, j = 0; i < MUPGRADE_SECTOR_PACKET_NUM && ret == MDF_OK; i = j + 1) {
+        for (j = i; j < MUPGRADE_SECTOR_PACKET_NUM && (sector->packet_bits & (1 << j)); ++j);
+
+        if (j > i) {
+            size_t size = MIN((j - i) * MUPGRADE_PACKET_MAX_SIZE,
+                              g_upgrade_config->status.total_size - (seq + i) * MUPGRADE_PACKET_MAX_SIZE);
+            ret = esp_partition_write(g_upgrade_config->partition, offset + i * MUPGRADE_PACKET_MAX_SIZE,
+                                      sector->data + i * MUPGRADE_PACKET_MAX_SIZE, size);
+
+            if (ret == MDF_OK) {
+                mupgrade_journal_append(seq + i, j - i);
+            }
+        }
+    }
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> Write the sector, sector: %d", mdf_err_to_name(ret), sector->sector);
+
+        for (int i = 0; i < MUPGRADE_SECTOR_PACKET_NUM; ++i) {
+            if ((sector->packet_bits & (1 << i))
+                    && MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, seq + i)) {
+                MUPGRADE_CLEAR_BITS(g_upgrade_config->status.progress_array, seq + i);
+                g_upgrade_config->status.written_size -= MIN(MUPGRADE_PACKET_MAX_SIZE,
+                        g_upgrade_config->status.total_size - (seq + i) * MUPGRADE_PACKET_MAX_SIZE);
+            }
+        }
+
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD;
+    }
+
+    sector->sector      = -1;
+    sector->packet_bits = 0;
+
+    return ret;
+}
+
+static mdf_err_t mupgrade_sector_flush_all()
+{
+    mdf_err_t ret = MDF_OK;
+
+    for (int i = 0; g_mupgrade_sector_list && i < CONFIG_MUPGRADE_SECTOR_BUFFER_NUM; ++i) {
+        if (mupgrade_sector_flush(g_mupgrade_sector_list + i) != MDF_OK) {
+            ret = MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Save the progress to NVS and start the journal over, the journal is
+ *        only replayed on top of the NVS entry so the order matters
+ */
+static void mupgrade_journal_compact()
+{
+    /**< Only the packets written to flash are saved as received */
+    mupgrade_sector_flush_all();
+
+    mdf_err_t ret = mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
+                                  sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> mdf_info_save, fall back to saving the progress periodically", mdf_err_to_name(ret));
+        g_mupgrade_journal_index = MUPGRADE_JOURNAL_NONE;
+        return;
+    }
+
+    mupgrade_journal_reset();
+}
+
+/**
+ * @brief Drop the buffered packets and fragments, they are not written to flash
+ */
+static void mupgrade_sector_free()
+{
+    MDF_FREE(g_mupgrade_sector_list);
+    MDF_FREE(g_mupgrade_stream);
+}
+
+/**
+ * @brief Sectors are erased just before they are first written, a sector with
+ *        packets saved as written has been erased before the reset
+ */
+static void mupgrade_erased_restore()
+{
+    memset(g_mupgrade_erased_array, 0, sizeof(g_mupgrade_erased_array));
+
+    for (int seq = 0; seq < MUPGRADE_PACKET_MAX_NUM; ++seq) {
+        if (MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, seq)) {
+            MUPGRADE_SET_BITS(g_mupgrade_erased_array, seq / MUPGRADE_SECTOR_PACKET_NUM);
+        }
+    }
+}
+
+/**
+ * @brief Buffer a packet, its sector is written to flash once all the packets
+ *        of the sector are received
+ *
+ * @note  A buffered packet is reported as received, it is always written to flash
+ *        unless the upgrade is dropped: when its buffer is evicted, before the
+ *        progress is saved and once the upgrade completes. It is marked as missing
+ *        again if the write fails
+ */
+static mdf_err_t mupgrade_sector_write(const mupgrade_packet_t *packet)
+{
+    mupgrade_sector_t *sector = NULL;
+    int32_t index             = packet->seq / MUPGRADE_SECTOR_PACKET_NUM;
+    uint16_t packet_num       = (g_upgrade_config->status.total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+    uint16_t sector_packet_num = MIN(MUPGRADE_SECTOR_PACKET_NUM, packet_num - index * MUPGRADE_SECTOR_PACKET_NUM);
+
+    if (!g_mupgrade_sector_list) {
+        g_mupgrade_sector_list = MDF_MALLOC(CONFIG_MUPGRADE_SECTOR_BUFFER_NUM * sizeof(mupgrade_sector_t));
+        MDF_ERROR_CHECK(!g_mupgrade_sector_list, MDF_ERR_NO_MEM, "");
+
+        for (int i = 0; i < CONFIG_MUPGRADE_SECTOR_BUFFER_NUM; ++i) {
+            g_mupgrade_sector_list[i].sector      = -1;
+            g_mupgrade_sector_list[i].packet_bits = 0;
+        }
+    }
+
+    /**< Use the buffer of the sector, else a free buffer, else the least recently used one */
+    for (int i = 0; i < CONFIG_MUPGRADE_SECTOR_BUFFER_NUM; ++i) {
+        mupgrade_sector_t *item = g_mupgrade_sector_list + i;
+
+        if (item->sector == index) {
+            sector = item;
+            break;
+        }
+
+        if (!sector || (sector->sector >= 0 && (item->sector < 0 || item->used_count < sector->used_count))) {
+            sector = item;
+        }
+    }
+
+    /**< The packets of the evicted sector are marked as missing if they fail to be written */
+    if (sector->sector != index) {
+        mupgrade_sector_flush(sector);
+        sector->sector = index;
+    }
+
+    memcpy(sector->data + (packet->seq % MUPGRADE_SECTOR_PACKET_NUM) * MUPGRADE_PACKET_MAX_SIZE,
+           packet->data, packet->size);
+    sector->packet_bits |= 1 << (packet->seq % MUPGRADE_SECTOR_PACKET_NUM);
+    sector->used_count   = ++g_mupgrade_sector_count;
+
+    /**< The packets written by a previous flush of the sector are not buffered anymore */
+    for (int i = 0; i < sector_packet_num; ++i) {
+        if (!(sector->packet_bits & (1 << i))
+                && !MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, index * MUPGRADE_SECTOR_PACKET_NUM + i)) {
+            return MDF_OK;
+        }
+    }
+
+    return mupgrade_sector_flush(sector);
+}
 
 static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
 {
     mdf_err_t ret               = MDF_ERR_NO_MEM;
     size_t response_size        = sizeof(mupgrade_status_t);
-    mwifi_data_type_t data_type = {
-        .upgrade = true
-    };
 
     if (!g_upgrade_config) {
         size_t config_size = sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8;
         g_upgrade_config   = MDF_CALLOC(1, config_size);
         MDF_ERROR_GOTO(!g_upgrade_config, EXIT, "<MDF_ERR_NO_MEM> g_upgrade_config");
 
-        mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size);
+        if (mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size) != MDF_OK) {
+            memset(g_upgrade_config, 0, config_size);
+        }
 
         g_upgrade_config->start_time = xTaskGetTickCount();
         g_upgrade_config->partition = esp_ota_get_next_update_partition(NULL);
+        mupgrade_journal_replay();
+        mupgrade_erased_restore();
     }
 
+    bool delta = (status->type == MUPGRADE_TYPE_DELTA);
+
     /**< If g_upgrade_config->status has been created and
          once again upgrade the same name bin, just return MDF_OK */
     if (!strcmp(g_upgrade_config->status.name, status->name)
-            && g_upgrade_config->status.total_size == status->total_size) {
+            && g_upgrade_config->status.total_size == status->total_size
+            && !g_upgrade_config->delta_offset == !delta) {
         ret = MDF_OK;
         goto EXIT;
     }
 
+    mupgrade_sector_free();
     memset(g_upgrade_config, 0, sizeof(mupgrade_config_t));
     memcpy(&g_upgrade_config->status, status, sizeof(mupgrade_status_t));
     memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
@@ -87,21 +485,30 @@ static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
     g_upgrade_config->partition  = update;
     g_upgrade_config->start_time = xTaskGetTickCount();
 
-    /**< In some case, the time-cost of flash erase in esp_ota_begin (called by
-         mupgrade_start) can be too long to expire the mdf connection */
-    uint32_t assoc_expire = esp_mesh_get_ap_assoc_expire();
-    ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(60));
+    ret = MDF_ERR_INVALID_ARG;
+    MDF_ERROR_GOTO(g_upgrade_config->status.total_size > update->size
+                   || g_upgrade_config->status.total_size > MUPGRADE_PACKET_MAX_NUM * MUPGRADE_PACKET_MAX_SIZE, EXIT,
+                   "The size of the firmware is wrong, total_size: %d", g_upgrade_config->status.total_size);
 
-    /**< Commence an OTA update writing to the specified partition. */
-    ret = esp_ota_begin(update, g_upgrade_config->status.total_size, &g_upgrade_config->handle);
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_ota_begin failed");
+    /**< The patch of a delta update is written to the end of the partition */
+    if (delta) {
+        MDF_ERROR_GOTO(g_upgrade_config->status.total_size < sizeof(mupgrade_delta_head_t)
+                       || g_upgrade_config->status.total_size >= update->size, EXIT,
+                       "The size of the patch is wrong, total_size: %d", g_upgrade_config->status.total_size);
 
-    ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(assoc_expire));
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_start, ret: %d", ret);
+        g_upgrade_config->delta_offset = MUPGRADE_DELTA_OFFSET(update->size, g_upgrade_config->status.total_size);
+    }
+
+    /**< The partition is not erased by esp_ota_begin, which blocks the device for seconds,
+         each sector is erased just before it is first written */
+    mupgrade_erased_restore();
+
+    /**< Entries left by the previous upgrade must not be replayed on top of the new one */
+    mupgrade_journal_reset();
 
     /**< Save upgrade infomation to flash. */
     ret = mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
-                        sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+                        sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8);
     MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "info_store_save, ret: %d", ret);
 
     /**< Send MDF_EVENT_MUPGRADE_STARTED event to the event handler */
@@ -126,54 +533,73 @@ EXIT:
 
     MDF_LOGD("Response mupgrade status, written_size: %d, response_size: %d",
              g_upgrade_config->status.written_size, response_size);
-    ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, response_size, true);
+    ret = mupgrade_status_write(response_size);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
 
     return MDF_OK;
 }
 
-static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
+/**
+ * @brief Restore the upgrade status saved before the system reset
+ */
+static mdf_err_t mupgrade_config_load()
 {
-    MDF_PARAM_CHECK(packet);
-    MDF_PARAM_CHECK(size);
-
     mdf_err_t ret = MDF_OK;
 
-    if (!g_upgrade_config) {
-        size_t config_size = sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8;
-        g_upgrade_config   = MDF_CALLOC(1, config_size);
-        MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_NO_MEM, "<MDF_ERR_NO_MEM> g_upgrade_config");
+    if (g_upgrade_config) {
+        return MDF_OK;
+    }
 
-        /**< Get upgrade infomation to flash. */
-        ret = mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size);
+    size_t config_size = sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8;
+    g_upgrade_config   = MDF_CALLOC(1, config_size);
+    MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_NO_MEM, "<MDF_ERR_NO_MEM> g_upgrade_config");
 
-        g_upgrade_config->start_time = xTaskGetTickCount();
-        g_upgrade_config->partition = esp_ota_get_next_update_partition(NULL);
+    /**< Get upgrade infomation to flash. */
+    ret = mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size);
 
-        if (ret != MDF_OK) {
-            MDF_FREE(g_upgrade_config);
-            MDF_LOGW("Upgrade configuration is not initialized");
-            return MDF_ERR_MUPGRADE_NOT_INIT;
-        }
+    g_upgrade_config->start_time = xTaskGetTickCount();
+    g_upgrade_config->partition = esp_ota_get_next_update_partition(NULL);
+
+    if (ret != MDF_OK) {
+        MDF_FREE(g_upgrade_config);
+        MDF_LOGW("Upgrade configuration is not initialized");
+        return MDF_ERR_MUPGRADE_NOT_INIT;
+    }
+
+    mupgrade_journal_replay();
+    mupgrade_erased_restore();
+
+    return MDF_OK;
+}
+
+static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
+{
+    MDF_PARAM_CHECK(packet);
+    MDF_PARAM_CHECK(size);
+
+    mdf_err_t ret = mupgrade_config_load();
+
+    if (ret != MDF_OK) {
+        return ret;
     }
 
     if (g_upgrade_config->status.error_code == MDF_ERR_MUPGRADE_STOP) {
-        mwifi_data_type_t data_type = {
-            .upgrade = true
-        };
         g_upgrade_config->status.type         = MUPGRADE_TYPE_DATA;
         g_upgrade_config->status.written_size = 0;
         memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
         mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
+        mupgrade_sector_free();
 
-        ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
+        ret = mupgrade_status_write(sizeof(mupgrade_status_t));
         MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
 
         return MDF_OK;
     }
 
-    MDF_ERROR_CHECK(packet->seq * MUPGRADE_PACKET_MAX_SIZE > g_upgrade_config->status.total_size,
-                    MDF_ERR_INVALID_ARG, "packet->seq: %d", packet->seq);
+    MDF_ERROR_CHECK(packet->seq * MUPGRADE_PACKET_MAX_SIZE >= g_upgrade_config->status.total_size
+                    || packet->size != MIN(MUPGRADE_PACKET_MAX_SIZE,
+                                           g_upgrade_config->status.total_size - packet->seq * MUPGRADE_PACKET_MAX_SIZE),
+                    MDF_ERR_INVALID_ARG, "packet->seq: %d, packet->size: %d", packet->seq, packet->size);
 
     /**< Received a duplicate packet */
     if (MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, packet->seq)) {
@@ -181,17 +607,22 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
         return MDF_OK;
     }
 
-    /**< Write firmware data to the update partition */
-    ret = esp_partition_write(g_upgrade_config->partition, packet->seq * MUPGRADE_PACKET_MAX_SIZE,
-                              packet->data, packet->size);
+    /**< Write firmware data to the update partition, a flash sector at a time */
+    ret = mupgrade_sector_write(packet);
     MDF_ERROR_CHECK(ret != MDF_OK, MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD,
-                    "esp_partition_write %s", esp_err_to_name(ret));
+                    "<%s> mupgrade_sector_write", mdf_err_to_name(ret));
 
-    /**< Update g_upgrade_config->status */
+    /**< Update g_upgrade_config->status, a buffered packet is reported as received, see mupgrade_sector_write() */
     MUPGRADE_SET_BITS(g_upgrade_config->status.progress_array, packet->seq);
     g_upgrade_config->status.written_size += packet->size;
 
-    /**< Save OTA status periodically, it can be used to
+    /**< Every packet written to flash is recorded in the journal, which
+         saves the progress to NVS only each time the journal is full */
+    if (g_mupgrade_journal_index == MUPGRADE_JOURNAL_NUM) {
+        mupgrade_journal_compact();
+    }
+
+    /**< Report OTA status periodically, it is also saved if there is no journal, it can be used to
          resumable data transfers from breakpoint after system reset */
     static uint32_t s_next_written_percentage = CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
     uint32_t written_percentage = g_upgrade_config->status.written_size * 100 / g_upgrade_config->status.total_size;
@@ -200,11 +631,17 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
              packet->seq, packet->size, g_upgrade_config->status.written_size, written_percentage, s_next_written_percentage);
 
     if (written_percentage == s_next_written_percentage) {
-        MDF_LOGD("Save the data of upgrade status to flash");
         s_next_written_percentage += CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
 
-        mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
-                      sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+        if (g_mupgrade_journal_index == MUPGRADE_JOURNAL_NONE) {
+            MDF_LOGD("Save the data of upgrade status to flash");
+
+            /**< Only the packets written to flash are saved as received */
+            mupgrade_sector_flush_all();
+
+            mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
+                          sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+        }
 
         /**< Send MDF_EVENT_MUPGRADE_STATUS event to the event handler */
         mdf_event_loop_send(MDF_EVENT_MUPGRADE_STATUS, (void *)written_percentage);
@@ -219,18 +656,33 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
                  g_upgrade_config->status.total_size, g_upgrade_config->status.written_size,
                  (xTaskGetTickCount() - g_upgrade_config->start_time) * portTICK_RATE_MS / 1000);
 
-        /**< If ESP32 was reset duration OTA, and after restart, the update_handle will be invalid,
-             but it still can switch boot partition and reboot successful */
-        esp_ota_end(g_upgrade_config->handle);
+        /**< The sectors flushed partially before are written as their last packets
+             are received, this catches any that is still buffered */
+        ret = mupgrade_sector_flush_all();
+        mupgrade_sector_free();
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_sector_flush_all, written_size: %d",
+                        g_upgrade_config->status.written_size);
+
+        /**< Rebuild the new image from the patch, the patch stays at the end
+             of the partition and can still be relayed */
+        if (g_upgrade_config->delta_offset) {
+            ret = mupgrade_delta_apply(g_upgrade_config->partition, g_upgrade_config->delta_offset,
+                                       g_upgrade_config->status.total_size);
+        }
+
+        /**< The firmware is not written through an OTA handle,
+             esp_ota_set_boot_partition validates the image */
         mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
 
-        const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
-        ret = esp_ota_set_boot_partition(update_partition);
+        if (ret == MDF_OK) {
+            const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+            ret = esp_ota_set_boot_partition(update_partition);
+        }
 
         if (ret != MDF_OK) {
             g_upgrade_config->status.written_size = 0;
             g_upgrade_config->status.error_code   = MDF_ERR_MUPGRADE_STOP;
-            MDF_LOGW("<%s> esp_ota_set_boot_partition", mdf_err_to_name(ret));
+            MDF_LOGW("<%s> Switch to the new image", mdf_err_to_name(ret));
             return ret;
         }
 
@@ -239,14 +691,260 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
         g_upgrade_finished_flag = true;
 
         /**< Response firmware upgrade status to root node. */
-        mwifi_data_type_t data_type = {.upgrade = true,};
-        ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
+        ret = mupgrade_status_write(sizeof(mupgrade_status_t));
         MDF_ERROR_CHECK(ret != MDF_OK, ret, "Send the status of the upgrade to the root");
     }
 
     return MDF_OK;
 }
 
+static mdf_err_t mupgrade_parity(const mupgrade_packet_t *parity, size_t size)
+{
+    MDF_PARAM_CHECK(parity);
+    MDF_PARAM_CHECK(size == sizeof(mupgrade_packet_t));
+
+    mdf_err_t ret             = MDF_OK;
+    mupgrade_packet_t *packet = NULL;
+    uint16_t missing_seq      = 0;
+    uint16_t missing_num      = 0;
+    uint8_t buffer[128]       = {0};
+
+    /**< The parity packet is useless until a data packet has restored the upgrade status */
+    if (!g_upgrade_config || g_upgrade_config->status.error_code == MDF_ERR_MUPGRADE_STOP
+            || g_upgrade_config->status.written_size == g_upgrade_config->status.total_size) {
+        return MDF_OK;
+    }
+
+    uint16_t packet_num = (g_upgrade_config->status.total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+    MDF_ERROR_CHECK(parity->seq >= packet_num || parity->size > packet_num - parity->seq,
+                    MDF_ERR_INVALID_ARG, "parity->seq: %d, parity->size: %d", parity->seq, parity->size);
+
+    for (uint16_t seq = parity->seq; seq < parity->seq + parity->size; ++seq) {
+        if (!MUPGRADE_GET_BITS(g_upgrade_config->status.progress_array, seq)) {
+            missing_seq = seq;
+            missing_num++;
+        }
+    }
+
+    /**< Only a single lost packet of the block can be rebuilt */
+    if (missing_num != 1) {
+        MDF_LOGD("Parity packet is not used, seq: %d, missing_num: %d", parity->seq, missing_num);
+        return MDF_OK;
+    }
+
+    /**< The packets of the block are read back from flash */
+    ret = mupgrade_sector_flush_all();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_sector_flush_all");
+
+    packet = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    MDF_ERROR_CHECK(!packet, MDF_ERR_NO_MEM, "");
+    memcpy(packet->data, parity->data, MUPGRADE_PACKET_MAX_SIZE);
+
+    /**< XOR the packets that have been written to the update partition out of the parity */
+    for (uint16_t seq = parity->seq; seq < parity->seq + parity->size; ++seq) {
+        if (seq == missing_seq) {
+            continue;
+        }
+
+        size_t packet_size = MIN(MUPGRADE_PACKET_MAX_SIZE,
+                                 g_upgrade_config->status.total_size - seq * MUPGRADE_PACKET_MAX_SIZE);
+
+        for (size_t offset = 0, read_size = 0; offset < packet_size; offset += read_size) {
+            read_size = MIN(sizeof(buffer), packet_size - offset);
+            ret = esp_partition_read(g_upgrade_config->partition, g_upgrade_config->delta_offset
+                                     + seq * MUPGRADE_PACKET_MAX_SIZE + offset, buffer, read_size);
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+            for (int i = 0; i < read_size; ++i) {
+                packet->data[offset + i] ^= buffer[i];
+            }
+        }
+    }
+
+    packet->type = MUPGRADE_TYPE_DATA;
+    packet->seq  = missing_seq;
+    packet->size = MIN(MUPGRADE_PACKET_MAX_SIZE,
+                       g_upgrade_config->status.total_size - missing_seq * MUPGRADE_PACKET_MAX_SIZE);
+    MDF_LOGD("Rebuild the lost packet, packet_seq: %d, packet_size: %d", packet->seq, packet->size);
+
+    ret = mupgrade_write(packet, sizeof(mupgrade_packet_t));
+
+EXIT:
+    MDF_FREE(packet);
+    return ret;
+}
+
+static mdf_err_t mupgrade_inflate(const mupgrade_deflate_t *fragment, size_t size)
+{
+    MDF_PARAM_CHECK(fragment);
+    MDF_PARAM_CHECK(size >= offsetof(mupgrade_deflate_t, data));
+    MDF_PARAM_CHECK(fragment->size <= MUPGRADE_PACKET_MAX_SIZE
+                    && size >= offsetof(mupgrade_deflate_t, data) + fragment->size);
+
+    mdf_err_t ret             = mupgrade_config_load();
+    mupgrade_packet_t *packet = NULL;
+    uint8_t *span_data        = NULL;
+
+    if (ret != MDF_OK) {
+        return ret;
+    }
+
+    /**< mupgrade_write responds the stop status */
+    if (g_upgrade_config->status.error_code == MDF_ERR_MUPGRADE_STOP) {
+        return mupgrade_write((mupgrade_packet_t *)fragment, size);
+    }
+
+    uint16_t packet_num = (g_upgrade_config->status.total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+    MDF_ERROR_CHECK(fragment->seq >= packet_num || fragment->seq % MUPGRADE_DEFLATE_PACKET_NUM
+                    || !fragment->packet_num || fragment->packet_num > MUPGRADE_DEFLATE_PACKET_NUM
+                    || !fragment->fragment_num || fragment->fragment_num > MUPGRADE_DEFLATE_FRAGMENT_MAX_NUM
+                    || fragment->fragment_index >= fragment->fragment_num
+                    || (fragment->fragment_index < fragment->fragment_num - 1 && fragment->size != MUPGRADE_PACKET_MAX_SIZE),
+                    MDF_ERR_INVALID_ARG, "seq: %d, packet_num: %d, fragment_index: %d, fragment_num: %d, size: %d",
+                    fragment->seq, fragment->packet_num, fragment->fragment_index, fragment->fragment_num, fragment->size);
+
+    if (!g_mupgrade_stream) {
+        g_mupgrade_stream = MDF_CALLOC(1, sizeof(mupgrade_stream_t));
+        MDF_ERROR_CHECK(!g_mupgrade_stream, MDF_ERR_NO_MEM, "");
+    }
+
+    mupgrade_stream_t *stream = g_mupgrade_stream;
+
+    /**< Only one stream is buffered, the fragments of an incomplete one are dropped */
+    if (stream->seq != fragment->seq || stream->packet_num != fragment->packet_num
+            || stream->fragment_num != fragment->fragment_num) {
+        stream->seq           = fragment->seq;
+        stream->packet_num    = fragment->packet_num;
+        stream->fragment_num  = fragment->fragment_num;
+        stream->fragment_bits = 0;
+    }
+
+    memcpy(stream->data + fragment->fragment_index * MUPGRADE_PACKET_MAX_SIZE, fragment->data, fragment->size);
+    stream->fragment_bits |= 1 << fragment->fragment_index;
+
+    if (fragment->fragment_index == fragment->fragment_num - 1) {
+        stream->size = fragment->fragment_index * MUPGRADE_PACKET_MAX_SIZE + fragment->size;
+    }
+
+    if (stream->fragment_bits != (1 << stream->fragment_num) - 1) {
+        return MDF_OK;
+    }
+
+    uint16_t seq     = stream->seq;
+    size_t span_size = MIN(stream->packet_num * MUPGRADE_PACKET_MAX_SIZE,
+                           g_upgrade_config->status.total_size - seq * MUPGRADE_PACKET_MAX_SIZE);
+    mz_ulong inflate_size = span_size;
+
+    /**< The stream is inflated once, a retransmission starts over */
+    stream->fragment_num = 0;
+
+    ret       = MDF_ERR_NO_MEM;
+    span_data = MDF_MALLOC(span_size);
+    packet    = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    MDF_ERROR_GOTO(!span_data || !packet, EXIT, "");
+
+    /**< The zlib stream ends with the adler32 of the packets, which is checked by uncompress */
+    int mz_ret = uncompress(span_data, &inflate_size, stream->data, stream->size);
+    ret = (mz_ret == MZ_OK && inflate_size == span_size) ? MDF_OK : MDF_FAIL;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Uncompress, seq: %d, size: %d, inflate_size: %d",
+                   mz_error(mz_ret), seq, stream->size, (int)inflate_size);
+
+    MDF_LOGD("Inflate, seq: %d, size: %d, inflate_size: %d", seq, stream->size, (int)inflate_size);
+    packet->type = MUPGRADE_TYPE_DATA;
+
+    /**< The stream is freed by mupgrade_write once the firmware is complete */
+    for (size_t offset = 0; offset < span_size; offset += packet->size) {
+        packet->seq  = seq + offset / MUPGRADE_PACKET_MAX_SIZE;
+        packet->size = MIN(MUPGRADE_PACKET_MAX_SIZE, span_size - offset);
+        memcpy(packet->data, span_data + offset, packet->size);
+
+        ret = mupgrade_write(packet, sizeof(mupgrade_packet_t));
+        MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mupgrade_write", mdf_err_to_name(ret));
+    }
+
+EXIT:
+    MDF_FREE(span_data);
+    MDF_FREE(packet);
+    return ret;
+}
+
+static void mupgrade_relay_task(void *arg)
+{
+    mdf_err_t ret               = MDF_OK;
+    mupgrade_relay_t *relay     = (mupgrade_relay_t *)arg;
+    mupgrade_packet_t *packet   = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    mwifi_data_type_t data_type = {.upgrade = true};
+    uint16_t packet_num         = (relay->total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+
+    MDF_ERROR_GOTO(!packet, EXIT, "");
+    MDF_LOGI("Relay the firmware to %d devices", relay->addrs_num);
+
+    packet->type = MUPGRADE_TYPE_DATA;
+
+    for (packet->seq = 0; packet->seq < packet_num && g_upgrade_finished_flag; ++packet->seq) {
+        if (MUPGRADE_GET_BITS(relay->progress_array, packet->seq)) {
+            continue;
+        }
+
+        packet->size = MIN(MUPGRADE_PACKET_MAX_SIZE, relay->total_size - packet->seq * MUPGRADE_PACKET_MAX_SIZE);
+        ret = esp_partition_read(g_upgrade_config->partition,
+                                 g_upgrade_config->delta_offset + packet->seq * MUPGRADE_PACKET_MAX_SIZE,
+                                 packet->data, packet->size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", mdf_err_to_name(ret));
+
+        for (int i = 0; i < relay->addrs_num; ++i) {
+            uint64_t start_us = esp_timer_get_time();
+
+            ret = mwifi_write(relay->addrs_list + i * MWIFI_ADDR_LEN, &data_type,
+                              packet, sizeof(mupgrade_packet_t), true);
+
+            uint64_t wait = (esp_timer_get_time() - start_us) * CONFIG_MUPGRADE_FLOW_CONTROL_LEVEL / 10;
+            vTaskDelay(pdMS_TO_TICKS(wait / 1000)); // flow control for sending data in ota
+
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_write", mdf_err_to_name(ret));
+        }
+    }
+
+EXIT:
+    MDF_FREE(packet);
+    MDF_FREE(relay);
+    g_upgrade_relay_running_flag = false;
+    vTaskDelete(NULL);
+}
+
+static mdf_err_t mupgrade_relay(const mupgrade_relay_t *relay, size_t size)
+{
+    MDF_PARAM_CHECK(relay);
+    MDF_PARAM_CHECK(size >= sizeof(mupgrade_relay_t));
+    MDF_PARAM_CHECK(size == sizeof(mupgrade_relay_t) + relay->addrs_num * MWIFI_ADDR_LEN);
+
+    /**< Only a device that has written the same firmware can relay it */
+    if (!g_upgrade_config || !g_upgrade_finished_flag
+            || esp_mesh_get_type() == MESH_ROOT || esp_mesh_get_type() == MESH_STA
+            || strncmp(g_upgrade_config->status.name, relay->name, sizeof(relay->name))
+            || g_upgrade_config->status.total_size != relay->total_size) {
+        MDF_LOGW("The device is not able to relay the firmware");
+        return MDF_OK;
+    }
+
+    /**< The root retries the devices that are not served in the next round */
+    if (g_upgrade_relay_running_flag) {
+        MDF_LOGW("The firmware is being relayed");
+        return MDF_OK;
+    }
+
+    mupgrade_relay_t *relay_copy = MDF_MALLOC(size);
+    MDF_ERROR_CHECK(!relay_copy, MDF_ERR_NO_MEM, "");
+    memcpy(relay_copy, relay, size);
+
+    g_upgrade_relay_running_flag = true;
+    xTaskCreatePinnedToCore(mupgrade_relay_task, "mupgrade_relay", 3 * 1024,
+                            relay_copy, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
+                            NULL, CONFIG_MDF_TASK_PINNED_TO_CORE);
+
+    return MDF_OK;
+}
+
 mdf_err_t mupgrade_handle(const uint8_t *addr, const void *data, size_t size)
 {
     MDF_PARAM_CHECK(addr);
@@ -258,7 +956,8 @@ mdf_err_t mupgrade_handle(const uint8_t *addr, const void *data, size_t size)
 
     switch (data_type) {
         case MUPGRADE_TYPE_STATUS:
-            MDF_LOGV("MUPGRADE_TYPE_STATUS");
+        case MUPGRADE_TYPE_DELTA:
+            MDF_LOGV("MUPGRADE_TYPE_STATUS, delta: %d", data_type == MUPGRADE_TYPE_DELTA);
             ret = mupgrade_status((mupgrade_status_t *)data, size);
             break;
 
@@ -267,6 +966,21 @@ mdf_err_t mupgrade_handle(const uint8_t *addr, const void *data, size_t size)
             ret = mupgrade_write((mupgrade_packet_t *)data, size);
             break;
 
+        case MUPGRADE_TYPE_PARITY:
+            MDF_LOGV("MUPGRADE_TYPE_PARITY");
+            ret = mupgrade_parity((mupgrade_packet_t *)data, size);
+            break;
+
+        case MUPGRADE_TYPE_DEFLATE:
+            MDF_LOGV("MUPGRADE_TYPE_DEFLATE");
+            ret = mupgrade_inflate((mupgrade_deflate_t *)data, size);
+            break;
+
+        case MUPGRADE_TYPE_RELAY:
+            MDF_LOGV("MUPGRADE_TYPE_RELAY");
+            ret = mupgrade_relay((mupgrade_relay_t *)data, size);
+            break;
+
         default:
             break;
     }
@@ -288,9 +1002,6 @@ mdf_err_t mupgrade_get_status(mupgrade_status_t *status)
 mdf_err_t mupgrade_stop()
 {
     mdf_err_t ret = MDF_OK;
-    mwifi_data_type_t data_type = {
-        .upgrade = true
-    };
 
     if (!g_upgrade_config) {
         return MDF_OK;
@@ -307,8 +1018,9 @@ mdf_err_t mupgrade_stop()
     g_upgrade_config->status.written_size = 0;
     memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
     mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
+    mupgrade_sector_free();
 
-    ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
+    ret = mupgrade_status_write(sizeof(mupgrade_status_t));
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
 
     return MDF_OK;
@@ -15,6 +15,7 @@
 #include "mdf_common.h"
 #include "mupgrade.h"
 #include "mwifi.h"
+#include "miniz.h"
 
 typedef struct {
     uint8_t src_addr[MWIFI_ADDR_LEN];
@@ -22,6 +23,68 @@ typedef struct {
     uint8_t data[0];
 } mupgrade_queue_t;
 
+/**
+ * @brief Devices that are missing the same packets, each group is
+ *        sent only the packets it lacks
+ */
+typedef struct {
+    size_t addrs_num;                                   /**< Number of devices in the group, 0 if the group is free */
+    uint8_t *addrs_list;                                /**< MAC address of devices in the group */
+    bool extended;                                      /**< All devices of the group report their parent,
+                                                             they are able to inflate MUPGRADE_TYPE_DEFLATE */
+    uint8_t progress_array[MUPGRADE_PACKET_MAX_NUM / 8]; /**< Packets received by all devices of the group */
+} mupgrade_group_t;
+
+/**
+ * @brief Pacing of the firmware packets, AIMD on the send rate: the delay after each
+ *        packet is decreased by 1/16 while the mesh keeps up with it, that is a nearly
+ *        constant increase of the rate when the delay is short, and doubled when mwifi
+ *        fails to send, the packets queue up to the children or the devices lose too
+ *        many packets of a round
+ */
+#define MUPGRADE_RATE_DELAY_MAX_US   (100 * 1000) /**< Longest delay after a packet */
+#define MUPGRADE_RATE_DELAY_STEP_US  (100)        /**< Minimum decrease of the delay after a packet sent without congestion */
+#define MUPGRADE_RATE_PENDING_NUM    (16)         /**< Number of packets queued to the children above which the mesh is congested */
+#define MUPGRADE_RATE_HOLD_NUM       (16)         /**< Number of packets sent before the delay is increased again */
+#define MUPGRADE_RATE_LOSS_PERCENT   (10)         /**< Percentage of the packets of a round lost above which the mesh is congested */
+
+typedef struct {
+    uint32_t delay_us;                               /**< Delay after each packet */
+    uint32_t wait_us;                                /**< Delay not waited yet, shorter than a tick */
+    uint16_t hold_num;                               /**< Number of packets to send before the delay is increased again */
+    uint16_t sent_num;                               /**< Number of packets sent in the round */
+    uint8_t sent_array[MUPGRADE_PACKET_MAX_NUM / 8]; /**< Packets sent in the round */
+} mupgrade_rate_t;
+
+#ifdef CONFIG_MUPGRADE_RELAY
+
+/**
+ * @brief Flags of a device in the relay list
+ */
+#define MUPGRADE_NODE_FINISHED (BIT0) /**< The device has completed the upgrade and is able to relay */
+#define MUPGRADE_NODE_RELAYED  (BIT1) /**< The device was served by a relay in the last round */
+#define MUPGRADE_NODE_NO_RELAY (BIT2) /**< The relay made no progress, the device is served by the root */
+
+#define MUPGRADE_RELAY_ADDRS_MAX_NUM ((MWIFI_PAYLOAD_LEN - sizeof(mupgrade_relay_t)) / MWIFI_ADDR_LEN)
+
+/**
+ * @brief A device that reports its parent
+ */
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];        /**< MAC address of the device */
+    uint8_t parent_addr[MWIFI_ADDR_LEN]; /**< MAC address of the parent */
+    uint16_t missing_num;                /**< Number of packets missing at the last status */
+    uint8_t flag;                        /**< Flags of the device, MUPGRADE_NODE_* */
+} mupgrade_node_t;
+
+static mupgrade_node_t *g_mupgrade_node_list = NULL;
+static size_t g_mupgrade_node_num            = 0;
+
+#endif /**< CONFIG_MUPGRADE_RELAY */
+
+#define MUPGRADE_DOWNLOAD_WAIT_MS     (10) /**< Interval at which the download is checked while packets are sent as they are downloaded */
+#define MUPGRADE_ENCRYPTED_BLOCK_SIZE (16) /**< Unit of the writes to an encrypted partition */
+
 static const char *TAG = "mupgrade_root";
 static mupgrade_config_t *g_upgrade_config = NULL;
 static bool g_mupgrade_send_running_flag   = false;
@@ -59,6 +122,7 @@ mdf_err_t mupgrade_firmware_init(const char *name, size_t size)
     g_upgrade_config->partition           = update;
     g_upgrade_config->status.total_size   = size;
     g_upgrade_config->status.written_size = 0;
+    g_upgrade_config->delta_offset        = 0;
     memcpy(g_upgrade_config->status.name, name, sizeof(g_upgrade_config->status.name));
 
     /**< Commence an OTA update writing to the specified partition. */
@@ -81,10 +145,37 @@ mdf_err_t mupgrade_firmware_download(const void *data, size_t size)
     if (g_upgrade_config->status.written_size == 0) {
         /**< Send MDF_EVENT_MUPGRADE_FIRMWARE_DOWNLOAD event to the event handler */
         mdf_event_loop_send(MDF_EVENT_MUPGRADE_FIRMWARE_DOWNLOAD, NULL);
+
+        uint32_t magic = 0;
+        memcpy(&magic, data, MIN(size, sizeof(uint32_t)));
+
+        /**< The patch of a delta update is written to the end of the partition,
+             the new image is rebuilt from it once the download is finished */
+        if (magic == MUPGRADE_DELTA_MAGIC) {
+            size_t total_size = g_upgrade_config->status.total_size;
+            MDF_ERROR_CHECK(total_size == OTA_SIZE_UNKNOWN || total_size < sizeof(mupgrade_delta_head_t),
+                            MDF_ERR_NOT_SUPPORTED, "The size of the patch must be known");
+
+            g_upgrade_config->delta_offset = MUPGRADE_DELTA_OFFSET(g_upgrade_config->partition->size, total_size);
+            g_upgrade_config->status.error_code = esp_partition_erase_range(g_upgrade_config->partition,
+                                                  g_upgrade_config->delta_offset,
+                                                  g_upgrade_config->partition->size - g_upgrade_config->delta_offset);
+            MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK, g_upgrade_config->status.error_code,
+                            "esp_partition_erase_range failed, error_code: %x", g_upgrade_config->status.error_code);
+        }
     }
 
     /**< Write OTA update data to partition */
-    g_upgrade_config->status.error_code = esp_ota_write(g_upgrade_config->handle, data, size);
+    if (g_upgrade_config->delta_offset) {
+        MDF_ERROR_CHECK(size > g_upgrade_config->status.total_size - g_upgrade_config->status.written_size,
+                        MDF_ERR_INVALID_ARG, "The patch is longer than total_size");
+        g_upgrade_config->status.error_code = esp_partition_write(g_upgrade_config->partition,
+                                              g_upgrade_config->delta_offset + g_upgrade_config->status.written_size,
+                                              data, size);
+    } else {
+        g_upgrade_config->status.error_code = esp_ota_write(g_upgrade_config->handle, data, size);
+    }
+
     MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK, g_upgrade_config->status.error_code,
                     "esp_ota_write failed, error_code: %x", g_upgrade_config->status.error_code);
 
@@ -111,10 +202,21 @@ mdf_err_t mupgrade_firmware_download_finished(size_t total_size)
 
     g_upgrade_config->status.total_size = total_size;
 
-    /**< Finish OTA update and validate newly written app image. */
-    g_upgrade_config->status.error_code = esp_ota_end(g_upgrade_config->handle);
-    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
-                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "esp_ota_end");
+    if (g_upgrade_config->delta_offset) {
+        /**< Nothing is written through the OTA handle, esp_ota_end only releases it */
+        esp_ota_end(g_upgrade_config->handle);
+
+        /**< Rebuild the new image from the patch, the patch is still sent to the devices */
+        g_upgrade_config->status.error_code = mupgrade_delta_apply(update_partition, g_upgrade_config->delta_offset,
+                                              g_upgrade_config->status.total_size);
+        MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
+                        g_upgrade_config->status.error_code, "mupgrade_delta_apply");
+    } else {
+        /**< Finish OTA update and validate newly written app image. */
+        g_upgrade_config->status.error_code = esp_ota_end(g_upgrade_config->handle);
+        MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
+                        MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "esp_ota_end");
+    }
 
     /**< Check if the firmware is generated by this project */
     g_upgrade_config->status.error_code = mupgrade_firmware_check(update_partition);
@@ -159,7 +261,7 @@ static bool addrs_remove(uint8_t *addrs_list, size_t *addrs_num, const uint8_t *
     for (int i = 0; i < *addrs_num; i++, addrs_list += MWIFI_ADDR_LEN) {
         if (!memcmp(addrs_list, addr, MWIFI_ADDR_LEN)) {
             if (--(*addrs_num)) {
-                memcpy(addrs_list, addrs_list + MWIFI_ADDR_LEN, (*addrs_num - i) * MWIFI_ADDR_LEN);
+                memmove(addrs_list, addrs_list + MWIFI_ADDR_LEN, (*addrs_num - i) * MWIFI_ADDR_LEN);
             }
 
             return true;
@@ -169,7 +271,327 @@ static bool addrs_remove(uint8_t *addrs_list, size_t *addrs_num, const uint8_t *
     return false;
 }
 
-static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_result_t *result)
+/**
+ * @brief The status is followed by the address of the parent, it is sent by a
+ *        device that supports the relay and the compressed packets
+ */
+static bool mupgrade_status_extended(size_t size)
+{
+    return size == sizeof(mupgrade_status_t) + MWIFI_ADDR_LEN
+           || size == sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8 + MWIFI_ADDR_LEN;
+}
+
+static void mupgrade_group_add(mupgrade_group_t *group_list, const uint8_t *addr,
+                               const uint8_t *progress_array, bool extended)
+{
+    mupgrade_group_t *group  = NULL;
+    mupgrade_group_t *near   = NULL;
+    uint32_t near_distance   = UINT32_MAX;
+
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        if (!group_list[i].addrs_num) {
+            group = group ? group : group_list + i;
+            continue;
+        }
+
+        if (group_list[i].extended == extended
+                && !memcmp(group_list[i].progress_array, progress_array, MUPGRADE_PACKET_MAX_NUM / 8)) {
+            group = group_list + i;
+            goto APPEND;
+        }
+
+        uint32_t distance = 0;
+
+        for (int j = 0; j < MUPGRADE_PACKET_MAX_NUM / 8; ++j) {
+            distance += __builtin_popcount(group_list[i].progress_array[j] ^ progress_array[j]);
+        }
+
+        if (distance < near_distance) {
+            near_distance = distance;
+            near          = group_list + i;
+        }
+    }
+
+    if (group) {
+        memcpy(group->progress_array, progress_array, MUPGRADE_PACKET_MAX_NUM / 8);
+        group->extended = extended;
+    } else {
+        /**< All groups are in use, merge into the group with the closest gaps,
+             the group then receives the packets missing by any of its devices */
+        group = near;
+        group->extended &= extended;
+
+        for (int j = 0; j < MUPGRADE_PACKET_MAX_NUM / 8; ++j) {
+            group->progress_array[j] &= progress_array[j];
+        }
+    }
+
+APPEND:
+    group->addrs_num++;
+    group->addrs_list = MDF_REALLOC_RETRY(group->addrs_list, group->addrs_num * MWIFI_ADDR_LEN);
+    memcpy(group->addrs_list + (group->addrs_num - 1) * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+}
+
+static bool mupgrade_group_remove(mupgrade_group_t *group_list, const uint8_t *addr)
+{
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        if (addrs_remove(group_list[i].addrs_list, &group_list[i].addrs_num, addr)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void mupgrade_group_reset(mupgrade_group_t *group_list)
+{
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        group_list[i].addrs_num = 0;
+    }
+}
+
+static void mupgrade_group_free(mupgrade_group_t *group_list)
+{
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        MDF_FREE(group_list[i].addrs_list);
+    }
+}
+
+/**
+ * @brief Bit i is set if the devices of group i are missing the packet
+ */
+static uint32_t mupgrade_group_mask(const mupgrade_group_t *group_list, uint16_t seq)
+{
+    uint32_t mask = 0;
+
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        if (group_list[i].addrs_num && !MUPGRADE_GET_BITS(group_list[i].progress_array, seq)) {
+            mask |= 1UL << i;
+        }
+    }
+
+    return mask;
+}
+
+static bool mupgrade_group_extended(const mupgrade_group_t *group_list, uint32_t mask)
+{
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        if ((mask & (1UL << i)) && !group_list[i].extended) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t mupgrade_group_addrs(const mupgrade_group_t *group_list, uint32_t mask, uint8_t *addrs_list)
+{
+    size_t addrs_num = 0;
+
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        if (mask & (1UL << i)) {
+            memcpy(addrs_list + addrs_num * MWIFI_ADDR_LEN, group_list[i].addrs_list,
+                   group_list[i].addrs_num * MWIFI_ADDR_LEN);
+            addrs_num += group_list[i].addrs_num;
+        }
+    }
+
+    return addrs_num;
+}
+
+#ifdef CONFIG_MUPGRADE_RELAY
+
+static mupgrade_node_t *mupgrade_node_find(const uint8_t *addr)
+{
+    for (int i = 0; i < g_mupgrade_node_num; ++i) {
+        if (!memcmp(g_mupgrade_node_list[i].addr, addr, MWIFI_ADDR_LEN)) {
+            return g_mupgrade_node_list + i;
+        }
+    }
+
+    return NULL;
+}
+
+static void mupgrade_node_update(const mupgrade_queue_t *q_data)
+{
+    const mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
+    mupgrade_node_t *node           = NULL;
+    uint16_t packet_num             = (status->total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+    uint16_t missing_num            = packet_num;
+
+    /**< Only the devices that are able to relay report their parent */
+    if (!mupgrade_status_extended(q_data->size)) {
+        return;
+    }
+
+    if (!(node = mupgrade_node_find(q_data->src_addr))) {
+        g_mupgrade_node_list = MDF_REALLOC_RETRY(g_mupgrade_node_list,
+                               (g_mupgrade_node_num + 1) * sizeof(mupgrade_node_t));
+        node = g_mupgrade_node_list + g_mupgrade_node_num++;
+        memset(node, 0, sizeof(mupgrade_node_t));
+        memcpy(node->addr, q_data->src_addr, MWIFI_ADDR_LEN);
+        node->missing_num = packet_num;
+    }
+
+    memcpy(node->parent_addr, q_data->data + q_data->size - MWIFI_ADDR_LEN, MWIFI_ADDR_LEN);
+
+    if (status->written_size == status->total_size) {
+        node->flag |= MUPGRADE_NODE_FINISHED;
+        missing_num = 0;
+    } else if (q_data->size > sizeof(mupgrade_status_t) + MWIFI_ADDR_LEN) {
+        for (int seq = 0; seq < packet_num; ++seq) {
+            missing_num -= MUPGRADE_GET_BITS(status->progress_array, seq) ? 1 : 0;
+        }
+    }
+
+    if (node->flag & MUPGRADE_NODE_RELAYED) {
+        if (missing_num >= node->missing_num) {
+            MDF_LOGD("The relay of " MACSTR " made no progress", MAC2STR(node->addr));
+            node->flag |= MUPGRADE_NODE_NO_RELAY;
+        }
+
+        node->flag &= ~MUPGRADE_NODE_RELAYED;
+    }
+
+    node->missing_num = missing_num;
+}
+
+/**
+ * @brief The nearest ancestor of the device that has completed the upgrade
+ */
+static mupgrade_node_t *mupgrade_relay_find(const uint8_t *addr)
+{
+    mupgrade_node_t *node = mupgrade_node_find(addr);
+
+    if (!node || node->flag & MUPGRADE_NODE_NO_RELAY) {
+        return NULL;
+    }
+
+    /**< The number of steps is bounded in case the reported parents form a loop */
+    for (int i = 0; i < g_mupgrade_node_num; ++i) {
+        if (!(node = mupgrade_node_find(node->parent_addr))) {
+            return NULL;
+        }
+
+        if (node->flag & MUPGRADE_NODE_FINISHED) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Hand the devices that have a relay over to it, these devices are removed from the groups
+ */
+static mdf_err_t mupgrade_relay_dispatch(mupgrade_group_t *group_list)
+{
+    mdf_err_t ret               = MDF_OK;
+    mwifi_data_type_t data_type = {.upgrade = true};
+    mupgrade_relay_t *request   = MDF_MALLOC(MWIFI_PAYLOAD_LEN);
+    MDF_ERROR_CHECK(!request, MDF_ERR_NO_MEM, "");
+
+    request->type       = MUPGRADE_TYPE_RELAY;
+    request->total_size = g_upgrade_config->status.total_size;
+    memcpy(request->name, g_upgrade_config->status.name, sizeof(request->name));
+
+    for (int i = 0; i < CONFIG_MUPGRADE_GROUP_MAX_NUM; ++i) {
+        mupgrade_group_t *group = group_list + i;
+
+        for (int j = 0; j < group->addrs_num;) {
+            mupgrade_node_t *relay = mupgrade_relay_find(group->addrs_list + j * MWIFI_ADDR_LEN);
+
+            if (!relay) {
+                ++j;
+                continue;
+            }
+
+            request->addrs_num = 0;
+            memcpy(request->progress_array, group->progress_array, MUPGRADE_PACKET_MAX_NUM / 8);
+
+            for (int k = j; k < group->addrs_num && request->addrs_num < MUPGRADE_RELAY_ADDRS_MAX_NUM;) {
+                uint8_t *addr = group->addrs_list + k * MWIFI_ADDR_LEN;
+
+                if (mupgrade_relay_find(addr) != relay) {
+                    ++k;
+                    continue;
+                }
+
+                mupgrade_node_find(addr)->flag |= MUPGRADE_NODE_RELAYED;
+                memcpy(request->addrs_list + request->addrs_num++ * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+                addrs_remove(group->addrs_list, &group->addrs_num, addr);
+            }
+
+            MDF_LOGD("Relay, addr: " MACSTR ", addrs_num: %d", MAC2STR(relay->addr), request->addrs_num);
+            ret = mwifi_root_write(relay->addr, 1, &data_type, request,
+                                   sizeof(mupgrade_relay_t) + request->addrs_num * MWIFI_ADDR_LEN, true);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_root_write", mdf_err_to_name(ret));
+        }
+    }
+
+    MDF_FREE(request);
+    return MDF_OK;
+}
+
+#endif /**< CONFIG_MUPGRADE_RELAY */
+
+static BaseType_t mupgrade_queue_receive(mupgrade_queue_t **q_data, TickType_t wait_ticks)
+{
+    BaseType_t ret = xQueueReceive(g_upgrade_config->queue, q_data, wait_ticks);
+
+#ifdef CONFIG_MUPGRADE_RELAY
+
+    if (ret == pdTRUE) {
+        mupgrade_node_update(*q_data);
+    }
+
+#endif /**< CONFIG_MUPGRADE_RELAY */
+
+    return ret;
+}
+
+/**
+ * @brief Length of the firmware that is in flash, esp_ota_write keeps the bytes that do
+ *        not fill a 16-byte block of an encrypted partition until the next write
+ */
+static size_t mupgrade_download_flushed_size()
+{
+    size_t size = g_upgrade_config->status.written_size;
+
+    if (g_upgrade_config->partition->encrypted && !g_upgrade_config->delta_offset) {
+        size &= ~(MUPGRADE_ENCRYPTED_BLOCK_SIZE - 1);
+    }
+
+    return size;
+}
+
+/**
+ * @brief Wait until the packets up to seq are written to the update partition. The last
+ *        packet is only sent once the firmware is checked, so that no device completes
+ *        an invalid firmware
+ */
+static mdf_err_t mupgrade_download_wait(uint16_t seq, uint16_t packet_num)
+{
+    size_t size = (seq + 1) * MUPGRADE_PACKET_MAX_SIZE;
+
+    while (g_upgrade_config->status.error_code == MDF_OK && g_mupgrade_send_running_flag
+            && (seq >= packet_num - 1 || mupgrade_download_flushed_size() < size)) {
+        vTaskDelay(MUPGRADE_DOWNLOAD_WAIT_MS / portTICK_RATE_MS);
+    }
+
+    if (!g_mupgrade_send_running_flag) {
+        return MDF_ERR_MUPGRADE_STOP;
+    }
+
+    if (g_upgrade_config->status.error_code == MDF_OK
+            || g_upgrade_config->status.error_code == MDF_ERR_MUPGRADE_FIRMWARE_FINISH) {
+        return MDF_OK;
+    }
+
+    return g_upgrade_config->status.error_code;
+}
+
+static mdf_err_t mupgrade_request_status(mupgrade_group_t *group_list, mupgrade_result_t *result)
 {
     mdf_err_t ret                      = MDF_OK;
     mupgrade_queue_t *q_data           = NULL;
@@ -188,7 +610,7 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
     /**
      * @brief Remove the device that the firmware upgrade has completed.
      */
-    while (xQueueReceive(g_upgrade_config->queue, &q_data, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+    while (mupgrade_queue_receive(&q_data, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
         mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
 
         if (status->written_size == status->total_size) {
@@ -218,10 +640,11 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
     request_addrs = MDF_REALLOC_RETRY(NULL, result->unfinished_num * MWIFI_ADDR_LEN);
 
     memcpy(request_addrs, result->unfinished_addr, MWIFI_ADDR_LEN * request_num);
-    memset(progress_array, 0xFF, MUPGRADE_PACKET_MAX_NUM / 8);
+    mupgrade_group_reset(group_list);
 
     memcpy(&request_status, &g_upgrade_config->status, sizeof(mupgrade_status_t));
-    request_status.type = MUPGRADE_TYPE_STATUS;
+    request_status.type         = g_upgrade_config->delta_offset ? MUPGRADE_TYPE_DELTA : MUPGRADE_TYPE_STATUS;
+    request_status.written_size = 0;
 
     /**
      * @brief Request all devices upgrade status from unfinished device.
@@ -233,8 +656,7 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
         }
 
         while (request_num > 0) {
-            ret = xQueueReceive(g_upgrade_config->queue, &q_data,
-                                CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS);
+            ret = mupgrade_queue_receive(&q_data, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS);
 
             if (ret != pdTRUE) {
                 MDF_LOGD("xQueueReceive failed");
@@ -261,18 +683,7 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
                 continue;
             }
 
-            /**< The device have not completed firmware upgrade. */
-            if (response_status->written_size != response_status->total_size) {
-                result->requested_num++;
-                result->requested_addr = MDF_REALLOC_RETRY(result->requested_addr,
-                                         result->requested_num * MWIFI_ADDR_LEN);
-                memcpy(result->requested_addr + (result->requested_num - 1) * MWIFI_ADDR_LEN,
-                       q_data->src_addr, MWIFI_ADDR_LEN);
-            }
-
-            if (response_status->written_size == 0) {
-                memset(progress_array, 0x0, MUPGRADE_PACKET_MAX_NUM / 8);
-            } else if (response_status->written_size == response_status->total_size) {
+            if (response_status->written_size == response_status->total_size) {
                 if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
                     MDF_LOGW("The device has been removed from the list waiting for the upgrade");
                     MDF_FREE(q_data);
@@ -284,11 +695,26 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
                                          result->successed_num * MWIFI_ADDR_LEN);
                 memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
                        q_data->src_addr, MWIFI_ADDR_LEN);
+                MDF_FREE(q_data);
+                continue;
+            }
+
+            /**< The device have not completed firmware upgrade. */
+            result->requested_num++;
+            result->requested_addr = MDF_REALLOC_RETRY(result->requested_addr,
+                                     result->requested_num * MWIFI_ADDR_LEN);
+            memcpy(result->requested_addr + (result->requested_num - 1) * MWIFI_ADDR_LEN,
+                   q_data->src_addr, MWIFI_ADDR_LEN);
+
+            /**< Only a device that has written part of the firmware responds with its progress */
+            bool extended = mupgrade_status_extended(q_data->size);
+
+            if (response_status->written_size == 0
+                    || q_data->size < sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8) {
+                static const uint8_t s_empty_progress[MUPGRADE_PACKET_MAX_NUM / 8] = {0};
+                mupgrade_group_add(group_list, q_data->src_addr, s_empty_progress, extended);
             } else {
-                /**< Update upgrade progress. */
-                for (int i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; i++) {
-                    progress_array[i] &= response_status->progress_array[i];
-                }
+                mupgrade_group_add(group_list, q_data->src_addr, response_status->progress_array, extended);
             }
 
             MDF_FREE(q_data);
@@ -302,18 +728,168 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
         ret = MDF_ERR_MUPGRADE_SEND_PACKET_LOSS;
     }
 
-    for (int i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
-        if (progress_array[i] != 0xFF) {
-            ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
-            MDF_LOGD("MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE");
-            break;
-        }
+    if (result->requested_num > 0) {
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
+        MDF_LOGD("MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE");
     }
 
     MDF_FREE(request_addrs);
     return ret;
 }
 
+static void mupgrade_rate_decrease(mupgrade_rate_t *rate, const char *reason)
+{
+    rate->delay_us = MIN(MAX(rate->delay_us * 2, MUPGRADE_RATE_DELAY_STEP_US * 8), MUPGRADE_RATE_DELAY_MAX_US);
+    rate->hold_num = MUPGRADE_RATE_HOLD_NUM;
+    MDF_LOGD("Decrease the send rate, reason: %s, delay: %dus", reason, rate->delay_us);
+}
+
+/**
+ * @brief Compare the packets sent in the round with the packets still missing
+ *        reported by the devices
+ */
+static void mupgrade_rate_round(mupgrade_rate_t *rate, const mupgrade_group_t *group_list, uint16_t packet_num)
+{
+    uint16_t lost_num = 0;
+
+    for (uint16_t seq = 0; seq < packet_num && rate->sent_num; ++seq) {
+        if (MUPGRADE_GET_BITS(rate->sent_array, seq) && mupgrade_group_mask(group_list, seq)) {
+            lost_num++;
+        }
+    }
+
+    MDF_LOGI("Send rate, sent_num: %d, lost_num: %d, delay: %dus", rate->sent_num, lost_num, rate->delay_us);
+
+    if (lost_num * 100 > rate->sent_num * MUPGRADE_RATE_LOSS_PERCENT) {
+        mupgrade_rate_decrease(rate, "packet loss");
+    }
+
+    rate->sent_num = 0;
+    memset(rate->sent_array, 0, sizeof(rate->sent_array));
+}
+
+static mdf_err_t mupgrade_packet_write(mupgrade_rate_t *rate, const uint8_t *addrs_list, size_t addrs_num,
+                                       const void *packet, size_t size)
+{
+    mdf_err_t ret             = MDF_OK;
+    mwifi_data_type_t type    = {.upgrade = true, .communicate = MWIFI_COMMUNICATE_MULTICAST};
+    mesh_tx_pending_t pending = {0};
+
+    ret = mwifi_root_write(addrs_list, addrs_num, &type, packet, size, true);
+    esp_mesh_get_tx_pending(&pending);
+
+    if (rate->hold_num > 0) {
+        rate->hold_num--;
+    } else if (ret != MDF_OK) {
+        mupgrade_rate_decrease(rate, mdf_err_to_name(ret));
+    } else if (pending.to_child > MUPGRADE_RATE_PENDING_NUM) {
+        mupgrade_rate_decrease(rate, "tx pending");
+    } else {
+        rate->delay_us -= MIN(rate->delay_us, MAX(rate->delay_us / 16, MUPGRADE_RATE_DELAY_STEP_US));
+    }
+
+    /**< Flow control for sending data in ota, the delays shorter than a tick add up */
+    rate->wait_us += rate->delay_us;
+
+    if (rate->wait_us >= portTICK_PERIOD_MS * 1000) {
+        vTaskDelay(rate->wait_us / (portTICK_PERIOD_MS * 1000));
+        rate->wait_us %= portTICK_PERIOD_MS * 1000;
+    }
+
+    return ret;
+}
+
+#if CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0
+/**
+ * @brief Add a packet to the parity of its block, the parity is only valid if all packets
+ *        of the block were sent in order to the same devices
+ *
+ * @return true if the parity packet of the block is complete and should be sent
+ */
+static bool mupgrade_parity_update(mupgrade_packet_t *parity, uint32_t *parity_mask, uint32_t mask,
+                                   uint16_t seq, const uint8_t *data, size_t size, uint16_t packet_num)
+{
+    uint16_t block_offset = seq % CONFIG_MUPGRADE_FEC_BLOCK_SIZE;
+
+    if (block_offset == 0 || mask != *parity_mask || parity->size != block_offset) {
+        memset(parity->data, 0, MUPGRADE_PACKET_MAX_SIZE);
+        parity->seq  = seq - block_offset;
+        parity->size = (block_offset == 0) ? 0 : UINT16_MAX;
+        *parity_mask = mask;
+    }
+
+    if (parity->size == block_offset) {
+        for (int i = 0; i < size; ++i) {
+            parity->data[i] ^= data[i];
+        }
+
+        parity->size++;
+    }
+
+    return parity->size >= 2 && parity->size != UINT16_MAX
+           && (parity->size == CONFIG_MUPGRADE_FEC_BLOCK_SIZE || seq == packet_num - 1);
+}
+#endif /**< CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0 */
+
+#ifdef CONFIG_MUPGRADE_COMPRESS
+/**
+ * @brief Compress the packets from seq into a zlib stream that is sent in fewer
+ *        MUPGRADE_TYPE_DEFLATE fragments than the packets
+ */
+static mdf_err_t mupgrade_deflate(uint16_t seq, uint16_t span_num, uint8_t *span_data,
+                                  uint8_t *stream, size_t *stream_size)
+{
+    mdf_err_t ret          = MDF_OK;
+    mz_ulong deflate_size  = (span_num - 1) * MUPGRADE_PACKET_MAX_SIZE;
+    size_t span_size       = MIN(span_num * MUPGRADE_PACKET_MAX_SIZE,
+                                 g_upgrade_config->status.total_size - seq * MUPGRADE_PACKET_MAX_SIZE);
+
+    ret = esp_partition_read(g_upgrade_config->partition,
+                             g_upgrade_config->delta_offset + seq * MUPGRADE_PACKET_MAX_SIZE,
+                             span_data, span_size);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> Read data from Flash", mdf_err_to_name(ret));
+
+    /**< MZ_BUF_ERROR if the stream does not save a packet */
+    ret = compress(stream, &deflate_size, span_data, span_size);
+
+    if (ret != MZ_OK) {
+        MDF_LOGD("<%s> Compress, seq: %d, span_size: %d", mz_error(ret), seq, span_size);
+        return MDF_FAIL;
+    }
+
+    MDF_LOGD("Compress, seq: %d, span_size: %d, deflate_size: %d, ratio: %d%%",
+             seq, span_size, (int)deflate_size, (int)(deflate_size * 100 / span_size));
+    *stream_size = deflate_size;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Send a zlib stream in MUPGRADE_TYPE_DEFLATE fragments
+ */
+static mdf_err_t mupgrade_deflate_write(mupgrade_rate_t *rate, const uint8_t *addrs_list, size_t addrs_num,
+                                        mupgrade_deflate_t *fragment, const uint8_t *stream, size_t stream_size)
+{
+    mdf_err_t ret = MDF_OK;
+
+    fragment->type         = MUPGRADE_TYPE_DEFLATE;
+    fragment->fragment_num = (stream_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
+
+    for (fragment->fragment_index = 0; fragment->fragment_index < fragment->fragment_num; ++fragment->fragment_index) {
+        size_t offset  = fragment->fragment_index * MUPGRADE_PACKET_MAX_SIZE;
+        fragment->size = MIN(MUPGRADE_PACKET_MAX_SIZE, stream_size - offset);
+        memcpy(fragment->data, stream + offset, fragment->size);
+
+        /**< The stream is useless without any of its fragments */
+        ret = mupgrade_packet_write(rate, addrs_list, addrs_num, fragment,
+                                    offsetof(mupgrade_deflate_t, data) + fragment->size);
+        MDF_ERROR_BREAK(ret != MDF_OK, "<%s> mupgrade_packet_write", mdf_err_to_name(ret));
+    }
+
+    return ret;
+}
+#endif /**< CONFIG_MUPGRADE_COMPRESS */
+
 mdf_err_t mupgrade_result_free(mupgrade_result_t *result)
 {
     MDF_PARAM_CHECK(result);
@@ -337,19 +913,50 @@ mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
     MDF_PARAM_CHECK(addrs_num > 0 && addrs_num <= esp_mesh_get_routing_table_size());
     MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
                     "Mupgrade firmware is not initialized");
+#ifdef CONFIG_MUPGRADE_PIPELINE
+    /**< The packets are sent as they are downloaded, the devices need the size of the firmware */
+    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_ERR_MUPGRADE_FIRMWARE_FINISH
+                    && (g_upgrade_config->status.error_code != MDF_OK
+                        || g_upgrade_config->status.total_size == OTA_SIZE_UNKNOWN),
+                    MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE, "mupgrade_firmware_download");
+#else
     MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_ERR_MUPGRADE_FIRMWARE_FINISH,
                     MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE, "mupgrade_firmware_download");
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
 
     mdf_err_t ret             = MDF_ERR_NO_MEM;
-    mwifi_data_type_t type    = {.upgrade = true, .communicate = MWIFI_COMMUNICATE_MULTICAST};
+    uint8_t broadcast_addr[]  = MWIFI_ADDR_BROADCAST;
     mupgrade_packet_t *packet = MDF_MALLOC(sizeof(mupgrade_packet_t));
-    uint8_t *progress_array   = MDF_MALLOC(MUPGRADE_PACKET_MAX_NUM / 8);
+    mupgrade_group_t *group_list = MDF_CALLOC(CONFIG_MUPGRADE_GROUP_MAX_NUM, sizeof(mupgrade_group_t));
     mupgrade_result_t *result = MDF_CALLOC(1, sizeof(mupgrade_result_t));
+    mupgrade_rate_t *rate     = MDF_CALLOC(1, sizeof(mupgrade_rate_t));
+    uint8_t *dest_addrs       = NULL;
+    size_t dest_num           = 0;
     g_mupgrade_send_running_flag = true;
 
+#if CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0
+    uint32_t parity_mask      = 0;
+    mupgrade_packet_t *parity = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    MDF_ERROR_GOTO(!parity, EXIT, "");
+    parity->type = MUPGRADE_TYPE_PARITY;
+    parity->size = UINT16_MAX;
+#endif /**< CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0 */
+
+#ifdef CONFIG_MUPGRADE_COMPRESS
+    size_t deflate_in_size       = 0;
+    size_t deflate_out_size      = 0;
+    mupgrade_deflate_t *fragment = MDF_MALLOC(sizeof(mupgrade_deflate_t));
+    uint8_t *span_data           = MDF_MALLOC(MUPGRADE_DEFLATE_PACKET_NUM * MUPGRADE_PACKET_MAX_SIZE);
+    uint8_t *stream              = MDF_MALLOC(MUPGRADE_DEFLATE_FRAGMENT_MAX_NUM * MUPGRADE_PACKET_MAX_SIZE);
+    MDF_ERROR_GOTO(!fragment || !span_data || !stream, EXIT, "");
+#endif /**< CONFIG_MUPGRADE_COMPRESS */
+
     MDF_ERROR_GOTO(!packet, EXIT, "");
-    MDF_ERROR_GOTO(!progress_array, EXIT, "");
+    MDF_ERROR_GOTO(!group_list, EXIT, "");
     MDF_ERROR_GOTO(!result, EXIT, "");
+    MDF_ERROR_GOTO(!rate, EXIT, "");
+
+    rate->delay_us = CONFIG_MUPGRADE_FLOW_CONTROL_LEVEL * 1000;
 
     /**
      * @brief If addrs_list is MWIFI_ADDR_ANY or MWIFI_ADDR_BROADCAST,
@@ -387,99 +994,193 @@ mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
     last_packet_size = (!last_packet_size) ? MUPGRADE_PACKET_MAX_SIZE : last_packet_size;
     packet->type = MUPGRADE_TYPE_DATA;
     packet->size = MUPGRADE_PACKET_MAX_SIZE;
-    g_upgrade_config->status.written_size = 0;
     MDF_LOGD("packet_num: %d, total_size: %d", packet_num, g_upgrade_config->status.total_size);
 
+    /**< A delta update is only known once the start of the firmware is downloaded */
+    ret = mupgrade_download_wait(0, packet_num);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Wait for the firmware to be downloaded", mdf_err_to_name(ret));
+
     for (int i = 0; i < CONFIG_MUPGRADE_RETRY_COUNT && result->unfinished_num > 0 && g_mupgrade_send_running_flag; ++i) {
 
         /**
          * @brief Request all devices upgrade status.
          */
-        if ((ret = mupgrade_request_status(progress_array, result)) == ESP_OK) {
+        if ((ret = mupgrade_request_status(group_list, result)) == ESP_OK) {
             break;
         }
 
         MDF_LOGD("Mupgrade_firmware_send unfinished_num: %d", result->unfinished_num);
+        mupgrade_rate_round(rate, group_list, packet_num);
 
         for (int i = 0; i < result->unfinished_num; ++i) {
             MDF_LOGD("Count: %d, addr: " MACSTR, i, MAC2STR(result->unfinished_addr + i * MWIFI_ADDR_LEN));
         }
 
+#ifdef CONFIG_MUPGRADE_RELAY
+        mupgrade_relay_dispatch(group_list);
+#endif /**< CONFIG_MUPGRADE_RELAY */
+
+        /**< The list of destinations only shrinks during a round */
+        MDF_FREE(dest_addrs);
+        dest_addrs = MDF_REALLOC_RETRY(NULL, (result->requested_num + 1) * MWIFI_ADDR_LEN);
+        uint32_t dest_mask = 0;
+
         for (packet->seq = 0; result->requested_num > 0 && packet->seq < packet_num && g_mupgrade_send_running_flag; ++packet->seq) {
-            if (!MUPGRADE_GET_BITS(progress_array, packet->seq)) {
-                packet->size = (packet->seq == packet_num - 1) ? last_packet_size : MUPGRADE_PACKET_MAX_SIZE;
-
-                /**
-                 * @brief Read firmware data from Flash to send to unfinished device.
-                 */
-                ret = esp_partition_read(g_upgrade_config->partition, packet->seq * MUPGRADE_PACKET_MAX_SIZE,
-                                         packet->data, packet->size);
-                MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", mdf_err_to_name(ret));
-
-                /**
-                 * @brief Remove the device have already completed firmware upgrade from unfinished and requested address list.
-                 */
-                for (mupgrade_queue_t *q_data = NULL; xQueueReceive(g_upgrade_config->queue, &q_data, 0);) {
-                    mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
-
-                    if (!status->written_size && (status->written_size == status->total_size)) {
-                        if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
-                            MDF_LOGW("The device has been removed from the list waiting for the upgrade");
-                            MDF_FREE(q_data);
-                            continue;
-                        }
-
-                        if (!addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr)) {
-                            MDF_LOGW("The device has been removed from the list of data sent for upgrade");
-                            MDF_FREE(q_data);
-                            continue;
-                        }
-
-                        result->successed_num++;
-                        result->successed_addr = MDF_REALLOC_RETRY(result->successed_addr,
-                                                 result->successed_num * MWIFI_ADDR_LEN);
-                        memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
-                               q_data->src_addr, MWIFI_ADDR_LEN);
-                    } else if (status->error_code == MDF_ERR_MUPGRADE_STOP) {
-                        addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr);
-                        addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr);
-                    }
+            if (!mupgrade_group_mask(group_list, packet->seq)) {
+                continue;
+            }
 
-                    MDF_FREE(q_data);
+            packet->size = (packet->seq == packet_num - 1) ? last_packet_size : MUPGRADE_PACKET_MAX_SIZE;
+
+            ret = mupgrade_download_wait(packet->seq, packet_num);
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Wait for the firmware to be downloaded", mdf_err_to_name(ret));
+
+            /**
+             * @brief Read firmware data from Flash to send to unfinished device.
+             */
+            ret = esp_partition_read(g_upgrade_config->partition,
+                                     g_upgrade_config->delta_offset + packet->seq * MUPGRADE_PACKET_MAX_SIZE,
+                                     packet->data, packet->size);
+            MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", mdf_err_to_name(ret));
+
+            /**
+             * @brief Remove the device have already completed firmware upgrade from unfinished and requested address list.
+             */
+            for (mupgrade_queue_t *q_data = NULL; mupgrade_queue_receive(&q_data, 0);) {
+                mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
+
+                if (status->written_size && (status->written_size == status->total_size)) {
+                    if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
+                        MDF_LOGW("The device has been removed from the list waiting for the upgrade");
+                        MDF_FREE(q_data);
+                        continue;
+                    }
 
-                    if (!result->unfinished_num) {
-                        goto EXIT;
+                    if (!addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr)) {
+                        MDF_LOGW("The device has been removed from the list of data sent for upgrade");
                     }
+
+                    mupgrade_group_remove(group_list, q_data->src_addr);
+                    dest_mask = 0;
+
+                    result->successed_num++;
+                    result->successed_addr = MDF_REALLOC_RETRY(result->successed_addr,
+                                             result->successed_num * MWIFI_ADDR_LEN);
+                    memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
+                           q_data->src_addr, MWIFI_ADDR_LEN);
+                } else if (status->error_code == MDF_ERR_MUPGRADE_STOP) {
+                    addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr);
+                    addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr);
+                    mupgrade_group_remove(group_list, q_data->src_addr);
+                    dest_mask = 0;
                 }
 
-                /**
-                 * @brief Send firmware data to unfinished devide.
-                 */
-                uint64_t start_us = esp_timer_get_time();
-
-                if ((MWIFI_ADDR_IS_ANY(addrs_list) || MWIFI_ADDR_IS_BROADCAST(addrs_list))
-                        && result->successed_num < 2 && addrs_num == 1) {
-                    MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, addrs_num);
-
-                    if (MWIFI_ADDR_IS_ANY(addrs_list) && result->successed_num == 1) {
-                        uint8_t broadcast_addr[] = MWIFI_ADDR_BROADCAST;
-                        ret = mwifi_root_write(broadcast_addr, addrs_num, &type,
-                                               packet, sizeof(mupgrade_packet_t), true);
-                    } else {
-                        ret = mwifi_root_write(addrs_list, addrs_num, &type,
-                                               packet, sizeof(mupgrade_packet_t), true);
-                    }
+                MDF_FREE(q_data);
+
+                if (!result->unfinished_num) {
+                    goto EXIT;
+                }
+            }
+
+            /**
+             * @brief Send the packet only to the groups of devices that are missing it.
+             */
+            uint32_t mask = mupgrade_group_mask(group_list, packet->seq);
+
+            if (!mask) {
+                continue;
+            }
+
+            if (mask != dest_mask) {
+                dest_mask = mask;
+                dest_num  = mupgrade_group_addrs(group_list, mask, dest_addrs);
+            }
+
+            /**
+             * @brief Send firmware data to unfinished devide.
+             */
+            const uint8_t *write_addrs = dest_addrs;
+            size_t write_num           = dest_num;
+
+            if ((MWIFI_ADDR_IS_ANY(addrs_list) || MWIFI_ADDR_IS_BROADCAST(addrs_list))
+                    && result->successed_num < 2 && addrs_num == 1 && dest_num == result->requested_num) {
+                write_addrs = (MWIFI_ADDR_IS_ANY(addrs_list) && result->successed_num == 1) ? broadcast_addr : addrs_list;
+                write_num   = addrs_num;
+            }
+
+            const uint8_t *span_data_ptr = packet->data;
+            uint16_t span_num            = 1;
+
+#ifdef CONFIG_MUPGRADE_COMPRESS
+            /**
+             * @brief The packets of a flash sector that are missing by the same devices
+             *        are compressed if all of these devices can inflate them, the stream
+             *        is sent if it takes fewer fragments than the packets.
+             */
+            if (packet->seq % MUPGRADE_DEFLATE_PACKET_NUM == 0 && mupgrade_group_extended(group_list, mask)) {
+                size_t stream_size = 0;
+
+                while (span_num < MUPGRADE_DEFLATE_PACKET_NUM && packet->seq + span_num < packet_num
+                        && mupgrade_group_mask(group_list, packet->seq + span_num) == mask) {
+                    span_num++;
+                }
+
+                if (span_num > 1 && mupgrade_download_wait(packet->seq + span_num - 1, packet_num) == MDF_OK
+                        && mupgrade_deflate(packet->seq, span_num, span_data, stream, &stream_size) == MDF_OK) {
+                    span_data_ptr        = span_data;
+                    fragment->seq        = packet->seq;
+                    fragment->packet_num = span_num;
+
+                    MDF_LOGD("seq: %d, span_num: %d, deflate_size: %d, addrs_num: %d",
+                             packet->seq, span_num, stream_size, write_num);
+                    ret = mupgrade_deflate_write(rate, write_addrs, write_num, fragment, stream, stream_size);
+
+                    deflate_in_size  += MIN(span_num * MUPGRADE_PACKET_MAX_SIZE,
+                                            g_upgrade_config->status.total_size - packet->seq * MUPGRADE_PACKET_MAX_SIZE);
+                    deflate_out_size += stream_size;
                 } else {
-                    MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, result->requested_num);
-                    ret = mwifi_root_write(result->requested_addr, result->requested_num, &type,
-                                           packet, sizeof(mupgrade_packet_t), true);
+                    span_num = 1;
                 }
+            }
 
-                uint64_t wait = (esp_timer_get_time() - start_us) * CONFIG_MUPGRADE_FLOW_CONTROL_LEVEL / 10;
-                vTaskDelay(pdMS_TO_TICKS(wait / 1000)); // flow control for sending data in ota
+#endif /**< CONFIG_MUPGRADE_COMPRESS */
+
+            /**< The packet is sent as it is if it was not compressed with the next ones */
+            if (span_num == 1) {
+                MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, write_num);
+                ret = mupgrade_packet_write(rate, write_addrs, write_num, packet, sizeof(mupgrade_packet_t));
+            }
 
-                MDF_ERROR_CONTINUE(ret != ESP_OK, "<%s> Mwifi root write", mdf_err_to_name(ret));
+            for (uint16_t j = 0; j < span_num; ++j) {
+                MUPGRADE_SET_BITS(rate->sent_array, packet->seq + j);
             }
+
+            rate->sent_num += span_num;
+
+#if CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0
+
+            /**
+             * @brief A parity packet is sent after a block of packets that were all sent
+             *        to the same devices, which lets them rebuild one lost packet of the block.
+             */
+            for (uint16_t j = 0; j < span_num; ++j) {
+                uint16_t seq = packet->seq + j;
+                size_t size  = (seq == packet_num - 1) ? last_packet_size : MUPGRADE_PACKET_MAX_SIZE;
+
+                if (mupgrade_parity_update(parity, &parity_mask, mask, seq,
+                                           span_data_ptr + j * MUPGRADE_PACKET_MAX_SIZE, size, packet_num)) {
+                    MDF_LOGD("parity, seq: %d, packet_num: %d, addrs_num: %d", parity->seq, parity->size, write_num);
+                    mupgrade_packet_write(rate, write_addrs, write_num, parity, sizeof(mupgrade_packet_t));
+                    parity->size = UINT16_MAX;
+                }
+            }
+
+#endif /**< CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0 */
+
+            /**< The compressed packets have been sent */
+            packet->seq += span_num - 1;
+
+            MDF_ERROR_CONTINUE(ret != ESP_OK, "<%s> Mwifi root write", mdf_err_to_name(ret));
         }
     }
 
@@ -500,9 +1201,36 @@ EXIT:
         MDF_FREE(q_data);
     }
 
+    if (group_list) {
+        mupgrade_group_free(group_list);
+    }
+
+#if CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0
+    MDF_FREE(parity);
+#endif /**< CONFIG_MUPGRADE_FEC_BLOCK_SIZE > 0 */
+
+#ifdef CONFIG_MUPGRADE_COMPRESS
+
+    if (deflate_in_size) {
+        MDF_LOGI("Compressed %d bytes of the firmware into %d bytes, ratio: %d%%",
+                 deflate_in_size, deflate_out_size, deflate_out_size * 100 / deflate_in_size);
+    }
+
+    MDF_FREE(fragment);
+    MDF_FREE(span_data);
+    MDF_FREE(stream);
+#endif /**< CONFIG_MUPGRADE_COMPRESS */
+
+#ifdef CONFIG_MUPGRADE_RELAY
+    MDF_FREE(g_mupgrade_node_list);
+    g_mupgrade_node_num = 0;
+#endif /**< CONFIG_MUPGRADE_RELAY */
+
     MDF_FREE(packet);
-    MDF_FREE(progress_array);
+    MDF_FREE(group_list);
+    MDF_FREE(dest_addrs);
     MDF_FREE(result);
+    MDF_FREE(rate);
 
     if (g_mupgrade_send_exit_sem) {
         xSemaphoreGive(g_mupgrade_send_exit_sem);
@@ -513,6 +1241,15 @@ EXIT:
 
 mdf_err_t mupgrade_firmware_stop()
 {
+#ifdef CONFIG_MUPGRADE_PIPELINE
+
+    /**< The packets that are not downloaded yet are never sent */
+    if (g_upgrade_config && g_upgrade_config->status.error_code == MDF_OK) {
+        g_upgrade_config->status.error_code = MDF_ERR_MUPGRADE_STOP;
+    }
+
+#endif /**< CONFIG_MUPGRADE_PIPELINE */
+
     if (!g_mupgrade_send_running_flag) {
         return MDF_OK;
     }
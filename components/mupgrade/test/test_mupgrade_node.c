@@ -0,0 +1,78 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "esp_system.h"
+#include "mdf_info_store.h"
+#include "mupgrade.h"
+#include "unity.h"
+
+#define TEST_PACKET_NUM    (21)
+#define TEST_FIRMWARE_SIZE ((TEST_PACKET_NUM - 1) * MUPGRADE_PACKET_MAX_SIZE + 300)
+
+static const char *TAG = "test_mupgrade";
+static const uint8_t g_root_addr[6] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x01};
+
+static void mupgrade_test_packet_send(const uint8_t *firmware, uint16_t seq)
+{
+    mupgrade_packet_t *packet = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    TEST_ASSERT_NOT_NULL(packet);
+
+    packet->type = MUPGRADE_TYPE_DATA;
+    packet->seq  = seq;
+    packet->size = MIN(MUPGRADE_PACKET_MAX_SIZE, TEST_FIRMWARE_SIZE - seq * MUPGRADE_PACKET_MAX_SIZE);
+    memcpy(packet->data, firmware + seq * MUPGRADE_PACKET_MAX_SIZE, packet->size);
+
+    /**< The response to the root fails without a mesh network */
+    mupgrade_handle(g_root_addr, packet, sizeof(mupgrade_packet_t));
+
+    MDF_FREE(packet);
+}
+
+/**
+ * @brief The packets lost in the first round are retransmitted after their sectors
+ *        have been evicted from the buffers, the image must still be written completely
+ */
+TEST_CASE("Retransmitted packets are written to flash", "[mupgrade]")
+{
+    mupgrade_status_t status  = {.type = MUPGRADE_TYPE_STATUS};
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    uint8_t *firmware = MDF_MALLOC(TEST_FIRMWARE_SIZE);
+    uint8_t *data     = MDF_MALLOC(TEST_FIRMWARE_SIZE);
+    TEST_ASSERT_NOT_NULL(partition);
+    TEST_ASSERT_NOT_NULL(firmware);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_EQUAL(MDF_OK, mdf_info_init());
+
+    esp_fill_random(firmware, TEST_FIRMWARE_SIZE);
+    snprintf(status.name, sizeof(status.name), "test_%08x", esp_random());
+    status.total_size = TEST_FIRMWARE_SIZE;
+    mupgrade_handle(g_root_addr, &status, sizeof(mupgrade_status_t));
+
+    for (int seq = 0; seq < TEST_PACKET_NUM; ++seq) {
+        if (seq % 7 != 1) {
+            mupgrade_test_packet_send(firmware, seq);
+        }
+    }
+
+    for (int seq = 1; seq < TEST_PACKET_NUM; seq += 7) {
+        mupgrade_test_packet_send(firmware, seq);
+    }
+
+    /**< The random image is rejected by esp_ota_set_boot_partition, but it is in flash */
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_read(partition, 0, data, TEST_FIRMWARE_SIZE));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(firmware, data, TEST_FIRMWARE_SIZE);
+
+    MDF_FREE(firmware);
+    MDF_FREE(data);
+}
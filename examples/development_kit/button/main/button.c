@@ -189,6 +189,19 @@ static mdf_err_t mlink_get_value(uint16_t cid, void *arg)
     return MDF_OK;
 }
 
+/**
+ * @brief The keys are changed by the driver instead of set_status,
+ *        so the triggers of the pressed keys are notified here
+ */
+static void button_trigger_notify()
+{
+    for (int cid = BUTTON_CID_KEY0; cid <= BUTTON_CID_KEY3; ++cid) {
+        if (button_key_get_status(cid) != BUTTON_KEY_NONE) {
+            mlink_trigger_notify(cid);
+        }
+    }
+}
+
 static void request_handle_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
@@ -428,6 +441,7 @@ static mdf_err_t button_mesh_mode()
     while (xEventGroupWaitBits(g_event_group_trigger,
                                EVENT_GROUP_BUTTON_KEY_LONG_PUSH | EVENT_GROUP_BUTTON_KEY_RELEASE,
                                pdTRUE, pdFALSE, portMAX_DELAY)) {
+        button_trigger_notify();
         ret = mlink_trigger_handle(MLINK_COMMUNICATE_MESH);
         button_key_reset_status();
         MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Data transmission failed", mdf_err_to_name(ret));
@@ -464,6 +478,8 @@ static mdf_err_t button_espnow_mode()
             continue;
         }
 
+        button_trigger_notify();
+
         if ((uxBits & EVENT_GROUP_BUTTON_KEY_LONG_PUSH)
                 && mdf_info_load(BUTTON_ESPNOW_CONFIG_STORE_KEY, &espnow_config, sizeof(mlink_espnow_config_t)) != MDF_OK) {
             mwifi_config_t ap_config        = {0x0};
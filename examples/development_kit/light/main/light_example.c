@@ -66,7 +66,8 @@ static void root_write_task(void *arg)
                  MAC2STR(src_addr), size, size, data);
 
         switch (mwifi_type.protocol) {
-            case MLINK_PROTO_HTTPD: { // use http protocol
+            case MLINK_PROTO_HTTPD:   // use http protocol
+            case MLINK_PROTO_BINARY: {
                 mlink_httpd_t httpd_data  = {
                     .size       = size,
                     .data       = data,
@@ -125,6 +126,7 @@ static void root_read_task(void *arg)
                  httpd_data->size, httpd_data->size, httpd_data->data);
 
         mwifi_type.group = httpd_data->group;
+        mwifi_type.protocol = (httpd_data->type.format == MLINK_HTTPD_FORMAT_HEX) ? MLINK_PROTO_BINARY : MLINK_PROTO_HTTPD;
         memcpy(&mwifi_type.custom, &httpd_data->type, sizeof(mlink_httpd_type_t));
 
         ret = mwifi_root_write(httpd_data->addrs_list, httpd_data->addrs_num,
@@ -213,8 +215,9 @@ void node_handle_task(void *arg)
 
         /*< Header information for http data */
         header_info = (mlink_httpd_type_t *)&mwifi_type.custom;
-        MDF_ERROR_GOTO(header_info->format != MLINK_HTTPD_FORMAT_JSON, FREE_MEM,
-                       "The current version only supports the json protocol");
+        MDF_ERROR_GOTO(header_info->format != MLINK_HTTPD_FORMAT_JSON
+                       && mwifi_type.protocol != MLINK_PROTO_BINARY, FREE_MEM,
+                       "The current version only supports the json and the binary protocol");
 
         /**
          * @brief Delayed call to achieve synchronous execution
@@ -222,7 +225,8 @@ void node_handle_task(void *arg)
         char tsf_time_str[16] = {0x0};
         int64_t delay_ticks   = 0;
 
-        if (mlink_json_parse((char *)data, "tsf_time", tsf_time_str) == MDF_OK) {
+        if (mwifi_type.protocol != MLINK_PROTO_BINARY
+                && mlink_json_parse((char *)data, "tsf_time", tsf_time_str) == MDF_OK) {
             int64_t tsf_time_us = 0;
             sscanf(tsf_time_str, "%llu", &tsf_time_us);
             delay_ticks = pdMS_TO_TICKS((tsf_time_us - esp_mesh_get_tsf_time()) / 1000);
@@ -245,13 +249,19 @@ void node_handle_task(void *arg)
         mlink_handle_data_t handle_data = {
             .req_data    = (char *)data,
             .req_size    = size,
-            .req_fromat  = MLINK_HTTPD_FORMAT_JSON,
+            .req_fromat  = (mwifi_type.protocol == MLINK_PROTO_BINARY) ? MLINK_HTTPD_FORMAT_HEX : MLINK_HTTPD_FORMAT_JSON,
             .resp_data   = NULL,
             .resp_size   = 0,
             .resp_fromat = MLINK_HTTPD_FORMAT_JSON,
         };
         ret = mlink_handle_request(&handle_data);
-        MDF_ERROR_GOTO(ret != MDF_OK, FREE_MEM, "<%s> mlink_handle", mdf_err_to_name(ret));
+
+        /**< A binary response carries the status code, it is sent even if the request failed */
+        if (ret != MDF_OK && handle_data.resp_fromat != MLINK_HTTPD_FORMAT_HEX) {
+            MDF_LOGW("<%s> mlink_handle", mdf_err_to_name(ret));
+            MDF_FREE(handle_data.resp_data);
+            goto FREE_MEM;
+        }
 
         if (handle_data.resp_fromat == MLINK_HTTPD_FORMAT_JSON) {
             mlink_json_pack(&handle_data.resp_data, "status_msg", mdf_err_to_name(ret));
@@ -277,8 +287,8 @@ void node_handle_task(void *arg)
             header_info->format = handle_data.resp_fromat;
             header_info->from   = MLINK_HTTPD_FROM_DEVICE;
 
-            mwifi_type.protocol = MLINK_PROTO_HTTPD;
-            mwifi_type.compression = true;
+            mwifi_type.protocol = (handle_data.resp_fromat == MLINK_HTTPD_FORMAT_HEX) ? MLINK_PROTO_BINARY : MLINK_PROTO_HTTPD;
+            mwifi_type.compression = (handle_data.resp_fromat != MLINK_HTTPD_FORMAT_HEX);
             ret = mwifi_write(dest_addr, &mwifi_type, handle_data.resp_data, handle_data.resp_size, true);
 
             if (handle_data.resp_fromat == MLINK_HTTPD_FORMAT_HEX) {
@@ -306,12 +316,13 @@ FREE_MEM:
  */
 static void espnow_to_mwifi_task(void *arg)
 {
-    mdf_err_t ret       = MDF_OK;
-    uint8_t *data       = NULL;
-    uint8_t *addrs_list = NULL;
-    size_t addrs_num    = 0;
-    size_t size         = 0;
-    uint32_t type       = 0;
+    mdf_err_t ret             = MDF_OK;
+    const uint8_t *data       = NULL;
+    const uint8_t *addrs_list = NULL;
+    size_t addrs_num          = 0;
+    size_t size               = 0;
+    uint32_t type             = 0;
+    uint8_t *buf              = MDF_MALLOC(MLINK_ESPNOW_BUF_SIZE);
 
     mwifi_data_type_t mwifi_type = {
         .protocol = MLINK_PROTO_HTTPD,
@@ -325,10 +336,18 @@ static void espnow_to_mwifi_task(void *arg)
 
     memcpy(&mwifi_type.custom, &header_info, sizeof(mlink_httpd_type_t));
 
-    while (mlink_espnow_read(&addrs_list, &addrs_num, &data, &size, &type, portMAX_DELAY) == MDF_OK) {
+    while (buf) {
+        ret = mlink_espnow_read_buf(buf, MLINK_ESPNOW_BUF_SIZE, &addrs_list, &addrs_num,
+                                    &data, &size, &type, portMAX_DELAY);
+        MDF_ERROR_BREAK(ret == MDF_ERR_NOT_INIT || ret == ESP_ERR_ESPNOW_NOT_INIT,
+                        "<%s> mlink_espnow_read_buf", mdf_err_to_name(ret));
+
+        /**< A malformed packet or a lost fragment only drops that packet */
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mlink_espnow_read_buf", mdf_err_to_name(ret));
+
         /*< Send to yourself if the destination address is empty */
         if (MWIFI_ADDR_IS_EMPTY(addrs_list) && addrs_num == 1) {
-            esp_wifi_get_mac(ESP_IF_WIFI_STA, addrs_list);
+            esp_wifi_get_mac(ESP_IF_WIFI_STA, (uint8_t *)addrs_list);
         }
 
         mwifi_type.group = (type == MLINK_ESPNOW_COMMUNICATE_GROUP) ? true : false;
@@ -338,11 +357,9 @@ static void espnow_to_mwifi_task(void *arg)
             ret = mwifi_write(addrs_list  + 6 * i, &mwifi_type, data, size, true);
             MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_write", mdf_err_to_name(ret));
         }
-
-        MDF_FREE(data);
-        MDF_FREE(addrs_list);
     }
 
+    MDF_FREE(buf);
     MDF_LOGW("espnow_to_mwifi_task is exit");
     vTaskDelete(NULL);
 }
@@ -480,6 +480,7 @@ static void trigger_handle_task(void *arg)
     int16_t temp = 0;
     int16_t hum = 0;
     float lum = 0;
+    bool lum_out_of_range = false;
     sense_work_mode_t work_mode = sense_work_mode_get();
 
     do {
@@ -489,7 +490,22 @@ static void trigger_handle_task(void *arg)
 
         MDF_LOGI("luminance: %f, humidity: %f, temperature: %f", lum, hum / 10.0, temp / 10.0);
 
-        if (lum < SENSE_LUMINANCE_THRESHOLD_LOW || lum > SENSE_LUMINANCE_THRESHOLD_UPPER) {
+#ifdef CONFIG_MLINK_SHADOW_REPORT
+
+        /**< The shadow on the root is updated when the luminance crosses a threshold */
+        if ((lum < SENSE_LUMINANCE_THRESHOLD_LOW || lum > SENSE_LUMINANCE_THRESHOLD_UPPER) != lum_out_of_range
+                && mwifi_is_connected()) {
+            mlink_shadow_report((uint16_t []) {CID_LUM}, 1);
+        }
+
+#endif /**< CONFIG_MLINK_SHADOW_REPORT */
+
+        lum_out_of_range = lum < SENSE_LUMINANCE_THRESHOLD_LOW || lum > SENSE_LUMINANCE_THRESHOLD_UPPER;
+
+        if (lum_out_of_range) {
+            /**< The luminance is measured here instead of set by set_status */
+            mlink_trigger_notify(CID_LUM);
+
             if (mlink_trigger_handle(MLINK_COMMUNICATE_MESH) != MDF_OK) {
                 MDF_LOGE("mlink trigger handle error");
             }
@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Generate the patch of a mupgrade delta update, see mupgrade_delta_head_t in
+components/mupgrade/include/mupgrade.h. The patch is downloaded by the root
+in place of the firmware and only applies to devices running the base image.
+"""
+
+from __future__ import print_function
+import argparse
+import hashlib
+import struct
+import sys
+
+DELTA_MAGIC = 0x4450554d
+DELTA_CMD_COPY = 0x1
+DELTA_CMD_INSERT = 0x2
+
+# Length of the blocks of the base image that are searched in the new image,
+# a shorter match costs more as a command than as inserted data
+BLOCK_SIZE = 32
+
+
+def gen_commands(base, image):
+    """
+    Find the blocks of the new image that are in the base image and extend each
+    match as far as possible, the remaining data is inserted
+    """
+    index = {}
+    for offset in range(len(base) - BLOCK_SIZE, -1, -BLOCK_SIZE):
+        index[base[offset:offset + BLOCK_SIZE]] = offset
+
+    commands = []
+    insert_start = 0
+    i = 0
+
+    while i + BLOCK_SIZE <= len(image):
+        base_offset = index.get(image[i:i + BLOCK_SIZE])
+
+        if base_offset is None:
+            i += 1
+            continue
+
+        start, base_start = i, base_offset
+        while start > insert_start and base_start > 0 and image[start - 1] == base[base_start - 1]:
+            start -= 1
+            base_start -= 1
+
+        end = i + BLOCK_SIZE
+        base_end = base_offset + BLOCK_SIZE
+        while end < len(image) and base_end < len(base) and image[end] == base[base_end]:
+            end += 1
+            base_end += 1
+
+        if start > insert_start:
+            commands.append((DELTA_CMD_INSERT, 0, image[insert_start:start]))
+
+        commands.append((DELTA_CMD_COPY, base_start, end - start))
+        insert_start = i = end
+
+    if insert_start < len(image):
+        commands.append((DELTA_CMD_INSERT, 0, image[insert_start:]))
+
+    return commands
+
+
+def gen_patch(base, image):
+    patch = bytearray(struct.pack('<II32sI32s', DELTA_MAGIC,
+                                  len(base), hashlib.sha256(base).digest(),
+                                  len(image), hashlib.sha256(image).digest()))
+
+    for cmd_type, offset, value in gen_commands(base, image):
+        if cmd_type == DELTA_CMD_COPY:
+            patch += struct.pack('<BII', cmd_type, offset, value)
+        else:
+            patch += struct.pack('<BII', cmd_type, offset, len(value))
+            patch += value
+
+    return patch
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the patch of a mupgrade delta update')
+    parser.add_argument('base', help='Image running on the devices')
+    parser.add_argument('image', help='New image')
+    parser.add_argument('output', help='Path of the generated patch')
+    args = parser.parse_args()
+
+    with open(args.base, 'rb') as f:
+        base = f.read()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    patch = gen_patch(base, image)
+
+    with open(args.output, 'wb') as f:
+        f.write(patch)
+
+    print('Patch size: %d, image size: %d (%d%%)' % (len(patch), len(image), len(patch) * 100 // max(len(image), 1)))
+
+    if len(patch) >= len(image):
+        print('The patch is not smaller than the image, send the image instead', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()